@@ -0,0 +1,170 @@
+//=================================================================================================
+// await_bench - Compares the cost of delivering interrupts to coroutines that co_await them with
+//               the cost of the virtual isr() callback
+//
+// As in dispatch_bench, the "interrupt controller" is an ordinary block of memory, so what's being
+// measured is the cost of getting from topLevelHandler() to the code that handles the interrupt.
+// Every heap allocation made while the clock is running is counted; there should be none.
+//
+// Usage: await_bench [iterations]
+//=================================================================================================
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <new>
+#include "AwaitableController.h"
+#include "CpuUtil.h"
+
+// The number of heap allocations made so far
+static std::atomic<uint64_t> allocations{0};
+
+void* operator new(size_t size)
+{
+    ++allocations;
+    void* ptr = malloc(size ? size : 1);
+    if (ptr == nullptr) throw std::bad_alloc();
+    return ptr;
+}
+void operator delete(void* ptr) noexcept              {free(ptr);}
+void operator delete(void* ptr, size_t size) noexcept {free(ptr);}
+
+// Handlers do a trivial amount of work that the compiler can't throw away
+static std::atomic<uint64_t> delivered{0};
+
+//================================================================================
+// This is the traditional way of servicing interrupts: override isr()
+//================================================================================
+class VirtualHandler : public IntrControlBase
+{
+protected:
+
+    virtual void isr(uint32_t pending, int IRQ, uint32_t count)
+    {
+        delivered.fetch_add(count, std::memory_order_relaxed);
+    }
+};
+//================================================================================
+
+
+//================================================================================
+// waiter() - A coroutine that handles one IRQ forever
+//================================================================================
+static IrqTask waiter(AwaitableController& controller, int irq)
+{
+    while (true)
+    {
+        uint32_t count = co_await controller.irq(irq);
+        delivered.fetch_add(count, std::memory_order_relaxed);
+    }
+}
+//================================================================================
+
+
+//================================================================================
+// This describes one run of the benchmark
+//================================================================================
+struct result_t
+{
+    double   nsPerCall;
+    double   nsPerDelivery;
+    uint64_t allocations;
+};
+//================================================================================
+
+
+//================================================================================
+// measure() - Calls topLevelHandler() "iterations" times with "pending" IRQs
+//             pending, and waits until every count has been delivered.
+//             "fanout" is the number of handlers each IRQ has.
+//================================================================================
+static result_t measure(IntrControlBase& controller, uint32_t* regs, uint32_t pending,
+                        int fanout, int iterations)
+{
+    // Fake up the pending register and a counter for every IRQ
+    regs[0] = pending;
+    for (int i=0; i<32; ++i) regs[32 + i] = 1;
+
+    // Every call delivers a count of 1 to every handler of every pending IRQ
+    uint64_t expected = (uint64_t)__builtin_popcount(pending) * fanout * iterations;
+
+    // Warm up the caches and the branch predictors
+    for (int i=0; i<iterations/10; ++i) controller.topLevelHandler();
+    while (delivered.exchange(0) != 0) usleep(10000);
+
+    // And time the real thing
+    uint64_t allocated = allocations;
+    uint64_t start = nowNs();
+    for (int i=0; i<iterations; ++i) controller.topLevelHandler();
+    while (delivered < expected) cpuRelax();
+    uint64_t elapsed = nowNs() - start;
+
+    result_t result;
+    result.nsPerCall     = (double)elapsed / iterations;
+    result.nsPerDelivery = (double)elapsed / expected;
+    result.allocations   = allocations - allocated;
+    return result;
+}
+//================================================================================
+
+
+//================================================================================
+// report() - Prints one line of results
+//================================================================================
+static void report(const char* name, uint32_t pending, int waiters, result_t r)
+{
+    printf("%-18s 0x%08X %8d %12.2f %14.2f %7lu\n",
+        name, pending, waiters, r.nsPerCall, r.nsPerDelivery, r.allocations);
+}
+//================================================================================
+
+
+//================================================================================
+// main() - Times the callback and both kinds of executor
+//================================================================================
+int main(int argc, char** argv)
+{
+    static uint32_t virtualRegs[64], inlineRegs[64], threadRegs[64];
+    static uint32_t fanoutRegs[64];
+
+    // The number of iterations can be given on the command line
+    int iterations = (argc > 1) ? atoi(argv[1]) : 1000000;
+
+    // A controller that calls isr(), and controllers that resume coroutines in the
+    // monitor's thread and in a thread of their own
+    IrqThreadExecutor   executor;
+    VirtualHandler      virtualHandler;
+    AwaitableController inlineController, threadController(&executor);
+    AwaitableController fanoutController;
+
+    virtualHandler  .initialize((uint8_t*)virtualRegs, 0);
+    inlineController.initialize((uint8_t*)inlineRegs,  0);
+    threadController.initialize((uint8_t*)threadRegs,  0);
+    fanoutController.initialize((uint8_t*)fanoutRegs,  0);
+
+    // One coroutine per IRQ on the first two, and 1024 logical waiters spread
+    // across the IRQs of the last one
+    const int FANOUT = 32;
+    for (int irq=0; irq<32; ++irq)
+    {
+        waiter(inlineController, irq);
+        waiter(threadController, irq);
+        for (int i=0; i<FANOUT; ++i) waiter(fanoutController, irq);
+    }
+
+    // These are the bitmaps of pending IRQs that we'll try
+    const uint32_t pattern[] = {0x00000001, 0x00000007, 0x80000005, 0xFFFFFFFF};
+
+    printf("%-18s %-10s %8s %12s %14s %7s\n", "path", "pending", "waiters", "ns/call", "ns/delivery", "allocs");
+
+    for (uint32_t pending : pattern)
+    {
+        int n = __builtin_popcount(pending);
+        report("virtual isr()",    pending, 0,          measure(virtualHandler,   virtualRegs, pending, 1, iterations));
+        report("co_await inline",  pending, n,          measure(inlineController, inlineRegs,  pending, 1, iterations));
+        report("co_await thread",  pending, n,          measure(threadController, threadRegs,  pending, 1, iterations));
+        report("co_await fan-out", pending, n * FANOUT, measure(fanoutController, fanoutRegs,  pending, FANOUT, iterations / 10));
+    }
+
+    return 0;
+}
+//================================================================================
@@ -0,0 +1,236 @@
+//=================================================================================================
+// discovery_bench - Measures how long it takes to find a PCI device in a large sysfs tree
+//
+// This builds a synthetic /sys/bus/pci/devices with thousands of devices in it (a few of which
+// are the device we're looking for), then times:
+//
+//    (1) the way PciDevice used to find a device: an ifstream and a stoi() per vendor and
+//        device file, for every directory
+//    (2) building the PciDiscovery index from scratch
+//    (3) a lookup that's served from the PciDiscovery index
+//    (4) PciDevice::open(), which uses the index
+//
+// Results are written as a single JSON object, so that runs can be compared by script.
+//=================================================================================================
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include "PciDiscovery.h"
+#include "PciDevice.h"
+#include "CpuUtil.h"
+
+namespace fs = std::filesystem;
+
+//================================================================================
+// Command line options
+//================================================================================
+struct options_t
+{
+    int         devices     = 5000;
+    int         matches     = 4;
+    int         iterations  = 20;
+    std::string device      = "10ee:903f";
+};
+//================================================================================
+
+
+//================================================================================
+// usage() - Describes the command line and exits
+//================================================================================
+static void usage()
+{
+    printf
+    (
+        "usage: discovery_bench [options]\n"
+        "  -devices n        Number of devices in the synthetic tree (default 5000)\n"
+        "  -matches n        How many of them match the device we look for (default 4)\n"
+        "  -iterations n     How many times to repeat each measurement (default 20)\n"
+    );
+    exit(1);
+}
+//================================================================================
+
+
+//================================================================================
+// parseCommandLine() - Fills in the options from the command line
+//================================================================================
+static options_t parseCommandLine(int argc, char** argv)
+{
+    options_t opt;
+
+    for (int i=1; i<argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) usage();
+        const char* value = argv[++i];
+
+        if      (arg == "-devices"   ) opt.devices    = atoi(value);
+        else if (arg == "-matches"   ) opt.matches    = atoi(value);
+        else if (arg == "-iterations") opt.iterations = atoi(value);
+        else usage();
+    }
+
+    if (opt.devices < 1 || opt.matches < 1 || opt.matches > opt.devices || opt.iterations < 1) usage();
+
+    return opt;
+}
+//================================================================================
+
+
+//================================================================================
+// writeFile() - Creates a file with the specified contents
+//================================================================================
+static void writeFile(std::string filename, std::string contents)
+{
+    std::ofstream file(filename);
+    if (!file.is_open()) throw std::runtime_error("Can't create " + filename);
+    file << contents;
+}
+//================================================================================
+
+
+//================================================================================
+// buildTree() - Creates a synthetic sysfs device directory.  The matching
+//               devices are spread evenly through it.
+//================================================================================
+static void buildTree(std::string root, const options_t& opt)
+{
+    char bdf[32], id[16];
+    int  stride = opt.devices / opt.matches;
+
+    for (int i=0; i<opt.devices; ++i)
+    {
+        bool match = (i % stride == stride - 1) && (i / stride < opt.matches);
+
+        sprintf(bdf, "0000:%02x:%02x.%d", (i >> 8) & 0xFF, (i >> 3) & 0x1F, i & 7);
+        std::string dir = root + "/" + bdf;
+        fs::create_directory(dir);
+
+        sprintf(id, "0x%04x\n", match ? 0x10ee : 0x8086);
+        writeFile(dir + "/vendor", id);
+        sprintf(id, "0x%04x\n", match ? 0x903f : 0x1000 + (i & 0xFFF));
+        writeFile(dir + "/device", id);
+
+        // The device has a single 4K BAR
+        writeFile(dir + "/resource", "0x00000000fb000000 0x00000000fb000fff 0x0000000000040200\n");
+    }
+}
+//================================================================================
+
+
+//================================================================================
+// legacyFind() - Finds every matching device the way PciDevice::open() used to
+//================================================================================
+static int legacyGetInteger(std::string filename)
+{
+    std::string line;
+    std::ifstream file(filename);
+    if (!file.is_open()) return -1;
+    getline(file, line);
+    return stoi(line, 0, 0);
+}
+
+static std::vector<std::string> legacyFind(std::string root, int vendorID, int deviceID)
+{
+    std::vector<std::string> result;
+
+    for (auto const& entry : fs::directory_iterator(root))
+    {
+        if (!entry.is_directory()) continue;
+        std::string dirName = entry.path().string();
+        if (legacyGetInteger(dirName + "/vendor") == vendorID
+        &&  legacyGetInteger(dirName + "/device") == deviceID)
+        {
+            result.push_back(entry.path().filename());
+        }
+    }
+
+    return result;
+}
+//================================================================================
+
+
+//================================================================================
+// main() - Builds the tree, runs the measurements, reports the results
+//================================================================================
+int main(int argc, char** argv)
+{
+    options_t opt = parseCommandLine(argc, argv);
+    char      root[] = "/tmp/discovery_bench.XXXXXX";
+    size_t    found[4] = {};
+    double    ns[4] = {0};
+
+    // Create the synthetic device tree
+    if (mkdtemp(root) == nullptr)
+    {
+        fprintf(stderr, "Can't create a temporary directory\n");
+        exit(1);
+    }
+
+    try
+    {
+        buildTree(root, opt);
+
+        for (int i=0; i<opt.iterations; ++i)
+        {
+            // (1) The old way
+            uint64_t t0 = nowNs();
+            found[0] = legacyFind(root, 0x10ee, 0x903f).size();
+
+            // (2) Building the index from scratch
+            uint64_t t1 = nowNs();
+            PciDiscovery::invalidate();
+            found[1] = PciDiscovery::find(opt.device, root).size();
+
+            // (3) A lookup from the index
+            uint64_t t2 = nowNs();
+            found[2] = PciDiscovery::find(opt.device, root).size();
+
+            // (4) Opening the device
+            uint64_t t3 = nowNs();
+            PciDevice pci;
+            pci.open(opt.device, root);
+            found[3] = pci.resourceList().size();
+            uint64_t t4 = nowNs();
+
+            ns[0] += t1 - t0;
+            ns[1] += t2 - t1;
+            ns[2] += t3 - t2;
+            ns[3] += t4 - t3;
+        }
+    }
+    catch(const std::exception& e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        fs::remove_all(root);
+        exit(1);
+    }
+
+    // Clean up the synthetic tree
+    fs::remove_all(root);
+
+    // And write the results as JSON
+    printf("{\n");
+    printf("  \"devices\": %d,\n", opt.devices);
+    printf("  \"matches\": %d,\n", opt.matches);
+    printf("  \"iterations\": %d,\n", opt.iterations);
+    printf("  \"found\": {\"legacy\": %zu, \"index\": %zu, \"cached\": %zu, \"bars\": %zu},\n",
+           found[0], found[1], found[2], found[3]);
+    printf("  \"mean_us\": {\"legacy_scan\": %.1f, \"index_build\": %.1f, \"cached_lookup\": %.3f, \"open\": %.1f}\n",
+           ns[0] / opt.iterations / 1e3, ns[1] / opt.iterations / 1e3,
+           ns[2] / opt.iterations / 1e3, ns[3] / opt.iterations / 1e3);
+    printf("}\n");
+
+    // If the two approaches disagree, or the device we opened doesn't have the one BAR that
+    // buildTree() gave it, say so in the exit code
+    bool ok = found[0] == (size_t)opt.matches && found[1] == found[0] && found[2] == found[0]
+           && found[3] == 1;
+    return ok ? 0 : 2;
+}
+//================================================================================
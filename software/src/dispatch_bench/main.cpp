@@ -0,0 +1,102 @@
+//=================================================================================================
+// dispatch_bench - Compares the cost of dispatching interrupts through the virtual isr() of an
+//                  IntrControlBase with the compile-time dispatch of an IntrController<>
+//
+// The "interrupt controller" here is an ordinary block of memory, so what's being measured is
+// the cost of the dispatch logic itself rather than the cost of PCIe reads.
+//=================================================================================================
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "IntrController.h"
+#include "CpuUtil.h"
+
+// Handlers do a trivial amount of work that the compiler can't throw away
+static volatile uint64_t sink;
+
+//================================================================================
+// This is the traditional way of servicing interrupts: override isr()
+//================================================================================
+class VirtualHandler : public IntrControlBase
+{
+protected:
+
+    virtual void isr(uint32_t pending, int IRQ, uint32_t count)
+    {
+        if      (IRQ == 0) sink += count;
+        else if (IRQ == 1) sink += count * 3;
+        else if (IRQ == 2) sink += count * 5;
+    }
+};
+//================================================================================
+
+
+//================================================================================
+// These are the equivalent compile-time handlers
+//================================================================================
+struct Irq0Handler {void operator()(uint32_t pending, uint32_t count) {sink += count;    }};
+struct Irq1Handler {void operator()(uint32_t pending, uint32_t count) {sink += count * 3;}};
+struct Irq2Handler {void operator()(uint32_t pending, uint32_t count) {sink += count * 5;}};
+
+typedef IntrController<Irq0Handler, Irq1Handler, Irq2Handler> StaticHandler;
+//================================================================================
+
+
+//================================================================================
+// measure() - Returns the average number of nanoseconds per call to 
+//             topLevelHandler() when the controller reports "pending"
+//================================================================================
+static double measure(IntrControlBase& controller, uint32_t* regs, uint32_t pending, int iterations)
+{
+    // Fake up the pending register and a counter for every IRQ
+    regs[0] = pending;
+    for (int i=0; i<32; ++i) regs[32 + i] = 1;
+
+    // Warm up the caches and the branch predictors
+    for (int i=0; i<iterations/10; ++i) controller.topLevelHandler();
+
+    // And time the real thing
+    uint64_t start = nowNs();
+    for (int i=0; i<iterations; ++i) controller.topLevelHandler();
+    uint64_t elapsed = nowNs() - start;
+
+    return (double)elapsed / iterations;
+}
+//================================================================================
+
+
+//================================================================================
+// main() - Times both dispatch paths over a few different pending bitmaps
+//================================================================================
+int main(int argc, char** argv)
+{
+    static uint32_t virtualRegs[64], staticRegs[64];
+    VirtualHandler  virtualHandler;
+    StaticHandler   staticHandler;
+
+    // The number of iterations can be given on the command line
+    int iterations = (argc > 1) ? atoi(argv[1]) : 10000000;
+
+    // Point each controller at its own block of "registers"
+    virtualHandler.initialize((uint8_t*)virtualRegs, 0);
+    staticHandler .initialize((uint8_t*)staticRegs,  0);
+
+    // These are the bitmaps of pending IRQs that we'll try
+    const uint32_t pattern[] = {0x00000001, 0x00000004, 0x00000007, 0x00000080, 0x80000005};
+
+    printf("%-12s %14s %14s %8s %14s\n", "pending", "virtual ns", "static ns", "speedup", "traced ns");
+
+    for (uint32_t pending : pattern)
+    {
+        // Compare the dispatch paths without the trace ring, then see what it adds
+        TraceRing::enable(false);
+        double v = measure(virtualHandler, virtualRegs, pending, iterations);
+        double s = measure(staticHandler,  staticRegs,  pending, iterations);
+        TraceRing::enable(true);
+        double t = measure(staticHandler,  staticRegs,  pending, iterations);
+        printf("0x%08X   %14.2f %14.2f %7.2fx %14.2f\n", pending, v, s, v / s, t);
+    }
+
+    return 0;
+}
+//================================================================================
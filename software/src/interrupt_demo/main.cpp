@@ -1,6 +1,7 @@
 #include <unistd.h>
-#include "UioInterface.h"
-#include "PciDevice.h"
+#include <stdlib.h>
+#include "BoardSet.h"
+#include "Telemetry.h"
 
 //================================================================================
 // This is an example of a class that provides the interrupt-service routine
@@ -20,36 +21,37 @@ protected:
 //================================================================================
 // Global objects, constants, and variables
 //================================================================================
-InterruptHandler handler;
-UioInterface     UIO;
-PciDevice        PCI;
-std::string      device = "10ee:903f";
-const uint32_t   INTR_CTRL_BASE_ADDR = 0x0000;
+BoardSet              boards;
+Telemetry             telemetry;
+std::string           device = "10ee:903f";
+std::vector<uint32_t> intrCtrlBaseAddr = {0x0000};
 //================================================================================
 
 
 //================================================================================
 // Forward declarations
 //================================================================================
-void initializeInterrupts(uint8_t* userspacePtr, std::string device);
+void initializeInterrupts(std::string device);
 //================================================================================
 
 
 //================================================================================
 // main() - Performs program setup, initializes interrupts, then hangs
+//
+// Usage: interrupt_demo [vendorID:deviceID | BDF] [controller base address ...]
 //================================================================================
-int main()
+int main(int argc, char** argv)
 {
+    // The device and the base addresses of its interrupt controllers can be
+    // given on the command line
+    if (argc > 1) device = argv[1];
+    if (argc > 2) intrCtrlBaseAddr.clear();
+    for (int i=2; i<argc; ++i) intrCtrlBaseAddr.push_back(strtoul(argv[i], nullptr, 0));
+
     try
     {
-        // Map the FPGA's registers into userspace
-        PCI.open(device);
-
-        // Get a userspace pointer to the first resource region for this PCI device
-        uint8_t* userspacePtr = PCI.resourceList()[0].baseAddr;
-
-        // Initialize the interrupt system
-        initializeInterrupts(userspacePtr, device);
+        // Initialize the interrupt system on every card
+        initializeInterrupts(device);
 
         // This thread is now free to go off and do other things
         printf("Waiting for interrupts\n");
@@ -70,18 +72,34 @@ int main()
 // initializeInterrupts() - Takes all the steps neccessary to enable, detect and
 //                          report interrupts.
 //================================================================================
-void initializeInterrupts(uint8_t* userspacePtr, std::string device)
+void initializeInterrupts(std::string device)
 {
-     // Tell the interrupt handler where to find its registers
-    handler.initialize(userspacePtr, INTR_CTRL_BASE_ADDR);
+    // Map the registers of every card, give each interrupt controller on each
+    // card a handler, and start monitoring each card near its NUMA node
+    int count = boards.open<InterruptHandler>(device, intrCtrlBaseAddr);
 
-    // Initialize the userspace I/O subsystem
-    UIO.initialize(device, &handler);
+    // Tell the user where each card is being serviced
+    for (int i=0; i<count; ++i)
+    {
+        const BoardSet::board_info_t& info = boards.info(i);
+        printf("%s: NUMA node %d, monitor on CPU %d\n", info.bdf.c_str(), info.numaNode, info.cpu);
+    }
+
+    // Publish the statistics of every interrupt controller, so that intr_top can watch them
+    telemetry.open();
+    for (int i=0; i<count; ++i) for (int ctrl=0; ctrl<boards.controllerCount(); ++ctrl)
+    {
+        char name[64];
+        sprintf(name, "%s@0x%X", boards.info(i).bdf.c_str(), intrCtrlBaseAddr[ctrl]);
+        boards.onBoardNode(i, [&]() {boards.handler(i, ctrl)->enableLatencyTracking(true);});
+        telemetry.addDevice(name, boards.handler(i, ctrl), &boards.uio(i));
+    }
+    printf("Publishing statistics to /dev/shm/%s\n", Telemetry::defaultName(getpid()).c_str());
 
     // Enable all the interrupt sources
-    handler.setIrqMask(0xFFFFFFFF);
+    boards.setIrqMask(0xFFFFFFFF);
 
     // And globally enable interrupts
-    handler.setGlobalEnable(true);
+    boards.setGlobalEnable(true);
 }
-//================================================================================
\ No newline at end of file
+//================================================================================
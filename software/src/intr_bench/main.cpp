@@ -0,0 +1,402 @@
+//=================================================================================================
+// intr_bench - Drives loopback interrupts through IntrControlBase::generateInterrupt() and
+//              measures how many interrupts per second the stack delivers, the latency of each
+//              interrupt, and how much CPU time it costs.
+//
+// By default this runs against IntrControllerModel, a software model of the interrupt
+// controller, so it needs no hardware.  With "-hw" it runs against a real board.
+//
+// Results are written as a single JSON object, so that runs can be compared by script.
+//=================================================================================================
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <string>
+#include <stdexcept>
+#include "UioInterface.h"
+#include "IntrControllerModel.h"
+#include "PciDevice.h"
+#include "Telemetry.h"
+#include "CpuUtil.h"
+
+//================================================================================
+// Command line options
+//================================================================================
+struct options_t
+{
+    bool        hardware    = false;
+    std::string device      = "10ee:903f";
+    uint32_t    baseAddr    = 0x0000;
+    double      rate        = 0;
+    double      seconds     = 5;
+    uint32_t    irqMask     = 0x7;
+    int         batch       = 1;
+    int         coalesce    = 1;
+    std::string mode        = "block";
+    bool        sqPoll      = false;
+    uint32_t    spinUs      = 50;
+    int         cpu         = -1;
+    uint32_t    ringSlots   = 0;
+    bool        telemetry   = false;
+    std::string traceFile;
+    uint32_t    triggerUs   = 0;
+    std::string outFile;
+};
+//================================================================================
+
+
+//================================================================================
+// This is the interrupt handler.  For every interrupt it sees, it records how
+// long it's been since that IRQ was last generated
+//================================================================================
+class BenchHandler : public IntrControlBase
+{
+public:
+
+    // The readTsc() value when each IRQ was most recently generated
+    std::atomic<uint64_t> sendTsc[32] = {};
+
+    // How many interrupts have been delivered to isr()
+    std::atomic<uint64_t> delivered{0};
+
+    // How many times an isr() call reported more than one interrupt
+    std::atomic<uint64_t> merged{0};
+
+    // Latency from generateInterrupt() to isr()
+    LatencyHistogram      latency;
+
+    // The thread that calls isr(), so that we can find out how much CPU it used
+    std::atomic<bool>     haveThread{false};
+    pthread_t             isrThread;
+
+protected:
+
+    virtual void isr(uint32_t pending, int IRQ, uint32_t count)
+    {
+        latency.record(readTsc() - sendTsc[IRQ].load(std::memory_order_relaxed));
+        bump(delivered, count);
+        if (count > 1) bump(merged);
+        if (!haveThread.load(std::memory_order_relaxed))
+        {
+            isrThread = pthread_self();
+            haveThread = true;
+        }
+    }
+};
+//================================================================================
+
+
+//================================================================================
+// Global objects
+//================================================================================
+BenchHandler handler;
+UioInterface UIO;
+PciDevice    PCI;
+//================================================================================
+
+
+//================================================================================
+// usage() - Describes the command line and exits
+//================================================================================
+static void usage()
+{
+    printf
+    (
+        "usage: intr_bench [options]\n"
+        "  -hw               Use real hardware instead of the software model\n"
+        "  -device vid:did   PCI device to use with -hw (default 10ee:903f)\n"
+        "  -base addr        AXI address of the interrupt controller (default 0)\n"
+        "  -rate n           Interrupts to generate per second (default: as fast as possible)\n"
+        "  -seconds n        How long to run (default 5)\n"
+        "  -irqs mask        Bitmap of IRQs to rotate through (default 0x7)\n"
+        "  -batch n          IRQs raised per generateInterrupt() call (default 1)\n"
+        "  -coalesce n       Passes per topLevelHandler() call (default 1)\n"
+        "  -mode m           block, spin, poll or uring (default block)\n"
+        "  -spin us          Spin budget for -mode spin, or -mode uring with -sqpoll (default 50)\n"
+        "  -sqpoll           With -mode uring, have a kernel thread poll the submission queue\n"
+        "  -cpu n            Pin the monitor thread to this CPU\n"
+        "  -ring n           Use an n-slot status writeback ring (software model only)\n"
+        "  -telemetry        Publish live statistics to /dev/shm for intr_top\n"
+        "  -trace file       Write the interrupt trace to a file at the end of the run\n"
+        "  -trigger us       With -trace, also write <file>.<n>.trace whenever a wakeup takes\n"
+        "                    longer than this\n"
+        "  -o file           Write the JSON results to a file instead of stdout\n"
+    );
+    exit(1);
+}
+//================================================================================
+
+
+//================================================================================
+// parseCommandLine() - Fills in the options from the command line
+//================================================================================
+static options_t parseCommandLine(int argc, char** argv)
+{
+    options_t opt;
+
+    for (int i=1; i<argc; ++i)
+    {
+        std::string arg = argv[i];
+        const char* value = (i + 1 < argc) ? argv[i+1] : nullptr;
+
+        if (arg == "-hw"    ) {opt.hardware = true; continue;}
+        if (arg == "-sqpoll") {opt.sqPoll   = true; continue;}
+        if (arg == "-telemetry") {opt.telemetry = true; continue;}
+
+        // Every other option takes a value
+        if (value == nullptr) usage();
+        ++i;
+
+        if      (arg == "-device"  ) opt.device   = value;
+        else if (arg == "-base"    ) opt.baseAddr = strtoul(value, nullptr, 0);
+        else if (arg == "-rate"    ) opt.rate     = atof(value);
+        else if (arg == "-seconds" ) opt.seconds  = atof(value);
+        else if (arg == "-irqs"    ) opt.irqMask  = strtoul(value, nullptr, 0);
+        else if (arg == "-batch"   ) opt.batch    = atoi(value);
+        else if (arg == "-coalesce") opt.coalesce = atoi(value);
+        else if (arg == "-mode"    ) opt.mode     = value;
+        else if (arg == "-spin"    ) opt.spinUs   = atoi(value);
+        else if (arg == "-cpu"     ) opt.cpu      = atoi(value);
+        else if (arg == "-ring"    ) opt.ringSlots = strtoul(value, nullptr, 0);
+        else if (arg == "-o"       ) opt.outFile  = value;
+        else if (arg == "-trace"   ) opt.traceFile = value;
+        else if (arg == "-trigger" ) opt.triggerUs = strtoul(value, nullptr, 0);
+        else usage();
+    }
+
+    if (opt.irqMask == 0 || opt.batch < 1) usage();
+    if (opt.mode != "block" && opt.mode != "spin" && opt.mode != "poll" && opt.mode != "uring") usage();
+
+    // Triggered traces are named after the -trace file
+    if (opt.triggerUs && opt.traceFile.empty()) usage();
+
+    // We have no way to find the bus address of a buffer on real hardware
+    if (opt.ringSlots && opt.hardware) usage();
+
+    return opt;
+}
+//================================================================================
+
+
+//================================================================================
+// cpuNs() - Returns the CPU time consumed by the whole process
+//================================================================================
+static uint64_t cpuNs()
+{
+    rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000ULL
+         + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000ULL;
+}
+//================================================================================
+
+
+//================================================================================
+// threadCpuNs() - Returns the CPU time consumed by the specified thread
+//================================================================================
+static uint64_t threadCpuNs(pthread_t thread)
+{
+    clockid_t clock;
+    timespec  ts;
+    if (pthread_getcpuclockid(thread, &clock) != 0) return 0;
+    if (clock_gettime(clock, &ts) != 0) return 0;
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+//================================================================================
+
+
+//================================================================================
+// run() - Generates interrupts for the requested amount of time, and returns
+//         how many were generated
+//================================================================================
+static uint64_t run(const options_t& opt)
+{
+    // Build the list of IRQs we're going to rotate through
+    int irqList[32], irqCount = 0;
+    for (int i=0; i<32; ++i) if (opt.irqMask & (1u << i)) irqList[irqCount++] = i;
+
+    // If there's a target rate, this is how far apart the interrupts are spaced
+    uint64_t periodNs = (opt.rate > 0) ? (uint64_t)(1e9 / opt.rate * opt.batch) : 0;
+
+    uint64_t startNs  = nowNs();
+    uint64_t stopNs   = startNs + (uint64_t)(opt.seconds * 1e9);
+    uint64_t sent     = 0;
+    uint32_t next     = 0;
+
+    for (uint64_t n = 0; ; ++n)
+    {
+        uint64_t now = nowNs();
+        if (now >= stopNs) break;
+
+        // Wait until it's time for the next batch
+        if (periodNs)
+        {
+            uint64_t due = startNs + n * periodNs;
+            if (due > now + 100000) usleep((due - now) / 1000 - 50);
+            while (nowNs() < due) cpuRelax();
+        }
+
+        // Decide which IRQs go in this batch, and note when they were generated
+        uint32_t irqs = 0;
+        uint64_t tsc  = readTsc();
+        for (int i=0; i<opt.batch; ++i)
+        {
+            int irq = irqList[next++ % irqCount];
+            irqs |= (1u << irq);
+            handler.sendTsc[irq].store(tsc, std::memory_order_relaxed);
+        }
+
+        // And fire them off
+        handler.generateInterrupt(irqs);
+        sent += __builtin_popcount(irqs);
+
+        // If we're going flat out, don't get more than a little way ahead of the handler
+        if (periodNs == 0) while (sent - handler.delivered > 1000) cpuRelax();
+    }
+
+    return sent;
+}
+//================================================================================
+
+
+//================================================================================
+// main() - Sets up the interrupt stack, runs the benchmark, reports the results
+//================================================================================
+int main(int argc, char** argv)
+{
+    options_t            opt = parseCommandLine(argc, argv);
+    IntrControllerModel* model = nullptr;
+    intr_status_t*       ring  = nullptr;
+    Telemetry            telemetry;
+
+    try
+    {
+        // Decide how the monitor thread waits for interrupts
+        UioInterface::monitor_config_t config = {UioInterface::MONITOR_BLOCKING, opt.spinUs, 1, 64, opt.sqPoll};
+        if (opt.mode == "spin" ) config.mode = UioInterface::MONITOR_SPIN_THEN_BLOCK;
+        if (opt.mode == "poll" ) config.mode = UioInterface::MONITOR_POLLING;
+        if (opt.mode == "uring") config.mode = UioInterface::MONITOR_IO_URING;
+        UIO.setMonitorConfig(config);
+
+        // Decide where the monitor thread runs
+        thread_placement_t placement;
+        placement.cpu = opt.cpu;
+        UIO.setPlacement(placement);
+
+        // Make the handler drain the controller as the caller asked
+        handler.setCoalescing(opt.coalesce);
+
+        // Make sure the TSC calibration is done before we start timing anything
+        nsPerTsc();
+
+        // The trace ring is always on, but the trigger has to be asked for
+        if (opt.triggerUs) TraceRing::setTrigger(opt.triggerUs * 1000ULL, opt.traceFile);
+
+        // Hook the handler up to either the real hardware or the model
+        if (opt.hardware)
+        {
+            PCI.open(opt.device);
+            handler.initialize(PCI.bar(0), opt.baseAddr);
+            UIO.initialize(opt.device, &handler);
+        }
+        else
+        {
+            model = new IntrControllerModel(32);
+            handler.initialize(model);
+            UIO.initialize(model->uioFd(), model->configFd(), &handler);
+        }
+
+        // If the caller wants status writeback, give the controller a ring to write to
+        if (opt.ringSlots)
+        {
+            ring = new intr_status_t[opt.ringSlots];
+            handler.enableStatusRing(ring, (uint64_t)ring, opt.ringSlots);
+        }
+
+        // If the caller wants to watch us with intr_top, publish our statistics
+        if (opt.telemetry)
+        {
+            telemetry.open();
+            telemetry.addDevice(opt.hardware ? opt.device : "model", &handler, &UIO);
+            fprintf(stderr, "Publishing statistics to /dev/shm/%s\n", Telemetry::defaultName(getpid()).c_str());
+        }
+
+        // Enable the interrupts we're going to generate
+        handler.setIrqMask(opt.irqMask);
+        handler.setGlobalEnable(true);
+    }
+    catch(const std::exception& e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+
+    // Run the benchmark
+    uint64_t cpuStart  = cpuNs();
+    uint64_t wallStart = nowNs();
+    uint64_t sent      = run(opt);
+
+    // Give the handler a moment to catch up with the last few interrupts
+    uint64_t deadline = nowNs() + 1000000000ULL;
+    while (handler.delivered < sent && nowNs() < deadline) usleep(100);
+
+    uint64_t wallNs    = nowNs() - wallStart;
+    uint64_t processNs = cpuNs() - cpuStart;
+    uint64_t monitorNs = handler.haveThread ? threadCpuNs(handler.isrThread) : 0;
+
+    // Gather up the statistics
+    uint64_t delivered = handler.delivered;
+    auto     lat       = handler.latency.summarize();
+    auto     dispatch  = handler.getDispatchStats();
+    auto     monitor   = UIO.getMonitorStats();
+    double   perIntr   = delivered ? 1.0 / delivered : 0;
+
+    // Decide where the results go
+    FILE* out = stdout;
+    if (!opt.outFile.empty() && (out = fopen(opt.outFile.c_str(), "w")) == nullptr)
+    {
+        fprintf(stderr, "Can't create %s\n", opt.outFile.c_str());
+        return 1;
+    }
+
+    // And write them as JSON
+    fprintf(out, "{\n");
+    fprintf(out, "  \"backend\": \"%s\",\n", opt.hardware ? "hardware" : "model");
+    fprintf(out, "  \"mode\": \"%s\",\n", opt.mode.c_str());
+    fprintf(out, "  \"io_uring\": %s,\n", monitor.ioUring ? (opt.sqPoll ? "\"sqpoll\"" : "true") : "false");
+    fprintf(out, "  \"target_rate\": %.0f,\n", opt.rate);
+    fprintf(out, "  \"seconds\": %.3f,\n", wallNs / 1e9);
+    fprintf(out, "  \"irq_mask\": \"0x%08X\",\n", opt.irqMask);
+    fprintf(out, "  \"batch\": %d,\n", opt.batch);
+    fprintf(out, "  \"coalesce\": %d,\n", opt.coalesce);
+    fprintf(out, "  \"status_ring\": %u,\n", opt.ringSlots);
+    fprintf(out, "  \"sent\": %lu,\n", sent);
+    fprintf(out, "  \"delivered\": %lu,\n", delivered);
+    fprintf(out, "  \"merged_isr_calls\": %lu,\n", handler.merged.load());
+    fprintf(out, "  \"interrupts_per_sec\": %.1f,\n", delivered / (wallNs / 1e9));
+    fprintf(out, "  \"wakeups\": %lu,\n", dispatch.wakeups);
+    fprintf(out, "  \"spurious_wakeups\": %lu,\n", dispatch.spurious);
+    fprintf(out, "  \"interrupts_per_wakeup\": %.3f,\n", dispatch.wakeups ? (double)dispatch.interrupts / dispatch.wakeups : 0);
+    fprintf(out, "  \"monitor_syscalls\": %lu,\n", monitor.syscalls);
+    fprintf(out, "  \"syscalls_per_interrupt\": %.3f,\n", monitor.syscalls * perIntr);
+    fprintf(out, "  \"latency_ns\": {\"count\": %lu, \"mean\": %.1f, \"p50\": %.1f, \"p99\": %.1f, \"p999\": %.1f, \"max\": %.1f},\n",
+            lat.count, lat.meanNs, lat.p50Ns, lat.p99Ns, lat.p999Ns, lat.maxNs);
+    fprintf(out, "  \"cpu_ns_per_interrupt\": {\"monitor\": %.1f, \"process\": %.1f}\n",
+            monitorNs * perIntr, processNs * perIntr);
+    fprintf(out, "}\n");
+
+    if (out != stdout) fclose(out);
+
+    // If the caller wants to look at the trace, write it out
+    if (!opt.traceFile.empty() && !TraceRing::dump(opt.traceFile))
+    {
+        fprintf(stderr, "Can't create %s\n", opt.traceFile.c_str());
+    }
+
+    // If interrupts went missing, say so in the exit code
+    return (delivered == sent) ? 0 : 2;
+}
+//================================================================================
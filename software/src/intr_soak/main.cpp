@@ -0,0 +1,634 @@
+//=================================================================================================
+// intr_soak - Programs the source.v interrupt sources with periodic and burst patterns, then
+//             checks, for as long as it's left running, that every interrupt they generate is
+//             delivered
+//
+// For each IRQ it reports how many interrupts were expected and how many were delivered, how
+// many were lost or arrived merged with another, and how late the interrupts of a periodic
+// pattern arrive.  A progress report is printed to stderr every so often, and the final results
+// are written as a single JSON object.
+//
+// By default this runs against software models of the interrupt controller and the sources, so
+// it needs no hardware.  With "-hw" it runs against a real board.
+//=================================================================================================
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <float.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include "UioInterface.h"
+#include "IntrControllerModel.h"
+#include "TimerSource.h"
+#include "PciDevice.h"
+#include "Telemetry.h"
+#include "CpuUtil.h"
+
+//================================================================================
+// A pattern that one source generates.  A periodic pattern strobes the IRQ
+// every "periodMs".  A burst pattern holds it high for "clocks" clock cycles
+// every "periodMs".
+//================================================================================
+struct pattern_t
+{
+    int         irq;
+    uint32_t    periodMs;
+    uint32_t    clocks;
+};
+//================================================================================
+
+
+//================================================================================
+// Command line options
+//================================================================================
+struct options_t
+{
+    bool                   hardware      = false;
+    std::string            device        = "10ee:903f";
+    uint32_t               baseAddr      = 0x0000;
+    uint32_t               sourceAddr[32] = {0x1000, 0x2000, 0x3000};
+    std::vector<pattern_t> pattern;
+    double                 seconds       = 60;
+    double                 reportSeconds = 10;
+    std::string            mode          = "block";
+    bool                   telemetry     = false;
+    std::string            outFile;
+};
+//================================================================================
+
+
+//================================================================================
+// What the handler has seen of one IRQ
+//
+// For a periodic pattern, each isr() call is compared against where the strobe
+// it's reporting should have been.  The controller counts every strobe, so a
+// call can be late (in which case it carries a count of more than one) but
+// should never be a whole period later than the last strobe it counted.  If
+// it is, the strobes in between were lost, unless a later call brings them.
+//
+// "Where the strobe should have been" is measured against the earliest any
+// call arrived during the previous second, so that a difference between the
+// source's clock and ours doesn't build up over a long run.
+//================================================================================
+struct arrival_t
+{
+    // The period of a periodic pattern in TSC ticks, or 0 for a burst pattern.  This is set
+    // before the IRQ is enabled.
+    double                periodTsc = 0;
+
+    // Only isr() touches these.  "base" is the count of the first call, "floor" the earliest
+    // lateness seen in the previous second, and "window" the earliest so far in this one.
+    uint64_t              firstTsc = 0, windowTsc = 0, floorTsc = 0, base = 0;
+    double                floor = 0, window = DBL_MAX, firstFloor = 0;
+    bool                  haveFloor = false;
+
+    // Anyone can read these
+    std::atomic<uint64_t> calls{0}, delivered{0}, merged{0}, lost{0};
+    std::atomic<double>   driftPpm{0};
+
+    // How late each call of a periodic pattern was, or how long each burst took to be delivered
+    LatencyHistogram      late;
+
+    // For a burst pattern, the delivered total that the latest burst brings us up to, and the
+    // TSC when it was forced
+    std::atomic<uint64_t> burstTarget{0}, burstTsc{0};
+};
+//================================================================================
+
+
+//================================================================================
+// This is the interrupt handler.  It checks each interrupt against the pattern
+// that its source is generating.
+//================================================================================
+class SoakHandler : public IntrControlBase
+{
+public:
+
+    arrival_t   irq[32];
+
+protected:
+
+    virtual void isr(uint32_t pending, int IRQ, uint32_t count)
+    {
+        arrival_t& a   = irq[IRQ];
+        uint64_t   now = readTsc();
+
+        bump(a.calls);
+        bump(a.delivered, count);
+        if (count > 1) bump(a.merged, count - 1);
+
+        if (a.periodTsc) checkPeriodic(a, now, count);
+        else if (a.burstTarget && a.delivered >= a.burstTarget)
+        {
+            a.late.record(now - a.burstTsc);
+            a.burstTarget = 0;
+        }
+    }
+
+    // Works out how late a call of a periodic pattern is, and whether strobes went missing
+    void checkPeriodic(arrival_t& a, uint64_t now, uint32_t count)
+    {
+        // The first call is where the schedule starts
+        if (a.firstTsc == 0)
+        {
+            a.firstTsc  = a.windowTsc = now;
+            a.base      = count;
+            return;
+        }
+
+        // How long after the last strobe it counted this call arrived
+        double strobe = a.firstTsc + (a.delivered + a.lost - a.base) * a.periodTsc;
+        double late   = now - strobe;
+        double rel    = late - a.floor;
+
+        // If it's a whole period late, the strobes in between never made it...
+        if (rel >= a.periodTsc)
+        {
+            uint64_t missing = (uint64_t)(rel / a.periodTsc);
+            bump(a.lost, missing);
+            late -= missing * a.periodTsc;
+            rel  -= missing * a.periodTsc;
+        }
+
+        // ...unless a later call turns up with strobes we'd given up on.  That happens when a
+        // strobe is counted late, e.g. because the thread of a TimerSourceModel was descheduled.
+        // A call that's early by half a period or more brought some of them, and so did every
+        // extra count of a merged call: the controller never drops a strobe, so a strobe that
+        // arrives merged with the next one is one we were wrong to give up on.
+        else if ((rel <= -a.periodTsc / 2 || count > 1) && a.lost)
+        {
+            uint64_t found = (rel < 0) ? (uint64_t)(-rel / a.periodTsc + 0.5) : 0;
+            if (found < count - 1) found = count - 1;
+            if (found > a.lost) found = a.lost;
+            a.lost.store(a.lost - found, std::memory_order_relaxed);
+            late += found * a.periodTsc;
+            rel  += found * a.periodTsc;
+        }
+
+        a.late.record(rel > 0 ? rel : 0);
+        if (late < a.window) a.window = late;
+
+        // Once a second, move the floor to the earliest arrival of the last second.  How far
+        // it has moved since the first second tells us how far apart the clocks are.
+        if (now - a.windowTsc >= 1e9 / nsPerTsc())
+        {
+            a.floor = a.window;
+            if (!a.haveFloor)
+            {
+                a.firstFloor = a.floor;
+                a.floorTsc   = now;
+                a.haveFloor  = true;
+            }
+            else a.driftPpm = (a.floor - a.firstFloor) / (now - a.floorTsc) * 1e6;
+
+            a.window    = DBL_MAX;
+            a.windowTsc = now;
+        }
+    }
+};
+//================================================================================
+
+
+//================================================================================
+// One source, and what it has been asked to generate
+//================================================================================
+struct line_t
+{
+    bool              active = false;
+    pattern_t         pattern;
+    TimerSource       source;
+    TimerSourceModel* model = nullptr;
+
+    // When the timer was started and stopped, or when the next burst is due
+    uint64_t          startNs = 0, stopNs = 0, nextNs = 0;
+
+    // How many bursts have been forced, and the sum of their lengths
+    uint64_t          bursts = 0, forced = 0;
+};
+//================================================================================
+
+
+//================================================================================
+// Global objects
+//================================================================================
+SoakHandler  handler;
+UioInterface UIO;
+PciDevice    PCI;
+line_t       line[32];
+
+// Set by SIGINT or SIGTERM to end the run early
+volatile sig_atomic_t stopRequested = 0;
+//================================================================================
+
+
+//================================================================================
+// usage() - Describes the command line and exits
+//================================================================================
+static void usage()
+{
+    printf
+    (
+        "usage: intr_soak [options]\n"
+        "  -hw                   Use real hardware instead of the software models\n"
+        "  -device vid:did       PCI device to use with -hw (default 10ee:903f)\n"
+        "  -base addr            AXI address of the interrupt controller (default 0)\n"
+        "  -source irq:addr      AXI address of the source that drives an IRQ\n"
+        "                        (defaults: IRQ 0 at 0x1000, 1 at 0x2000, 2 at 0x3000)\n"
+        "  -periodic irq:ms      Strobe the IRQ every \"ms\" milliseconds (at least 2)\n"
+        "  -burst irq:ms:clocks  Hold the IRQ high for \"clocks\" clock cycles every \"ms\"\n"
+        "                        milliseconds\n"
+        "  -seconds n            How long to run (default 60)\n"
+        "  -hours n              How long to run, in hours\n"
+        "  -report n             Seconds between progress reports (default 10, 0 for none)\n"
+        "  -mode m               block, spin, poll or uring (default block)\n"
+        "  -telemetry            Publish live statistics to /dev/shm for intr_top\n"
+        "  -o file               Write the JSON results to a file instead of stdout\n"
+        "\n"
+        "With no patterns, IRQ 0 is strobed every 2 ms, IRQ 1 every 10 ms, and IRQ 2 is\n"
+        "held high for 1000 clocks every 100 ms.  Each IRQ can have only one pattern,\n"
+        "since a burst stops the source's timer.\n"
+    );
+    exit(1);
+}
+//================================================================================
+
+
+//================================================================================
+// parseCommandLine() - Fills in the options from the command line
+//================================================================================
+static options_t parseCommandLine(int argc, char** argv)
+{
+    options_t opt;
+    uint32_t  used = 0;
+
+    for (int i=1; i<argc; ++i)
+    {
+        std::string arg = argv[i];
+        const char* value = (i + 1 < argc) ? argv[i+1] : nullptr;
+        pattern_t   p = {0, 0, 0};
+        uint32_t    addr;
+
+        if (arg == "-hw"       ) {opt.hardware  = true; continue;}
+        if (arg == "-telemetry") {opt.telemetry = true; continue;}
+
+        // Every other option takes a value
+        if (value == nullptr) usage();
+        ++i;
+
+        if      (arg == "-device" ) opt.device        = value;
+        else if (arg == "-base"   ) opt.baseAddr      = strtoul(value, nullptr, 0);
+        else if (arg == "-seconds") opt.seconds       = atof(value);
+        else if (arg == "-hours"  ) opt.seconds       = atof(value) * 3600;
+        else if (arg == "-report" ) opt.reportSeconds = atof(value);
+        else if (arg == "-mode"   ) opt.mode          = value;
+        else if (arg == "-o"      ) opt.outFile       = value;
+        else if (arg == "-source")
+        {
+            if (sscanf(value, "%d:%i", &p.irq, &addr) != 2) usage();
+            if (p.irq < 0 || p.irq > 31) usage();
+            opt.sourceAddr[p.irq] = addr;
+        }
+        else if (arg == "-periodic")
+        {
+            if (sscanf(value, "%d:%u", &p.irq, &p.periodMs) != 2) usage();
+            opt.pattern.push_back(p);
+        }
+        else if (arg == "-burst")
+        {
+            if (sscanf(value, "%d:%u:%u", &p.irq, &p.periodMs, &p.clocks) != 3) usage();
+            if (p.clocks == 0) usage();
+            opt.pattern.push_back(p);
+        }
+        else usage();
+    }
+
+    if (opt.pattern.empty()) opt.pattern = {{0, 2, 0}, {1, 10, 0}, {2, 100, 1000}};
+
+    // Every IRQ gets at most one pattern, from a source we know the address of
+    for (auto& p : opt.pattern)
+    {
+        if (p.irq < 0 || p.irq > 31 || (used & (1u << p.irq))) usage();
+        if (p.clocks == 0 && p.periodMs < 2) usage();
+        if (p.clocks != 0 && p.periodMs < 1) usage();
+        if (opt.hardware && opt.sourceAddr[p.irq] == 0) usage();
+        used |= (1u << p.irq);
+    }
+
+    if (opt.seconds <= 0 || opt.reportSeconds < 0) usage();
+    if (opt.mode != "block" && opt.mode != "spin" && opt.mode != "poll" && opt.mode != "uring") usage();
+
+    return opt;
+}
+//================================================================================
+
+
+//================================================================================
+// expected() - Returns how many interrupts a source should have generated by
+//              "now"
+//================================================================================
+static uint64_t expected(line_t& l, uint64_t now)
+{
+    if (l.pattern.clocks) return l.forced;
+
+    if (l.startNs == 0) return 0;
+    if (l.stopNs && now > l.stopNs) now = l.stopNs;
+    return (uint64_t)((now - l.startNs) / l.source.periodNs(l.pattern.periodMs));
+}
+//================================================================================
+
+
+//================================================================================
+// describe() - Returns a short description of a pattern
+//================================================================================
+static std::string describe(const pattern_t& p)
+{
+    char text[64];
+    if (p.clocks)
+        sprintf(text, "burst %u clk/%u ms", p.clocks, p.periodMs);
+    else
+        sprintf(text, "every %u ms", p.periodMs);
+    return text;
+}
+//================================================================================
+
+
+//================================================================================
+// printProgress() - Prints one progress report to stderr
+//================================================================================
+static void printProgress(uint64_t now, uint64_t startNs)
+{
+    fprintf(stderr, "%.0f s\n", (now - startNs) / 1e9);
+    fprintf(stderr, "  %-4s %-22s %14s %14s %8s %10s %10s %10s\n",
+            "IRQ", "pattern", "expected", "delivered", "lost", "merged", "p99 us", "max us");
+
+    for (int irq=0; irq<32; ++irq) if (line[irq].active)
+    {
+        arrival_t& a   = handler.irq[irq];
+        auto       lat = a.late.summarize();
+        fprintf(stderr, "  %-4d %-22s %14lu %14lu %8lu %10lu %10.1f %10.1f\n",
+                irq, describe(line[irq].pattern).c_str(), expected(line[irq], now),
+                a.delivered.load(), a.lost.load(), a.merged.load(), lat.p99Ns / 1e3, lat.maxNs / 1e3);
+    }
+}
+//================================================================================
+
+
+//================================================================================
+// run() - Starts the sources, forces the bursts and reports progress until it's
+//         time to stop, then stops the sources
+//================================================================================
+static void run(const options_t& opt)
+{
+    uint64_t startNs  = nowNs();
+    uint64_t stopNs   = startNs + (uint64_t)(opt.seconds * 1e9);
+    uint64_t reportNs = (uint64_t)(opt.reportSeconds * 1e9);
+    uint64_t nextReport = startNs + reportNs;
+
+    // Start every periodic source, and schedule the first burst of the others
+    for (auto& l : line) if (l.active)
+    {
+        if (l.pattern.clocks)
+        {
+            l.nextNs = startNs + l.pattern.periodMs * 1000000ULL;
+            continue;
+        }
+
+        l.source.startTimer(l.pattern.periodMs);
+        l.startNs = nowNs();
+    }
+
+    while (!stopRequested)
+    {
+        uint64_t now = nowNs();
+        if (now >= stopNs) break;
+        uint64_t wake = stopNs;
+
+        // Force any bursts that are due
+        for (int irq=0; irq<32; ++irq) if (line[irq].active && line[irq].pattern.clocks)
+        {
+            line_t&    l = line[irq];
+            arrival_t& a = handler.irq[irq];
+
+            if (now >= l.nextNs)
+            {
+                l.forced += l.pattern.clocks;
+                ++l.bursts;
+                a.burstTsc    = readTsc();
+                a.burstTarget = l.forced;
+                l.source.force(l.pattern.clocks);
+
+                // If we've fallen behind, don't try to catch up
+                l.nextNs += l.pattern.periodMs * 1000000ULL;
+                if (l.nextNs <= now) l.nextNs = now + l.pattern.periodMs * 1000000ULL;
+            }
+
+            if (l.nextNs < wake) wake = l.nextNs;
+        }
+
+        // Report progress if it's time
+        if (reportNs && now >= nextReport)
+        {
+            printProgress(now, startNs);
+            nextReport += reportNs;
+        }
+        if (reportNs && nextReport < wake) wake = nextReport;
+
+        // And sleep until something else needs doing
+        now = nowNs();
+        if (wake > now) usleep((wake - now) / 1000);
+    }
+
+    // Stop the timers
+    for (auto& l : line) if (l.active && l.pattern.clocks == 0)
+    {
+        l.source.stopTimer();
+        l.stopNs = nowNs();
+    }
+}
+//================================================================================
+
+
+//================================================================================
+// onSignal() - Ends the run early
+//================================================================================
+static void onSignal(int)
+{
+    stopRequested = 1;
+}
+//================================================================================
+
+
+//================================================================================
+// main() - Sets up the interrupt stack and the sources, runs the soak, reports
+//          the results
+//================================================================================
+int main(int argc, char** argv)
+{
+    options_t            opt   = parseCommandLine(argc, argv);
+    IntrControllerModel* model = nullptr;
+    Telemetry            telemetry;
+    uint32_t             irqMask = 0;
+
+    try
+    {
+        // Decide how the monitor thread waits for interrupts
+        UioInterface::monitor_config_t config = {UioInterface::MONITOR_BLOCKING, 50, 1, 64, false};
+        if (opt.mode == "spin" ) config.mode = UioInterface::MONITOR_SPIN_THEN_BLOCK;
+        if (opt.mode == "poll" ) config.mode = UioInterface::MONITOR_POLLING;
+        if (opt.mode == "uring") config.mode = UioInterface::MONITOR_IO_URING;
+        UIO.setMonitorConfig(config);
+
+        // Make sure the TSC calibration is done before we start timing anything
+        nsPerTsc();
+
+        // Hook the handler up to either the real hardware or the model
+        if (opt.hardware)
+        {
+            PCI.open(opt.device);
+            handler.initialize(PCI.bar(0), opt.baseAddr);
+            UIO.initialize(opt.device, &handler);
+        }
+        else
+        {
+            model = new IntrControllerModel(32);
+            handler.initialize(model);
+            UIO.initialize(model->uioFd(), model->configFd(), &handler);
+        }
+
+        // Hook each source up to its registers, and tell the handler what to expect of it
+        for (auto& p : opt.pattern)
+        {
+            line_t& l = line[p.irq];
+            l.active  = true;
+            l.pattern = p;
+
+            if (opt.hardware)
+                l.source.initialize(PCI.bar(0), opt.sourceAddr[p.irq]);
+            else
+            {
+                l.model = new TimerSourceModel(model, p.irq);
+                l.source.initialize(l.model);
+            }
+
+            // Make sure the source isn't still running from some earlier test
+            l.source.stopTimer();
+
+            if (p.clocks == 0) handler.irq[p.irq].periodTsc = l.source.periodNs(p.periodMs) / nsPerTsc();
+            irqMask |= (1u << p.irq);
+        }
+
+        // If the caller wants to watch us with intr_top, publish our statistics
+        if (opt.telemetry)
+        {
+            telemetry.open();
+            telemetry.addDevice(opt.hardware ? opt.device : "model", &handler, &UIO);
+            fprintf(stderr, "Publishing statistics to /dev/shm/%s\n", Telemetry::defaultName(getpid()).c_str());
+        }
+
+        // Enable the interrupts we're going to generate
+        handler.setIrqMask(irqMask);
+        handler.setGlobalEnable(true);
+    }
+    catch(const std::exception& e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+
+    // A long run can be cut short and still report
+    signal(SIGINT,  onSignal);
+    signal(SIGTERM, onSignal);
+
+    // Run the soak
+    uint64_t wallStart = nowNs();
+    run(opt);
+
+    // Give the handler a moment to catch up with the last few interrupts
+    uint64_t deadline = nowNs() + 1000000000ULL;
+    while (nowNs() < deadline)
+    {
+        bool caughtUp = true;
+        for (int irq=0; irq<32; ++irq) if (line[irq].active)
+        {
+            uint64_t total = handler.irq[irq].delivered + handler.irq[irq].lost;
+            if (total < expected(line[irq], nowNs())) caughtUp = false;
+        }
+        if (caughtUp) break;
+        usleep(1000);
+    }
+    uint64_t wallNs = nowNs() - wallStart;
+
+    // Decide where the results go
+    FILE* out = stdout;
+    if (!opt.outFile.empty() && (out = fopen(opt.outFile.c_str(), "w")) == nullptr)
+    {
+        fprintf(stderr, "Can't create %s\n", opt.outFile.c_str());
+        return 1;
+    }
+
+    // A periodic IRQ passes if nothing went missing.  We allow one interrupt either way at the
+    // ends, plus 100 ppm for the difference between the clocks.  A strobe that the handler gave
+    // up on but that was delivered after all (e.g. the last one, counted late with no later
+    // call to bring it) isn't lost, so the handler's losses are never more than the shortfall.
+    // A burst IRQ passes if every clock of every burst was counted.
+    bool pass  = true;
+    auto dispatch = handler.getDispatchStats();
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"backend\": \"%s\",\n", opt.hardware ? "hardware" : "model");
+    fprintf(out, "  \"mode\": \"%s\",\n", opt.mode.c_str());
+    fprintf(out, "  \"seconds\": %.3f,\n", wallNs / 1e9);
+    fprintf(out, "  \"wakeups\": %lu,\n", dispatch.wakeups);
+    fprintf(out, "  \"spurious_wakeups\": %lu,\n", dispatch.spurious);
+    fprintf(out, "  \"irqs\": [\n");
+
+    int remaining = __builtin_popcount(irqMask);
+    for (int irq=0; irq<32; ++irq) if (line[irq].active)
+    {
+        line_t&    l     = line[irq];
+        arrival_t& a     = handler.irq[irq];
+        auto       lat   = a.late.summarize();
+        uint64_t   want  = expected(l, nowNs());
+        uint64_t   got   = a.delivered;
+        uint64_t   lost  = a.lost;
+
+        fprintf(out, "    {\"irq\": %d, ", irq);
+        if (l.pattern.clocks)
+        {
+            lost = (want > got) ? want - got : 0;
+            pass = pass && (got == want);
+            fprintf(out, "\"pattern\": \"burst\", \"every_ms\": %u, \"clocks\": %u, \"bursts\": %lu, ",
+                    l.pattern.periodMs, l.pattern.clocks, l.bursts);
+        }
+        else
+        {
+            double slack = 1 + want * 1e-4;
+            uint64_t shortfall = (want > got) ? want - got : 0;
+            if (lost > shortfall) lost = shortfall;
+            pass = pass && (lost <= slack) && (got + slack >= want) && (got <= want + slack);
+            fprintf(out, "\"pattern\": \"periodic\", \"period_ms\": %u, \"drift_ppm\": %.2f, ",
+                    l.pattern.periodMs, a.driftPpm.load());
+        }
+
+        fprintf(out, "\"expected\": %lu, \"delivered\": %lu, \"lost\": %lu, \"merged\": %lu, \"isr_calls\": %lu,\n",
+                want, got, lost, a.merged.load(), a.calls.load());
+        fprintf(out, "     \"%s\": {\"count\": %lu, \"mean\": %.1f, \"p50\": %.1f, \"p99\": %.1f, \"p999\": %.1f, \"max\": %.1f}}%s\n",
+                l.pattern.clocks ? "burst_latency_ns" : "lateness_ns",
+                lat.count, lat.meanNs, lat.p50Ns, lat.p99Ns, lat.p999Ns, lat.maxNs,
+                --remaining ? "," : "");
+    }
+
+    fprintf(out, "  ],\n");
+    fprintf(out, "  \"result\": \"%s\"\n", pass ? "pass" : "fail");
+    fprintf(out, "}\n");
+
+    if (out != stdout) fclose(out);
+
+    // If interrupts went missing, say so in the exit code
+    return pass ? 0 : 2;
+}
+//================================================================================
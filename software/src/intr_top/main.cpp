@@ -0,0 +1,322 @@
+//=================================================================================================
+// intr_top - Shows a live, top-style view of the interrupt statistics that a process publishes
+//            through Telemetry
+//
+// The segment is mapped read-only and only ever read, so watching a process has no effect on it.
+//
+// Usage: intr_top [pid | segment name] [-d seconds] [-n iterations]
+//
+// With no pid or name, this watches the most recently created segment in /dev/shm.
+//=================================================================================================
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <dirent.h>
+#include <math.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string>
+#include "Telemetry.h"
+#include "CpuUtil.h"
+
+//================================================================================
+// Command line options
+//================================================================================
+struct options_t
+{
+    std::string name;
+    double      seconds    = 1;
+    int         iterations = 0;
+};
+//================================================================================
+
+
+//================================================================================
+// usage() - Displays help text and exits
+//================================================================================
+static void usage()
+{
+    printf
+    (
+        "usage: intr_top [pid | segment name] [options]\n"
+        "  -d seconds        Time between refreshes (default 1)\n"
+        "  -n iterations     Stop after this many refreshes (default: run until killed)\n"
+    );
+    exit(1);
+}
+//================================================================================
+
+
+//================================================================================
+// parseCommandLine() - Fills in the options from the command line
+//================================================================================
+static options_t parseCommandLine(int argc, char** argv)
+{
+    options_t opt;
+
+    for (int i=1; i<argc; ++i)
+    {
+        std::string arg = argv[i];
+        const char* value = (i + 1 < argc) ? argv[i+1] : nullptr;
+
+        // Anything that isn't an option is the process to watch
+        if (arg[0] != '-')
+        {
+            bool isPid = strspn(arg.c_str(), "0123456789") == arg.size();
+            opt.name = isPid ? Telemetry::defaultName(atoi(arg.c_str())) : arg;
+            continue;
+        }
+
+        // Every option takes a value
+        if (value == nullptr) usage();
+        ++i;
+
+        if      (arg == "-d") opt.seconds    = atof(value);
+        else if (arg == "-n") opt.iterations = atoi(value);
+        else usage();
+    }
+
+    if (opt.seconds <= 0) usage();
+    return opt;
+}
+//================================================================================
+
+
+//================================================================================
+// newestSegment() - Returns the name of the most recently created telemetry
+//                   segment in /dev/shm, or "" if there aren't any
+//================================================================================
+static std::string newestSegment()
+{
+    std::string prefix = Telemetry::defaultName(0);
+    prefix.resize(prefix.size() - 1);
+
+    std::string newest;
+    time_t      newestTime = 0;
+
+    DIR* dir = opendir("/dev/shm");
+    if (dir == nullptr) return "";
+
+    while (dirent* entry = readdir(dir))
+    {
+        struct stat sb;
+        if (strncmp(entry->d_name, prefix.c_str(), prefix.size()) != 0) continue;
+        if (stat(("/dev/shm/" + std::string(entry->d_name)).c_str(), &sb) != 0) continue;
+        if (newest.empty() || sb.st_mtime > newestTime)
+        {
+            newest     = entry->d_name;
+            newestTime = sb.st_mtime;
+        }
+    }
+
+    closedir(dir);
+    return newest;
+}
+//================================================================================
+
+
+//================================================================================
+// mapSegment() - Maps a telemetry segment read-only and checks that it's one
+//                we understand.  Returns nullptr (and says why) if it isn't.
+//================================================================================
+static const telemetry_segment_t* mapSegment(const std::string& name)
+{
+    std::string path = "/dev/shm/" + name;
+    struct stat sb;
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Can't open %s\n", path.c_str());
+        return nullptr;
+    }
+
+    if (fstat(fd, &sb) != 0 || sb.st_size < (off_t)sizeof(telemetry_segment_t))
+    {
+        fprintf(stderr, "%s is not a telemetry segment\n", path.c_str());
+        close(fd);
+        return nullptr;
+    }
+
+    void* ptr = mmap(0, sizeof(telemetry_segment_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED)
+    {
+        fprintf(stderr, "Can't map %s\n", path.c_str());
+        return nullptr;
+    }
+
+    auto segment = (const telemetry_segment_t*)ptr;
+    if (__atomic_load_n(&segment->magic, __ATOMIC_ACQUIRE) != TELEMETRY_MAGIC)
+    {
+        fprintf(stderr, "%s is not a telemetry segment\n", path.c_str());
+        return nullptr;
+    }
+
+    if (segment->version != TELEMETRY_VERSION)
+    {
+        fprintf(stderr, "%s is version %u, we understand version %u\n",
+                path.c_str(), segment->version, TELEMETRY_VERSION);
+        return nullptr;
+    }
+
+    return segment;
+}
+//================================================================================
+
+
+//================================================================================
+// readDevice() - Copies a device's slot under its seqlock.  Returns false if
+//                the writer kept it busy for the whole time we tried.
+//================================================================================
+static bool readDevice(const telemetry_device_t& slot, telemetry_device_t& copy)
+{
+    for (int attempt=0; attempt<1000; ++attempt)
+    {
+        uint32_t seq = __atomic_load_n(&slot.seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {cpuRelax(); continue;}
+
+        memcpy(&copy, &slot, sizeof copy);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot.seq, __ATOMIC_RELAXED) == seq) return true;
+    }
+
+    return false;
+}
+//================================================================================
+
+
+//================================================================================
+// printLatency() - Prints one line of the latency table
+//================================================================================
+static void printLatency(const char* stage, const latency_summary_t& s)
+{
+    printf("    %-15s %10lu %10.0f %10.0f %10.0f %10.0f\n",
+           stage, s.count, s.p50Ns, s.p99Ns, s.p999Ns, s.maxNs);
+}
+//================================================================================
+
+
+//================================================================================
+// The statistics of a device from the previous refresh, so that we can show
+// how they've changed since then
+//================================================================================
+struct previous_t
+{
+    bool     valid = false;
+    uint64_t timeNs, interrupts, wakeups, syscalls;
+};
+//================================================================================
+
+
+//================================================================================
+// showDevice() - Prints everything we know about one device
+//================================================================================
+static void showDevice(const telemetry_device_t& d, uint64_t now, previous_t& prev)
+{
+    static const char* modeName[] = {"block", "spin", "poll", "uring"};
+
+    // The rates are as of the last time the device was published, which is at
+    // most 100 ms ago while the process is alive.  They've been decaying since.
+    double age   = (now > d.updateNs) ? now - d.updateNs : 0;
+    double decay = (d.rateTauNs > 0) ? exp(-age / d.rateTauNs) : 1;
+
+    // Interrupts per second, over the time since the last refresh
+    double intrRate = 0, intrPerWake = 0, syscallsPerIntr = 0;
+    if (prev.valid && now > prev.timeNs)
+    {
+        uint64_t intr = d.interrupts - prev.interrupts;
+        uint64_t wake = d.wakeups - prev.wakeups;
+        intrRate = intr * 1e9 / (now - prev.timeNs);
+        if (wake) intrPerWake = (double)intr / wake;
+        if (intr) syscallsPerIntr = (double)(d.monitor.syscalls - prev.syscalls) / intr;
+    }
+    prev = {true, now, d.interrupts, d.wakeups, d.monitor.syscalls};
+
+    printf("%s\n", d.name);
+    if (d.hasMonitor)
+    {
+        const char* mode = (d.monitor.mode >= 0 && d.monitor.mode < 4) ? modeName[d.monitor.mode] : "?";
+        printf("  monitor  mode %-5s  cpu %-3d  io_uring %-3s  reconnects %lu\n",
+               mode, d.monitor.cpu, d.monitor.ioUring ? "yes" : "no", d.monitor.reconnects);
+    }
+
+    printf("  %10.1f intr/s  %8.2f intr/wakeup  %6.2f syscalls/intr  %6.2f%% spurious  %lu budget exhausted\n",
+           intrRate, intrPerWake, syscallsPerIntr,
+           d.wakeups ? 100.0 * d.spurious / d.wakeups : 0.0, d.budgetExhausted);
+
+    if (d.latencyTracking)
+    {
+        printf("    %-15s %10s %10s %10s %10s %10s\n", "latency (ns)", "count", "p50", "p99", "p99.9", "max");
+        printLatency("wake->pending", d.wakeToPending);
+        printLatency("re-enable",     d.reenable);
+        printLatency("total",         d.total);
+    }
+
+    // And every IRQ that has ever fired
+    printf("    %-4s %16s %12s %12s\n", "IRQ", "total", "rate/s", "saturated");
+    for (int irq=0; irq<32; ++irq)
+    {
+        const telemetry_irq_t& i = d.irq[irq];
+        if (i.total == 0) continue;
+        printf("    %-4d %16lu %12.1f %12lu\n", irq, i.total, i.rate * decay, i.saturations);
+    }
+    printf("\n");
+}
+//================================================================================
+
+
+//================================================================================
+// main() - Maps the segment and refreshes the display until told to stop
+//================================================================================
+int main(int argc, char** argv)
+{
+    options_t opt = parseCommandLine(argc, argv);
+    previous_t prev[TELEMETRY_MAX_DEVICES];
+
+    // If we weren't told which process to watch, find the newest one
+    if (opt.name.empty()) opt.name = newestSegment();
+    if (opt.name.empty())
+    {
+        fprintf(stderr, "No telemetry segments found in /dev/shm\n");
+        exit(1);
+    }
+
+    const telemetry_segment_t* segment = mapSegment(opt.name);
+    if (segment == nullptr) exit(1);
+
+    // Only clear the screen if someone is looking at it
+    bool interactive = isatty(STDOUT_FILENO);
+
+    for (int n=0; opt.iterations == 0 || n < opt.iterations; ++n)
+    {
+        if (n) usleep(opt.seconds * 1e6);
+
+        uint64_t now   = nowNs();
+        bool     alive = kill(segment->pid, 0) == 0 || errno == EPERM;
+
+        if (interactive) printf("\033[H\033[2J");
+        printf("intr_top - %s (pid %d)%s, up %.0f s\n\n", segment->process, segment->pid,
+               alive ? "" : " [exited]", (now - segment->startNs) / 1e9);
+
+        uint32_t count = __atomic_load_n(&segment->deviceCount, __ATOMIC_ACQUIRE);
+        for (uint32_t i=0; i<count && i<TELEMETRY_MAX_DEVICES; ++i)
+        {
+            telemetry_device_t device;
+            if (readDevice(segment->device[i], device))
+                showDevice(device, now, prev[i]);
+            else
+                printf("%s: busy\n\n", segment->device[i].name);
+        }
+
+        fflush(stdout);
+    }
+
+    return 0;
+}
+//================================================================================
@@ -0,0 +1,453 @@
+//=================================================================================================
+// intr_trace - Reads a file written by TraceRing::dump() and reconstructs what the interrupt-
+//              handling threads were doing: how long each wakeup took and where the time went,
+//              how far apart wakeups and interrupts arrived, and a timeline of the events
+//
+// Usage: intr_trace <file> [-worst n] [-timeline n]
+//
+// The timeline shows the "n" events leading up to the first trigger in the file, or the last
+// "n" events if there's no trigger.
+//=================================================================================================
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "TraceRing.h"
+
+//================================================================================
+// Command line options
+//================================================================================
+struct options_t
+{
+    std::string filename;
+    int         worst    = 5;
+    int         timeline = 40;
+};
+//================================================================================
+
+
+//================================================================================
+// An event, along with the thread that recorded it
+//================================================================================
+struct event_t
+{
+    trace_event_t event;
+    int           thread;
+};
+//================================================================================
+
+
+//================================================================================
+// One wakeup: from TRACE_WAKEUP to the TRACE_REENABLE (or the last
+// TRACE_HANDLER_EXIT) that finished it.  "first" and "last" are indices into
+// the thread's events.
+//================================================================================
+struct wakeup_t
+{
+    int         thread;
+    size_t      first, last;
+    uint64_t    durationTsc;
+};
+//================================================================================
+
+
+//================================================================================
+// Everything we read from the file
+//================================================================================
+struct trace_t
+{
+    trace_file_t                              header;
+    std::vector<trace_thread_t>               thread;
+    std::vector<std::vector<trace_event_t>>   events;
+};
+//================================================================================
+
+static const char* typeName[] =
+{
+    "?", "wakeup", "handler-enter", "handler-exit", "pending", "count",
+    "isr-enter", "isr-exit", "re-enable", "reconnect", "TRIGGER"
+};
+
+
+//================================================================================
+// usage() - Displays help text and exits
+//================================================================================
+static void usage()
+{
+    printf
+    (
+        "usage: intr_trace <file> [options]\n"
+        "  -worst n          Show the n slowest wakeups in detail (default 5)\n"
+        "  -timeline n       Show the n events leading up to the trigger (default 40)\n"
+    );
+    exit(1);
+}
+//================================================================================
+
+
+//================================================================================
+// parseCommandLine() - Fills in the options from the command line
+//================================================================================
+static options_t parseCommandLine(int argc, char** argv)
+{
+    options_t opt;
+
+    for (int i=1; i<argc; ++i)
+    {
+        std::string arg = argv[i];
+        const char* value = (i + 1 < argc) ? argv[i+1] : nullptr;
+
+        if (arg[0] != '-') {opt.filename = arg; continue;}
+
+        // Every option takes a value
+        if (value == nullptr) usage();
+        ++i;
+
+        if      (arg == "-worst"   ) opt.worst    = atoi(value);
+        else if (arg == "-timeline") opt.timeline = atoi(value);
+        else usage();
+    }
+
+    if (opt.filename.empty()) usage();
+    return opt;
+}
+//================================================================================
+
+
+//================================================================================
+// readTrace() - Reads a trace file, exiting if it isn't one
+//================================================================================
+static trace_t readTrace(const std::string& filename)
+{
+    trace_t trace;
+
+    FILE* file = fopen(filename.c_str(), "rb");
+    if (file == nullptr)
+    {
+        fprintf(stderr, "Can't open %s\n", filename.c_str());
+        exit(1);
+    }
+
+    if (fread(&trace.header, sizeof trace.header, 1, file) != 1 || trace.header.magic != TRACE_MAGIC)
+    {
+        fprintf(stderr, "%s is not a trace file\n", filename.c_str());
+        exit(1);
+    }
+
+    if (trace.header.version != TRACE_VERSION)
+    {
+        fprintf(stderr, "%s is version %u, we understand version %u\n",
+                filename.c_str(), trace.header.version, TRACE_VERSION);
+        exit(1);
+    }
+
+    trace.thread.resize(trace.header.threadCount);
+    trace.events.resize(trace.header.threadCount);
+    for (uint32_t i=0; i<trace.header.threadCount; ++i)
+    {
+        bool ok = fread(&trace.thread[i], sizeof trace.thread[i], 1, file) == 1;
+        trace.events[i].resize(ok ? trace.thread[i].eventCount : 0);
+        if (ok && trace.thread[i].eventCount)
+        {
+            ok = fread(trace.events[i].data(), sizeof(trace_event_t), trace.thread[i].eventCount, file)
+               == trace.thread[i].eventCount;
+        }
+        if (!ok)
+        {
+            fprintf(stderr, "%s is truncated\n", filename.c_str());
+            exit(1);
+        }
+    }
+
+    fclose(file);
+    return trace;
+}
+//================================================================================
+
+
+//================================================================================
+// findWakeups() - Splits every thread's events into wakeups
+//================================================================================
+static std::vector<wakeup_t> findWakeups(const trace_t& trace)
+{
+    std::vector<wakeup_t> wakeups;
+
+    for (size_t t=0; t<trace.events.size(); ++t)
+    {
+        const std::vector<trace_event_t>& events = trace.events[t];
+        bool     open = false;
+        wakeup_t wakeup;
+
+        for (size_t i=0; i<events.size(); ++i)
+        {
+            uint8_t type = events[i].type;
+
+            // A new wakeup finishes any that hadn't been re-enabled, at its last handler exit
+            if (type == TRACE_WAKEUP)
+            {
+                if (open && wakeup.last != wakeup.first) wakeups.push_back(wakeup);
+                wakeup = {(int)t, i, i, 0};
+                open   = true;
+            }
+
+            else if (open && (type == TRACE_HANDLER_EXIT || type == TRACE_REENABLE))
+            {
+                wakeup.last        = i;
+                wakeup.durationTsc = events[i].tsc - events[wakeup.first].tsc;
+                if (type == TRACE_REENABLE)
+                {
+                    wakeups.push_back(wakeup);
+                    open = false;
+                }
+            }
+        }
+
+        if (open && wakeup.last != wakeup.first) wakeups.push_back(wakeup);
+    }
+
+    return wakeups;
+}
+//================================================================================
+
+
+//================================================================================
+// printDistribution() - Prints the percentiles of a set of durations and a
+//                       histogram of them in power-of-2 nanosecond buckets
+//================================================================================
+static void printDistribution(const char* title, std::vector<double> ns)
+{
+    printf("%s\n", title);
+    if (ns.empty())
+    {
+        printf("  (none)\n\n");
+        return;
+    }
+
+    std::sort(ns.begin(), ns.end());
+    auto pct = [&](double p) {return ns[std::min(ns.size() - 1, (size_t)(p * ns.size()))];};
+
+    double sum = 0;
+    for (double v : ns) sum += v;
+
+    printf("  count %zu  mean %.0f ns  p50 %.0f  p99 %.0f  p99.9 %.0f  max %.0f\n",
+           ns.size(), sum / ns.size(), pct(0.50), pct(0.99), pct(0.999), ns.back());
+
+    // A histogram with one bucket per power of 2
+    uint64_t bucket[64] = {};
+    for (double v : ns) ++bucket[v < 1 ? 0 : 63 - __builtin_clzll((uint64_t)v)];
+
+    uint64_t most = *std::max_element(bucket, bucket + 64);
+    for (int b=0; b<64; ++b) if (bucket[b])
+    {
+        int bar = (int)(40.0 * bucket[b] / most);
+        printf("  %10.0f ns+ %10lu  %.*s\n", (double)(1ULL << b), bucket[b], bar,
+               "########################################");
+    }
+    printf("\n");
+}
+//================================================================================
+
+
+//================================================================================
+// describe() - Returns a one-line description of an event
+//================================================================================
+static std::string describe(const trace_event_t& e)
+{
+    char text[128];
+
+    switch (e.type)
+    {
+        case TRACE_WAKEUP:
+            sprintf(text, "%-14s %s", typeName[e.type], e.irq ? "(spinning)" : "(kernel)");
+            break;
+        case TRACE_PENDING:
+            sprintf(text, "%-14s 0x%08X", typeName[e.type], e.value);
+            break;
+        case TRACE_COUNT:
+            sprintf(text, "%-14s irq %u x%u", typeName[e.type], e.irq, e.value);
+            break;
+        case TRACE_ISR_ENTER:
+        case TRACE_ISR_EXIT:
+            sprintf(text, "%-14s irq %u", typeName[e.type], e.irq);
+            break;
+        case TRACE_HANDLER_EXIT:
+            sprintf(text, "%-14s %u passes", typeName[e.type], e.value);
+            break;
+        case TRACE_RECONNECT:
+        case TRACE_TRIGGER:
+            sprintf(text, "%-14s %u us", typeName[e.type], e.value);
+            break;
+        default:
+            sprintf(text, "%s", e.type < 11 ? typeName[e.type] : "?");
+    }
+
+    return text;
+}
+//================================================================================
+
+
+//================================================================================
+// showWorst() - Prints the events of the slowest wakeups, with how long after
+//               the wakeup each one happened and how long since the previous
+//================================================================================
+static void showWorst(const trace_t& trace, std::vector<wakeup_t> wakeups, int count)
+{
+    double nsPerTsc = trace.header.nsPerTsc;
+
+    std::sort(wakeups.begin(), wakeups.end(),
+              [](const wakeup_t& a, const wakeup_t& b) {return a.durationTsc > b.durationTsc;});
+    if ((int)wakeups.size() > count) wakeups.resize(count);
+
+    for (const wakeup_t& w : wakeups)
+    {
+        const std::vector<trace_event_t>& events = trace.events[w.thread];
+        uint64_t start = events[w.first].tsc;
+
+        printf("Wakeup on thread %d (%s): %.2f us, %.3f s before the dump\n",
+               trace.thread[w.thread].tid, trace.thread[w.thread].name, w.durationTsc * nsPerTsc / 1000,
+               (trace.header.dumpTsc - start) * nsPerTsc / 1e9);
+
+        for (size_t i=w.first; i<=w.last; ++i)
+        {
+            uint64_t prev = (i == w.first) ? start : events[i-1].tsc;
+            printf("  %+10.2f us  (%+9.2f)  %s\n", (events[i].tsc - start) * nsPerTsc / 1000,
+                   (events[i].tsc - prev) * nsPerTsc / 1000, describe(events[i]).c_str());
+        }
+        printf("\n");
+    }
+}
+//================================================================================
+
+
+//================================================================================
+// showTimeline() - Prints the events of every thread, merged in time order, that
+//                  lead up to the first trigger (or to the end of the trace)
+//================================================================================
+static void showTimeline(const trace_t& trace, int count)
+{
+    double nsPerTsc = trace.header.nsPerTsc;
+
+    std::vector<event_t> merged;
+    for (size_t t=0; t<trace.events.size(); ++t)
+    {
+        for (const trace_event_t& e : trace.events[t]) merged.push_back({e, (int)t});
+    }
+    std::stable_sort(merged.begin(), merged.end(),
+                     [](const event_t& a, const event_t& b) {return a.event.tsc < b.event.tsc;});
+    if (merged.empty()) return;
+
+    // Find the first trigger, and stop a little after it.  Times are shown relative to the
+    // trigger, or to the last event if there isn't one.
+    size_t   end    = merged.size();
+    uint64_t origin = merged.back().event.tsc;
+    for (size_t i=0; i<merged.size(); ++i) if (merged[i].event.type == TRACE_TRIGGER)
+    {
+        end    = std::min(merged.size(), i + 1 + count / 4);
+        origin = merged[i].event.tsc;
+        break;
+    }
+    size_t begin = (end > (size_t)count) ? end - count : 0;
+
+    printf("Timeline (%s)\n", origin == merged.back().event.tsc ? "the end of the trace" : "around the trigger");
+    for (size_t i=begin; i<end; ++i)
+    {
+        const event_t& e = merged[i];
+        printf("  %+12.2f us  %-16s  %s\n", ((double)e.event.tsc - origin) * nsPerTsc / 1000,
+               trace.thread[e.thread].name, describe(e.event).c_str());
+    }
+    printf("\n");
+}
+//================================================================================
+
+
+//================================================================================
+// main() - Reads the trace and prints everything we can work out from it
+//================================================================================
+int main(int argc, char** argv)
+{
+    options_t opt      = parseCommandLine(argc, argv);
+    trace_t   trace    = readTrace(opt.filename);
+    double    nsPerTsc = trace.header.nsPerTsc;
+
+    // Say what's in the file
+    printf("%s: %s dump, %u threads\n", opt.filename.c_str(),
+           trace.header.triggered ? "triggered" : "on-demand", trace.header.threadCount);
+    for (size_t t=0; t<trace.thread.size(); ++t)
+    {
+        const std::vector<trace_event_t>& events = trace.events[t];
+        double span = events.empty() ? 0 : (events.back().tsc - events.front().tsc) * nsPerTsc / 1e9;
+        printf("  thread %-7d %-16s %9u events over %.3f s, %lu older events lost\n",
+               trace.thread[t].tid, trace.thread[t].name, trace.thread[t].eventCount, span,
+               trace.thread[t].lost);
+    }
+    printf("\n");
+
+    // How long each wakeup took from start to finish, and to get to the pending register
+    std::vector<wakeup_t> wakeups = findWakeups(trace);
+    std::vector<double>   duration, toPending, arrival;
+    for (const wakeup_t& w : wakeups)
+    {
+        const std::vector<trace_event_t>& events = trace.events[w.thread];
+        duration.push_back(w.durationTsc * nsPerTsc);
+        for (size_t i=w.first; i<=w.last; ++i) if (events[i].type == TRACE_PENDING)
+        {
+            toPending.push_back((events[i].tsc - events[w.first].tsc) * nsPerTsc);
+            break;
+        }
+    }
+    printDistribution("Wakeup to end of servicing", duration);
+    printDistribution("Wakeup to pending register read", toPending);
+
+    // How long ISRs took, and how far apart wakeups and each IRQ's interrupts arrived
+    std::vector<double> isrNs, irqArrival[32];
+    uint64_t            lastCount[32];
+    for (size_t t=0; t<trace.events.size(); ++t)
+    {
+        const std::vector<trace_event_t>& events = trace.events[t];
+        uint64_t enter = 0, lastWake = 0;
+        memset(lastCount, 0, sizeof lastCount);
+
+        for (const trace_event_t& e : events)
+        {
+            int irq = e.irq & 31;
+            switch (e.type)
+            {
+                case TRACE_WAKEUP:
+                    if (lastWake) arrival.push_back((e.tsc - lastWake) * nsPerTsc);
+                    lastWake = e.tsc;
+                    break;
+                case TRACE_ISR_ENTER:
+                    enter = e.tsc;
+                    break;
+                case TRACE_ISR_EXIT:
+                    if (enter) isrNs.push_back((e.tsc - enter) * nsPerTsc);
+                    enter = 0;
+                    break;
+                case TRACE_COUNT:
+                    if (lastCount[irq]) irqArrival[irq].push_back((e.tsc - lastCount[irq]) * nsPerTsc);
+                    lastCount[irq] = e.tsc;
+                    break;
+            }
+        }
+    }
+    printDistribution("Interrupt service routines", isrNs);
+    printDistribution("Wakeup inter-arrival", arrival);
+
+    for (int irq=0; irq<32; ++irq) if (!irqArrival[irq].empty())
+    {
+        char title[64];
+        sprintf(title, "IRQ %d inter-arrival", irq);
+        printDistribution(title, irqArrival[irq]);
+    }
+
+    // The slowest wakeups, event by event
+    if (opt.worst > 0) showWorst(trace, wakeups, opt.worst);
+
+    // And what everyone was doing around the trigger
+    if (opt.timeline > 0) showTimeline(trace, opt.timeline);
+
+    return 0;
+}
+//================================================================================
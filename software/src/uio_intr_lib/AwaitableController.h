@@ -0,0 +1,294 @@
+//==========================================================================================================
+// AwaitableController.h - Defines an interrupt controller whose interrupts can be awaited by C++20
+//                         coroutines
+//
+// Instead of overriding isr(), a coroutine waits for an IRQ with:
+//
+//      uint32_t count = co_await controller.irq(3);
+//
+// which suspends the coroutine until topLevelHandler() next services IRQ 3, and yields the count
+// that was handed to isr().  Every coroutine waiting on an IRQ is resumed when it fires, so any
+// number of them can share a single monitor thread.  If an IRQ fires while nobody is waiting for
+// it, its count is held for the next coroutine that waits on it, which doesn't suspend at all.
+//
+// Coroutines are resumed by an IrqExecutor.  By default that's InlineExecutor, which resumes them
+// right there in the thread that called topLevelHandler().  IrqThreadExecutor resumes them in a
+// thread of its own, so that a slow coroutine never delays the monitor.
+//
+// Nothing on the path from isr() to a resumed coroutine allocates memory: the list a waiter sits
+// on and the queue an executor keeps are linked through the awaiter itself, which lives in the
+// waiting coroutine's frame.
+//
+// This header needs C++20.  IrqTask is a minimal coroutine type for starting a coroutine that
+// nobody waits for; any other coroutine type can co_await irq() just as well.
+//==========================================================================================================
+#pragma once
+#if __cplusplus < 202002L
+#error "AwaitableController.h requires C++20"
+#endif
+#include <stdint.h>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include "IntrControlBase.h"
+#include "Futex.h"
+
+//==========================================================================================================
+// One of these exists for every suspended coroutine.  It lives inside the coroutine's awaiter.
+//==========================================================================================================
+struct irq_waiter_t
+{
+    // The next waiter on the same IRQ, or in the same executor queue
+    irq_waiter_t*           next;
+
+    // The coroutine to resume, and the count to hand it when it resumes
+    std::coroutine_handle<> handle;
+    uint32_t                count;
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// An executor decides where a coroutine resumes.  post() must not allocate: "waiter->next" is
+// free for the executor's own use until the coroutine has been resumed.
+//==========================================================================================================
+class IrqExecutor
+{
+public:
+    virtual ~IrqExecutor() {}
+    virtual void post(irq_waiter_t* waiter) = 0;
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// Resumes the coroutine immediately, in the thread that serviced the interrupt
+//==========================================================================================================
+class InlineExecutor : public IrqExecutor
+{
+public:
+    void post(irq_waiter_t* waiter) override {waiter->handle.resume();}
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// Resumes coroutines, in the order they were posted, in a thread of its own.  The thread sleeps on
+// a futex when there's nothing to do.
+//==========================================================================================================
+class IrqThreadExecutor : public IrqExecutor
+{
+public:
+
+    IrqThreadExecutor() : thread_(&IrqThreadExecutor::run, this) {}
+
+    // Destructor - Resumes whatever has already been posted, then stops the thread
+    ~IrqThreadExecutor()
+    {
+        stopping_ = true;
+        ++posted_;
+        futexWake(&posted_);
+        thread_.join();
+    }
+
+    // No copy or assignment constructor - objects of this class can't be copied
+    IrqThreadExecutor (const IrqThreadExecutor&) = delete;
+    IrqThreadExecutor& operator= (const IrqThreadExecutor&) = delete;
+
+    // Adds the waiter to the end of the queue and wakes the thread
+    void post(irq_waiter_t* waiter) override
+    {
+        waiter->next = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (tail_) tail_->next = waiter; else head_ = waiter;
+            tail_ = waiter;
+        }
+        ++posted_;
+        futexWake(&posted_);
+    }
+
+protected:
+
+    // This runs in our thread
+    void run()
+    {
+        while (true)
+        {
+            uint32_t posted = posted_;
+
+            // Take everything that's in the queue
+            irq_waiter_t* waiter;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                waiter = head_;
+                head_  = tail_ = nullptr;
+            }
+
+            // If there was nothing to do, either exit or wait for something to be posted
+            if (waiter == nullptr)
+            {
+                if (stopping_) return;
+                futexWait(&posted_, posted);
+                continue;
+            }
+
+            // Resume each coroutine.  Fetch "next" first: once resumed, the waiter is gone.
+            while (waiter)
+            {
+                irq_waiter_t* next = waiter->next;
+                waiter->handle.resume();
+                waiter = next;
+            }
+        }
+    }
+
+    std::mutex            mutex_;
+    irq_waiter_t*         head_ = nullptr;
+    irq_waiter_t*         tail_ = nullptr;
+    std::atomic<uint32_t> posted_{0};
+    std::atomic<bool>     stopping_{false};
+    std::thread           thread_;
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// A coroutine that starts running as soon as it's called and destroys itself when it finishes
+//==========================================================================================================
+struct IrqTask
+{
+    struct promise_type
+    {
+        IrqTask             get_return_object()   {return {};}
+        std::suspend_never  initial_suspend()     {return {};}
+        std::suspend_never  final_suspend() noexcept {return {};}
+        void                return_void()         {}
+        void                unhandled_exception() {std::terminate();}
+    };
+};
+//==========================================================================================================
+
+
+class AwaitableController : public IntrControlBase
+{
+public:
+
+    // If no executor is given, coroutines resume in the thread that calls topLevelHandler()
+    AwaitableController(IrqExecutor* executor = nullptr) {setExecutor(executor);}
+
+    // Deferred ISRs resume our waiters, so the workers have to stop before they go
+    ~AwaitableController() {stopDeferredIsr();}
+
+    // Selects where coroutines resume.  The executor must outlive this object.
+    void setExecutor(IrqExecutor* executor) {executor_ = executor ? executor : &inline_;}
+
+    //------------------------------------------------------------------------------------------
+    // This is what "co_await controller.irq(n)" waits on
+    //------------------------------------------------------------------------------------------
+    class irq_awaiter_t
+    {
+    public:
+
+        irq_awaiter_t(AwaitableController* controller, int irq) : controller_(controller), irq_(irq) {}
+
+        // We never know without the lock whether a count is already waiting for us
+        bool await_ready() {return false;}
+
+        // Either takes the count that's waiting for us (and doesn't suspend), or joins the waiters
+        bool await_suspend(std::coroutine_handle<> handle)
+        {
+            waiter_.handle = handle;
+            return controller_->addWaiter(irq_, &waiter_);
+        }
+
+        // Yields the count that was handed to isr()
+        uint32_t await_resume() {return waiter_.count;}
+
+    protected:
+        AwaitableController* controller_;
+        int                  irq_;
+        irq_waiter_t         waiter_;
+    };
+    //------------------------------------------------------------------------------------------
+
+    // Returns something a coroutine can co_await until IRQ "irq" is next serviced
+    irq_awaiter_t irq(int irq) {return irq_awaiter_t(this, irq & 31);}
+
+protected:
+
+    //------------------------------------------------------------------------------------------
+    // addWaiter() - Adds a waiter to an IRQ, unless there's a count waiting to be picked up.
+    //               Returns false if the waiter got a count and shouldn't suspend.
+    //------------------------------------------------------------------------------------------
+    bool addWaiter(int irq, irq_waiter_t* waiter)
+    {
+        std::lock_guard<std::mutex> lock(irq_[irq].mutex);
+
+        if (irq_[irq].unclaimed)
+        {
+            waiter->count = irq_[irq].unclaimed;
+            irq_[irq].unclaimed = 0;
+            return false;
+        }
+
+        waiter->next = irq_[irq].waiters;
+        irq_[irq].waiters = waiter;
+        return true;
+    }
+    //------------------------------------------------------------------------------------------
+
+
+    //------------------------------------------------------------------------------------------
+    // isr() - Hands the count to everyone who's waiting on this IRQ
+    //------------------------------------------------------------------------------------------
+    void isr(uint32_t pending, int irq, uint32_t count) override
+    {
+        irq_waiter_t* waiter;
+
+        // Take the list of waiters.  If there aren't any, keep the count for the next one.
+        {
+            std::lock_guard<std::mutex> lock(irq_[irq].mutex);
+            waiter = irq_[irq].waiters;
+            irq_[irq].waiters = nullptr;
+            if (waiter == nullptr) irq_[irq].unclaimed += count;
+        }
+
+        // Waiters were pushed on the front of the list: reverse it so they resume in the order
+        // they started waiting
+        irq_waiter_t* ordered = nullptr;
+        while (waiter)
+        {
+            irq_waiter_t* next = waiter->next;
+            waiter->next = ordered;
+            ordered = waiter;
+            waiter = next;
+        }
+
+        // And resume them.  Fetch "next" first: once posted, the waiter belongs to the executor.
+        while (ordered)
+        {
+            irq_waiter_t* next = ordered->next;
+            ordered->count = count;
+            executor_->post(ordered);
+            ordered = next;
+        }
+    }
+    //------------------------------------------------------------------------------------------
+
+    // The waiters and unclaimed count of each IRQ, one cache-line apiece
+    struct alignas(64) irq_state_t
+    {
+        std::mutex    mutex;
+        irq_waiter_t* waiters   = nullptr;
+        uint32_t      unclaimed = 0;
+    };
+    irq_state_t     irq_[32];
+
+    // Where coroutines resume
+    InlineExecutor  inline_;
+    IrqExecutor*    executor_;
+};
+//==========================================================================================================
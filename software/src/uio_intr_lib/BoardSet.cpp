@@ -0,0 +1,224 @@
+//=================================================================================================
+// BoardSet.cpp - Implements a class that manages every card of one type in the system
+//=================================================================================================
+#include <stdio.h>
+#include <stdarg.h>
+#include <map>
+#include <thread>
+#include <exception>
+#include <stdexcept>
+#include "BoardSet.h"
+#include "PciDiscovery.h"
+
+
+//=================================================================================================
+// throwRuntime() - Throws a runtime exception
+//=================================================================================================
+static void throwRuntime(const char* fmt, ...)
+{
+    char buffer[1024];
+    va_list ap;
+    va_start(ap, fmt);
+    vsprintf(buffer, fmt, ap);
+    va_end(ap);
+
+    throw std::runtime_error(buffer);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// open() - Finds the cards, creates their handlers in node-local memory, and starts a monitor
+//          thread for each card on a CPU that's local to it
+//=================================================================================================
+int BoardSet::open(std::string device, const std::vector<uint32_t>& baseAddress, int bar,
+                   thread_placement_t placement, size_t size, size_t align, construct_t construct)
+{
+    // How many cards we've placed on each NUMA node, so we can spread them across its CPUs
+    std::map<int, int> placedOnNode;
+
+    if (!board_.empty()) throwRuntime("BoardSet is already open");
+    if (baseAddress.empty()) throwRuntime("No interrupt controller base addresses");
+
+    // Find the cards
+    std::vector<std::string> bdfs;
+    if (PciDiscovery::isBdf(device))
+        bdfs.push_back(device);
+    else
+        bdfs = PciDiscovery::find(device);
+    if (bdfs.empty()) throwRuntime("No PCI device %s", device.c_str());
+
+    // Each handler starts on a cache-line boundary, so that handlers for different
+    // controllers never share a line
+    if (align < 64) align = 64;
+    size_t stride = (size + align - 1) / align * align;
+
+    for (auto& bdf : bdfs)
+    {
+        board_t* board = new board_t;
+        board_.push_back(board);
+
+        // Find out where the card is attached
+        board->info.bdf       = bdf;
+        board->info.numaNode  = getPciNumaNode(bdf);
+        board->info.localCpus = getPciLocalCpus(bdf);
+        if (board->info.localCpus.empty()) throwRuntime("No CPUs are local to %s", bdf.c_str());
+        int index = placedOnNode[board->info.numaNode]++;
+        board->info.cpu = board->info.localCpus[index % board->info.localCpus.size()];
+
+        // The card's monitor thread runs on one of the card's local CPUs
+        placement.cpu = board->info.cpu;
+
+        // The rest of the card's setup runs on its node, so that what the handlers and
+        // the UIO interface allocate for themselves (their shadow registers, say) is local
+        onBoardNode(board, [&]()
+        {
+            // Map the card's registers
+            board->pci.open(bdf);
+            uint8_t* userspacePtr = board->pci.bar(bar);
+
+            // Build the handlers in memory that belongs to the card's node, and point each
+            // of them at its controller
+            uint8_t* memory = (uint8_t*)allocateOnNode(stride * baseAddress.size(), board->info.numaNode);
+            for (size_t i=0; i<baseAddress.size(); ++i)
+            {
+                IntrControlBase* handler = construct(memory + i * stride);
+                handler->initialize(userspacePtr, baseAddress[i]);
+                board->handler.push_back(handler);
+            }
+
+            board->uio.setPlacement(placement);
+
+            // If the card is hot-reset, the monitor will map its registers again
+            board->uio.setPciDevice(&board->pci, baseAddress, bar);
+
+            // And start servicing the card's interrupts
+            board->uio.initialize(bdf, board->handler);
+        });
+    }
+
+    controllerCount_ = baseAddress.size();
+    return board_.size();
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// onBoardNode() - Runs "fn" on a thread that's bound to the card's node and local CPUs
+//=================================================================================================
+void BoardSet::onBoardNode(board_t* board, const std::function<void()>& fn)
+{
+    std::exception_ptr error;
+
+    std::thread th([&]()
+    {
+        bindThreadToNode(board->info.numaNode, board->info.localCpus);
+        try
+        {
+            fn();
+        }
+        catch(...)
+        {
+            error = std::current_exception();
+        }
+    });
+    th.join();
+
+    if (error) std::rethrow_exception(error);
+}
+
+void BoardSet::onBoardNode(int board, const std::function<void()>& fn)
+{
+    check(board);
+    onBoardNode(board_[board], fn);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// check() - Throws if "board" or "ctrl" doesn't exist
+//=================================================================================================
+void BoardSet::check(int board, int ctrl)
+{
+    if (board < 0 || board >= (int)board_.size()) throwRuntime("No such board %d", board);
+    if (ctrl  < 0 || ctrl  >= controllerCount_)   throwRuntime("No such controller %d", ctrl);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// Accessors for the parts of each card
+//=================================================================================================
+IntrControlBase* BoardSet::handler(int board, int ctrl)
+{
+    check(board, ctrl);
+    return board_[board]->handler[ctrl];
+}
+
+const BoardSet::board_info_t& BoardSet::info(int board)
+{
+    check(board);
+    return board_[board]->info;
+}
+
+UioInterface& BoardSet::uio(int board)
+{
+    check(board);
+    return board_[board]->uio;
+}
+
+PciDevice& BoardSet::pci(int board)
+{
+    check(board);
+    return board_[board]->pci;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// setIrqMask() - Enables the same IRQs on every controller of every card
+//=================================================================================================
+void BoardSet::setIrqMask(uint32_t mask)
+{
+    for (auto board : board_) for (auto handler : board->handler) handler->setIrqMask(mask);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// setGlobalEnable() - Globally enables (or disables) interrupts on every controller of every card
+//=================================================================================================
+void BoardSet::setGlobalEnable(bool flag)
+{
+    for (auto board : board_) for (auto handler : board->handler) handler->setGlobalEnable(flag);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// getDispatchStats() - Returns the dispatch statistics of one card
+//=================================================================================================
+IntrControlBase::dispatch_stats_t BoardSet::getDispatchStats(int board)
+{
+    IntrControlBase::dispatch_stats_t stats = {};
+
+    check(board);
+    for (auto handler : board_[board]->handler) stats += handler->getDispatchStats();
+
+    return stats;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// getDispatchStats() - Returns the dispatch statistics summed across every card
+//=================================================================================================
+IntrControlBase::dispatch_stats_t BoardSet::getDispatchStats()
+{
+    IntrControlBase::dispatch_stats_t stats = {};
+
+    for (size_t board=0; board<board_.size(); ++board) stats += getDispatchStats(board);
+
+    return stats;
+}
+//=================================================================================================
@@ -0,0 +1,130 @@
+//=================================================================================================
+// BoardSet.h - Defines a class that manages every card of one type in the system, each of them
+//              containing one or more interrupt controllers
+//=================================================================================================
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <functional>
+#include <new>
+#include "IntrControlBase.h"
+#include "UioInterface.h"
+#include "PciDevice.h"
+#include "ThreadPlacement.h"
+
+//-------------------------------------------------------------------
+// For each card, open() creates a PciDevice, one interrupt handler
+// per controller, and a UioInterface whose monitor thread services
+// all of that card's controllers.
+//
+// Everything a card's interrupts touch is kept on the NUMA node the
+// card is attached to: the handlers are allocated from that node's
+// memory, whatever they allocate while being set up is allocated by
+// a thread bound to that node, and the monitor thread is pinned to
+// one of the CPUs that sysfs says is local to the card.  Cards on
+// the same node are spread across that node's CPUs.
+//
+// Anything the handlers allocate later (latency histograms, worker
+// pools, storm control) should be set up through onBoardNode().
+//
+// Like UioInterface, a BoardSet is meant to live for the life of the
+// program.  The monitor threads can't be stopped, so nothing they
+// use is ever freed.
+//-------------------------------------------------------------------
+class BoardSet
+{
+public:
+
+    // This describes one card and where its interrupts are serviced
+    struct board_info_t
+    {
+        // The card's PCI address
+        std::string      bdf;
+
+        // The NUMA node the card is attached to (-1 if unknown) and the CPUs local to it
+        int              numaNode;
+        std::vector<int> localCpus;
+
+        // The CPU the card's monitor thread is pinned to
+        int              cpu;
+    };
+
+    // Default constructor
+    BoardSet() {}
+
+    // No copy or assignment constructor - objects of this class can't be copied
+    BoardSet (const BoardSet&) = delete;
+    BoardSet& operator= (const BoardSet&) = delete;
+
+    // Finds every card that matches "device" (either "vendorID:deviceID" or a single BDF) and
+    // creates a "Handler" for each of the controllers at BAR "bar" + baseAddress[i] on each
+    // card.  "placement" supplies the scheduling policy and IRQ steering of the monitor threads;
+    // its CPU is ignored in favour of one that's local to the card.  Returns the number of cards.
+    template <class Handler>
+    int open(std::string device, const std::vector<uint32_t>& baseAddress, int bar = 0,
+             thread_placement_t placement = {})
+    {
+        return open(device, baseAddress, bar, placement, sizeof(Handler), alignof(Handler),
+                    [](void* ptr) -> IntrControlBase* {return new (ptr) Handler;});
+    }
+
+    // Returns the number of cards, and the number of controllers on each one
+    int         boardCount() {return board_.size();}
+    int         controllerCount() {return controllerCount_;}
+
+    // Returns the handler for controller "ctrl" on card "board"
+    IntrControlBase* handler(int board, int ctrl = 0);
+
+    // Returns a description of card "board"
+    const board_info_t& info(int board);
+
+    // Returns the UIO interface and PCI device of card "board"
+    UioInterface&    uio(int board);
+    PciDevice&       pci(int board);
+
+    // Calls "fn" on a thread bound to the NUMA node (and local CPUs) of card "board", and
+    // waits for it to return.  Whatever "fn" allocates comes from the card's node, and any
+    // thread it starts stays on the card's CPUs.  Exceptions thrown by "fn" are rethrown.
+    void        onBoardNode(int board, const std::function<void()>& fn);
+
+    // Enables the same IRQs (and globally enables interrupts) on every controller of every card
+    void        setIrqMask(uint32_t mask);
+    void        setGlobalEnable(bool flag);
+
+    // Returns the dispatch statistics of card "board", summed across its controllers
+    IntrControlBase::dispatch_stats_t getDispatchStats(int board);
+
+    // Returns the dispatch statistics summed across every card
+    IntrControlBase::dispatch_stats_t getDispatchStats();
+
+protected:
+
+    // Constructs a handler in the memory at "ptr"
+    typedef IntrControlBase* (*construct_t)(void* ptr);
+
+    // The implementation of open(), with the handler type boiled down to its size, alignment
+    // and a way to construct one
+    int         open(std::string device, const std::vector<uint32_t>& baseAddress, int bar,
+                     thread_placement_t placement, size_t size, size_t align, construct_t construct);
+
+    // Everything that belongs to one card
+    struct board_t
+    {
+        board_info_t     info;
+        PciDevice        pci;
+        UioInterface     uio;
+        std::vector<IntrControlBase*> handler;
+    };
+
+    // Throws if "board" (or "ctrl") is out of range
+    void        check(int board, int ctrl = 0);
+
+    // Calls "fn" on a thread bound to the node of "board"
+    void        onBoardNode(board_t* board, const std::function<void()>& fn);
+
+    // One entry per card, in BDF order
+    std::vector<board_t*> board_;
+    int                   controllerCount_ = 0;
+};
+//-------------------------------------------------------------------
@@ -0,0 +1,41 @@
+//=================================================================================================
+// CpuUtil.cpp - Implements the parts of CpuUtil.h that aren't inline
+//=================================================================================================
+#include <unistd.h>
+#include "CpuUtil.h"
+
+//=================================================================================================
+// calibrate() - Measures how many nanoseconds one tick of readTsc() lasts
+//=================================================================================================
+static double calibrate()
+{
+#if defined(__aarch64__)
+    // The generic timer tells us its own frequency
+    uint64_t frequency;
+    asm volatile("mrs %0, cntfrq_el0" : "=r"(frequency));
+    return 1e9 / frequency;
+#elif defined(__x86_64__) || defined(__i386__)
+    // Count how many ticks go by in a known interval of wall-clock time
+    uint64_t startNs  = nowNs();
+    uint64_t startTsc = readTsc();
+    usleep(20000);
+    uint64_t elapsedNs  = nowNs()   - startNs;
+    uint64_t elapsedTsc = readTsc() - startTsc;
+    return (double)elapsedNs / elapsedTsc;
+#else
+    // readTsc() is just nowNs()
+    return 1.0;
+#endif
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// nsPerTsc() - Returns the number of nanoseconds per readTsc() tick
+//=================================================================================================
+double nsPerTsc()
+{
+    static const double value = calibrate();
+    return value;
+}
+//=================================================================================================
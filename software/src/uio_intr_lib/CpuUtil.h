@@ -0,0 +1,79 @@
+//=================================================================================================
+// CpuUtil.h - Small inline helpers for busy-waiting, timekeeping and statistics counters
+//=================================================================================================
+#pragma once
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+
+//=================================================================================================
+// cpuRelax() - Tells the CPU that we're in a spin-wait loop.  On x86 this is the "pause"
+//              instruction, which saves power and frees execution resources for the sibling
+//              hyperthread.
+//=================================================================================================
+inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#else
+    asm volatile("" ::: "memory");
+#endif
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// nowNs() - Returns the value of the monotonic clock in nanoseconds
+//=================================================================================================
+inline uint64_t nowNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// readTsc() - Returns the CPU's free-running cycle counter.  This is much cheaper than nowNs(),
+//             but its units are CPU-specific: use tscToNs() to convert a difference between two
+//             readings to nanoseconds.
+//=================================================================================================
+inline uint64_t readTsc()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+    uint64_t value;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(value));
+    return value;
+#else
+    return nowNs();
+#endif
+}
+//=================================================================================================
+
+// Returns the number of nanoseconds per readTsc() tick (calibrated once, on first use)
+double nsPerTsc();
+
+//=================================================================================================
+// tscToNs() - Converts a number of readTsc() ticks to nanoseconds
+//=================================================================================================
+inline double tscToNs(uint64_t ticks)
+{
+    return ticks * nsPerTsc();
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// bump() - Adds to a statistics counter that only one thread ever writes.  This avoids the
+//          cost of a locked read-modify-write while still letting other threads read it
+//=================================================================================================
+inline void bump(std::atomic<uint64_t>& counter, uint64_t value = 1)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+//=================================================================================================
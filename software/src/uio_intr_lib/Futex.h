@@ -0,0 +1,46 @@
+//=================================================================================================
+// Futex.h - Thin wrappers around the Linux futex() system call
+//=================================================================================================
+#pragma once
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+#include <atomic>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+//=================================================================================================
+// futexWait() - Sleeps as long as "*word" still contains "expected", until woken by futexWake()
+//               or until "timeoutNs" nanoseconds have passed.  A timeout of 0 means "forever".
+//
+// Returns false on timeout.  Like any futex wait, this can return early for no reason; callers
+// must re-check their condition.
+//=================================================================================================
+inline bool futexWait(std::atomic<uint32_t>* word, uint32_t expected, uint64_t timeoutNs = 0)
+{
+    timespec  ts;
+    timespec* pts = nullptr;
+
+    if (timeoutNs)
+    {
+        ts.tv_sec  = timeoutNs / 1000000000ULL;
+        ts.tv_nsec = timeoutNs % 1000000000ULL;
+        pts = &ts;
+    }
+
+    long err = syscall(SYS_futex, (uint32_t*)word, FUTEX_WAIT_PRIVATE, expected, pts, nullptr, 0);
+    return !(err < 0 && errno == ETIMEDOUT);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// futexWake() - Wakes up to "count" threads sleeping in futexWait() on "word"
+//=================================================================================================
+inline void futexWake(std::atomic<uint32_t>* word, int count = INT_MAX)
+{
+    syscall(SYS_futex, (uint32_t*)word, FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+}
+//=================================================================================================
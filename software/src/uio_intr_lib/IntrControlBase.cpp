@@ -1,43 +1,204 @@
+#include <string.h>
+#include <math.h>
+#include <stdexcept>
+#include <exception>
+#include <map>
 #include "IntrControlBase.h"
+#include "CpuUtil.h"
 
-// These are the control and status registers of the interrupt controller
-enum
+
+//=============================================================================
+// Destructor - Stops the storm poller
+//=============================================================================
+IntrControlBase::~IntrControlBase()
 {
-    REG_IRQ_PENDING        =  0,
-    REG_IRQ_ACK            =  1,
-    REG_IRQ_MASK           =  2,
-    REG_GLOB_ENABLE        =  3,
-    REG_COUNTERS           = 32
-};
+    // The derived class has already been destroyed, so if the workers are
+    // still running, one of them may be inside its isr() right now.  There's
+    // no safe way on from there, so, like a std::thread that was never joined,
+    // we terminate.
+    if (workerPool_) std::terminate();
+
+    // Stop the storm poller
+    if (storm_)
+    {
+        storm_->stopping = true;
+        ++storm_->wake;
+        futexWake(&storm_->wake);
+        storm_->thread.join();
+    }
+}
+//=============================================================================
 
 
 uint32_t IntrControlBase::getIrqMask()
 {
-    return axiReg_[REG_IRQ_MASK];
+    return shadow_->mask;
 }
 
 void IntrControlBase::setIrqMask(uint32_t mask)
 {
-    axiReg_[REG_IRQ_MASK] = mask;
+    shadow_->mask = mask;
+    shadow_->dirty |= SHADOW_MASK;
+    flush();
 }
 
 
 bool IntrControlBase::getGlobalEnable()
 {
-    return axiReg_[REG_GLOB_ENABLE] & 1;
+    return shadow_->enable & 1;
 }
 
 
 void IntrControlBase::setGlobalEnable(bool flag)
 {
-    axiReg_[REG_GLOB_ENABLE] = flag;
+    shadow_->enable = flag;
+    shadow_->dirty |= SHADOW_ENABLE;
+    flush();
+}
+
+
+void IntrControlBase::maskIrqs(uint32_t irqs, bool flush)
+{
+    shadow_->mask &= ~irqs;
+    shadow_->dirty |= SHADOW_MASK;
+    if (flush) this->flush();
+}
+
+
+void IntrControlBase::unmaskIrqs(uint32_t irqs, bool flush)
+{
+    shadow_->mask |= irqs;
+    shadow_->dirty |= SHADOW_MASK;
+    if (flush) this->flush();
+}
+
+
+//=============================================================================
+// flush() - Writes the shadow registers that have changed to the controller
+//
+// Only one thread at a time does the writing.  Any other thread that has
+// changed a shadow leaves it to that thread, which keeps going until there's
+// nothing left to write.  That way, a burst of changes from several threads
+// costs one register write instead of one each.
+//=============================================================================
+void IntrControlBase::flush()
+{
+    while (!shadow_->offline && shadow_->dirty)
+    {
+        // If another thread is writing, it will see our changes before it stops
+        if (shadow_->writer.exchange(true)) return;
+
+        writeShadows();
+
+        // Let the next writer in, then go back for anything it left for us
+        shadow_->writer = false;
+    }
+}
+//=============================================================================
+
+
+//=============================================================================
+// writeShadows() - Writes whichever shadows have changed since they were last
+//                  written
+//=============================================================================
+void IntrControlBase::writeShadows()
+{
+    if (shadow_->offline) return;
+
+    uint32_t dirty = shadow_->dirty.exchange(0);
+    if (dirty & SHADOW_MASK  ) writeReg(REG_IRQ_MASK,    shadow_->mask & ~shadow_->stormMask);
+    if (dirty & SHADOW_ENABLE) writeReg(REG_GLOB_ENABLE, shadow_->enable);
+}
+//=============================================================================
+
+
+//=============================================================================
+// fence() - PCIe never lets a read overtake a posted write, so once a read
+//           of the controller comes back, all of our writes have arrived
+//
+// flush() returns straight away if another thread is writing, possibly before
+// that thread has picked up our changes.  So we wait our turn to write
+// instead: whoever held it before us issued everything they picked up before
+// they let go, and whatever they didn't pick up, we write ourselves.
+//=============================================================================
+void IntrControlBase::fence()
+{
+    while (shadow_->writer.exchange(true)) cpuRelax();
+
+    if (!shadow_->offline)
+    {
+        writeShadows();
+        readReg(REG_GLOB_ENABLE);
+    }
+
+    // Anyone who changed a shadow while we were writing left it to us
+    shadow_->writer = false;
+    flush();
+}
+//=============================================================================
+
+
+//=============================================================================
+// invalidateShadows() - Stops us touching a controller that has been reset.
+//                       Once this returns, no other thread is in the middle
+//                       of reading or writing it, so the monitor is free to
+//                       re-map it.
+//=============================================================================
+void IntrControlBase::invalidateShadows()
+{
+    while (shadow_->writer.exchange(true)) cpuRelax();
+    shadow_->offline = true;
+    shadow_->writer  = false;
+
+    // Wait for anyone who got in before the controller went offline
+    while (shadow_->users) cpuRelax();
+}
+//=============================================================================
+
+
+//=============================================================================
+// restoreConfig() - Puts back the configuration that a hot-reset wiped out
+//=============================================================================
+void IntrControlBase::restoreConfig()
+{
+    // Point the controller back at the status ring.  Any records that were
+    // written before the reset get serviced first.
+    if (statusRing_)
+    {
+        while (nextStatus()) drainStatusRing();
+        enableStatusRing(statusRing_, statusBusAddr_, statusMask_ + 1);
+    }
+
+    // Write every shadow register back to the controller
+    shadow_->offline = false;
+    shadow_->dirty  |= SHADOW_MASK | SHADOW_ENABLE;
+    flush();
 }
 
 
 
 void IntrControlBase::generateInterrupt(uint32_t irqs)
 {
-    axiReg_[REG_IRQ_PENDING] = irqs;
+    if (!enterRegisters()) return;
+    writeReg(REG_IRQ_PENDING, irqs);
+    leaveRegisters();
+}
+
+
+uint32_t IntrControlBase::getPendingIrqs()
+{
+    if (!enterRegisters()) return 0;
+    uint32_t pending = readReg(REG_IRQ_PENDING);
+    leaveRegisters();
+    return pending;
+}
+
+
+uint32_t IntrControlBase::getWaitingIrqs()
+{
+    if (statusRing_ == nullptr) return readReg(REG_IRQ_PENDING);
+    const intr_status_t* record = nextStatus();
+    return record ? record->pending : 0;
 }
 
 //=============================================================================
@@ -47,39 +208,873 @@ void IntrControlBase::generateInterrupt(uint32_t irqs)
 void IntrControlBase::initialize(uint8_t* userspacePtr, uint32_t baseAddress)
 {
     axiReg_ = (uint32_t*)(userspacePtr + baseAddress);
+    model_  = nullptr;
+    attachShadows(axiReg_);
+}
+//=============================================================================
+
+
+//=============================================================================
+// initialize() - Points us at a software model of the interrupt controller
+//                instead of the real thing
+//=============================================================================
+void IntrControlBase::initialize(RegisterModel* model)
+{
+    axiReg_ = nullptr;
+    model_  = model;
+    attachShadows(model_);
+}
+//=============================================================================
+
+
+//=============================================================================
+// attachShadows() - Finds the shadow registers of the controller at "key", or
+//                   creates them.  If we've been pointed at a controller that
+//                   has been reset (e.g. because a hot-reset moved its BARs),
+//                   it's our shadows that are right, and restoreConfig() will
+//                   write them back.
+//=============================================================================
+static std::mutex                                        shadowMutex;
+static std::map<const volatile void*, std::weak_ptr<void>> shadowRegistry;
+
+void IntrControlBase::attachShadows(const volatile void* key)
+{
+    std::lock_guard<std::mutex> lock(shadowMutex);
+
+    // Forget about controllers that nobody is using any more
+    for (auto it = shadowRegistry.begin(); it != shadowRegistry.end(); )
+    {
+        if (it->second.expired()) it = shadowRegistry.erase(it); else ++it;
+    }
+
+    auto existing = std::static_pointer_cast<shadow_t>(shadowRegistry[key].lock());
+
+    // If the controller has been reset, our shadows move to wherever it is now, unless
+    // another object that shares them has already moved them.  Other threads may be
+    // reading shadow_ right now, so we leave it alone if it's already the right one.
+    if (shadow_->offline)
+    {
+        if (existing) {if (existing != shadow_) shadow_ = existing; return;}
+        if (shadow_->key && shadowRegistry[shadow_->key].lock() == shadow_) shadowRegistry.erase(shadow_->key);
+        shadow_->key = key;
+        shadowRegistry[key] = shadow_;
+        return;
+    }
+
+    // If another object is already using this controller, share its shadows
+    if (existing) {shadow_ = existing; return;}
+
+    // Otherwise, read the registers into shadows of our own
+    shadow_ = std::make_shared<shadow_t>();
+    shadow_->key    = key;
+    shadow_->mask   = readReg(REG_IRQ_MASK);
+    shadow_->enable = readReg(REG_GLOB_ENABLE) & 1;
+    shadowRegistry[key] = shadow_;
 }
 //=============================================================================
 
+//=============================================================================
+// setCoalescing() - Sets the batch and time budget for a single call to
+//                   topLevelHandler()
+//=============================================================================
+void IntrControlBase::setCoalescing(uint32_t maxPasses, uint32_t maxTimeUs)
+{
+    maxPasses_ = (maxPasses == 0) ? 1 : maxPasses;
+    maxTimeNs_ = maxTimeUs * 1000ULL;
+}
+//=============================================================================
+
+
+//=============================================================================
+// getDispatchStats() - Returns statistics about the work topLevelHandler()
+//                      has done.   interrupts / wakeups is the average number
+//                      of interrupts serviced per wakeup.
+//=============================================================================
+IntrControlBase::dispatch_stats_t IntrControlBase::getDispatchStats()
+{
+    dispatch_stats_t stats;
+
+    stats.wakeups         = wakeups_;
+    stats.spurious        = spurious_;
+    stats.passes          = passes_;
+    stats.isrCalls        = isrCalls_;
+    stats.interrupts      = interrupts_;
+    stats.budgetExhausted = budgetExhausted_;
+
+    return stats;
+}
+//=============================================================================
+
+
+//=============================================================================
+// enableDeferredIsr() - Creates (or destroys) the pool of worker threads that
+//                       run our interrupt service routines
+//=============================================================================
+void IntrControlBase::enableDeferredIsr(int workerCount, uint32_t ringSize)
+{
+    // Get rid of any existing worker pool
+    stopDeferredIsr();
+
+    // If the caller doesn't want deferred ISRs, we're done
+    if (workerCount < 1) return;
+
+    // Each worker calls isr() with the contents of the events posted to it
+    workerPool_.reset(new IsrWorkerPool(workerCount, ringSize, [this](const irq_event_t& event)
+    {
+        // The worker's own trace ring shows when it ran the ISR
+        TraceRing::record(TRACE_ISR_ENTER, event.irq);
+
+        // If we're not tracking latency, just call the interrupt service routine
+        if (!latency_)
+            isr(event.pending, event.irq, event.count);
+
+        // Otherwise, keep track of how long it took.  Each IRQ is only ever
+        // serviced by one worker, so there is only one writer per histogram.
+        else
+        {
+            uint64_t start = readTsc();
+            isr(event.pending, event.irq, event.count);
+            latency_->isr[event.irq].record(readTsc() - start);
+        }
+
+        TraceRing::record(TRACE_ISR_EXIT, event.irq);
+    }));
+}
+//=============================================================================
+
+
+//=============================================================================
+// stopDeferredIsr() - Lets the workers finish everything that has been posted
+//                     to them, then joins them
+//=============================================================================
+void IntrControlBase::stopDeferredIsr()
+{
+    workerPool_.reset();
+}
+//=============================================================================
+
+
 //=============================================================================
 // topLevelHandler() - The userspace I/O interrupt monitor calls this any 
 //                     time it detects that the interrupt controller raised
 //                     the IRQ_REQ line.
+//
+// If coalescing is enabled, we keep re-reading the pending register and 
+// servicing interrupts until nothing is pending or the budget runs out, so
+// that a burst of interrupts costs a single wakeup (and a single re-enable
+// of PCI interrupts) instead of one per interrupt.
+//
+// Only the IRQs in "irqFilter" are serviced.  If we stopped because the
+// budget ran out rather than because nothing was left pending, the return
+// value is the (non-zero) bitmap of IRQs we serviced last, otherwise 0.
 //=============================================================================
-void IntrControlBase::topLevelHandler()
+uint32_t IntrControlBase::topLevelHandler(uint32_t irqFilter)
 {
-    int      i;
-    uint32_t counter[32];
+    uint32_t passes = 0;
+
+    // Keep track of how many times we've been called
+    bump(wakeups_);
+    TraceRing::record(TRACE_HANDLER_ENTER);
+
+    // If the controller is DMA'ing status records to us, we don't need to read its registers
+    if (statusRing_) return drainStatusRing();
 
     // Find out which interrupts are pending
-    uint32_t pending = axiReg_[REG_IRQ_PENDING];
+    uint32_t pending = readReg(REG_IRQ_PENDING) & irqFilter;
+    TraceRing::record(TRACE_PENDING, 0, pending);
+
+    // If we know when the monitor woke up, keep track of how long it took to get here
+    if (latency_ && wakeTsc_) latency_->wakeToPending.record(readTsc() - wakeTsc_);
 
     // If there are no interrupts pending then this was spurious, we're done
-    if (pending == 0) return;
+    if (pending == 0)
+    {
+        bump(spurious_);
+        TraceRing::record(TRACE_HANDLER_EXIT);
+        return 0;
+    }
+
+    // We only need to look at the clock if there is a time budget
+    uint64_t startNs = maxTimeNs_ ? nowNs() : 0;
+
+    while (true)
+    {
+        // Service every interrupt that is currently pending
+        servicePending(pending);
+
+        // If we've used up our pass budget, we're done
+        if (++passes >= maxPasses_) break;
+
+        // If we've used up our time budget, we're done
+        if (maxTimeNs_ && nowNs() - startNs >= maxTimeNs_) break;
+
+        // Find out if more interrupts arrived while we were busy
+        pending = readReg(REG_IRQ_PENDING) & irqFilter;
+        TraceRing::record(TRACE_PENDING, 0, pending);
+
+        // If nothing else is pending, we've drained the interrupt controller
+        if (pending == 0) break;
+    }
+
+    // Keep track of how many passes we made
+    bump(passes_, passes);
+
+    // If we stopped with interrupts still pending, make a note of it
+    if (pending && maxPasses_ > 1) bump(budgetExhausted_);
+    TraceRing::record(TRACE_HANDLER_EXIT, 0, passes);
+
+    // Let the caller know whether more might be waiting
+    return pending;
+}
+//=============================================================================
+
+
+//=============================================================================
+// servicePending() - Reads the counters of the IRQs in "pending" then calls 
+//                    the interrupt service routine for each of them
+//=============================================================================
+void IntrControlBase::servicePending(uint32_t pending)
+{
+    int      i;
+    uint32_t counter[32];
+
+    // If we're tracking latency, use the version of this routine that does so
+    if (latency_) return servicePendingTimed(pending);
 
     // Read the counter for every pending IRQ so we can allow IRQ_REQ to
     // de-assert as quickly as possible.  Reading a counter clears
     // the "pending" status in the interrupt controller
     for (i=0; i<32; ++i) if (pending & (1<<i))
     {
-        counter[i] = axiReg_[REG_COUNTERS + i];
+        counter[i] = readReg(REG_COUNTERS + i);
     }
 
     // Now call the interrupt service routines
+    serviceCounts(pending, counter);
+}
+//=============================================================================
+
+
+//=============================================================================
+// servicePendingTimed() - Identical to servicePending(), but records how long
+//                         each counter read takes
+//=============================================================================
+void IntrControlBase::servicePendingTimed(uint32_t pending)
+{
+    int      i;
+    uint32_t counter[32];
+    uint64_t t0, t1;
+
+    // Read the counter for every pending IRQ
+    t0 = readTsc();
     for (i=0; i<32; ++i) if (pending & (1<<i))
     {
-        isr(pending, i, counter[i]);
+        counter[i] = readReg(REG_COUNTERS + i);
+        t1 = readTsc();
+        latency_->counterRead[i].record(t1 - t0);
+        t0 = t1;
     }
 
+    // Now call the interrupt service routines
+    serviceCounts(pending, counter);
 }
 //=============================================================================
 
+
+//=============================================================================
+// serviceCounts() - Calls the interrupt service routine for each IRQ in 
+//                   "pending", or has the worker pool do it
+//=============================================================================
+void IntrControlBase::serviceCounts(uint32_t pending, const uint32_t* counter)
+{
+    uint64_t interrupts = 0;
+    uint64_t t0 = latency_ ? readTsc() : 0, t1;
+
+    for (int i=0; i<32; ++i) if (pending & (1<<i))
+    {
+        interrupts += counter[i];
+
+        if (workerPool_)
+            workerPool_->post({pending, (uint32_t)i, counter[i]});
+        else if (!latency_)
+        {
+            TraceRing::record(TRACE_ISR_ENTER, i);
+            isr(pending, i, counter[i]);
+            TraceRing::record(TRACE_ISR_EXIT, i);
+        }
+        else
+        {
+            TraceRing::record(TRACE_ISR_ENTER, i);
+            isr(pending, i, counter[i]);
+            TraceRing::record(TRACE_ISR_EXIT, i);
+            t1 = readTsc();
+            latency_->isr[i].record(t1 - t0);
+            t0 = t1;
+        }
+    }
+
+    // Keep track of how many interrupts we've serviced, and wake anyone waiting for them
+    recordDispatch(__builtin_popcount(pending), interrupts);
+    publishCounts(pending, counter);
+}
+//=============================================================================
+
+
+//=============================================================================
+// enableStatusRing() - Points the controller at a ring of status records in
+//                      host memory and turns on status writeback
+//=============================================================================
+void IntrControlBase::enableStatusRing(intr_status_t* ring, uint64_t busAddr, uint32_t slots)
+{
+    // The ring has to be a power of two in size
+    if (slots < 2 || (slots & (slots - 1)))
+    {
+        throw std::runtime_error("Status ring size must be a power of two");
+    }
+
+    // Make sure the controller isn't writing to any ring we were using before
+    disableStatusRing();
+
+    // An empty ring is one that doesn't contain the sequence numbers we expect
+    memset(ring, 0, slots * sizeof(intr_status_t));
+    statusRing_ = ring;
+    statusMask_ = slots - 1;
+    statusSeq_  = 1;
+    statusBusAddr_ = busAddr;
+
+    // Tell the controller where the ring is.  Writing the size turns writeback on.
+    writeReg(REG_STATUS_ADDR_LO,  (uint32_t)busAddr);
+    writeReg(REG_STATUS_ADDR_HI,  (uint32_t)(busAddr >> 32));
+    writeReg(REG_STATUS_CONSUMED, 0);
+    writeReg(REG_STATUS_SLOTS,    slots);
+
+    // A controller that doesn't do status writeback won't read the slot count back
+    if (readReg(REG_STATUS_SLOTS) != slots)
+    {
+        writeReg(REG_STATUS_SLOTS, 0);
+        statusRing_ = nullptr;
+        throw std::runtime_error("Interrupt controller doesn't support status writeback");
+    }
+}
+//=============================================================================
+
+
+//=============================================================================
+// disableStatusRing() - Turns off status writeback
+//=============================================================================
+void IntrControlBase::disableStatusRing()
+{
+    if (statusRing_ == nullptr) return;
+    writeReg(REG_STATUS_SLOTS, 0);
+    statusRing_ = nullptr;
+}
+//=============================================================================
+
+
+//=============================================================================
+// drainStatusRing() - Services the status records the controller has written
+//                     since we were last called
+//
+// The only register access here is the posted write that hands the slots we
+// consumed back to the controller.  There is only one ring, so the IRQ filter
+// of topLevelHandler() doesn't apply: every record is serviced.  Passes and the time budget are counted
+// in records, just as they're counted in reads of the pending register when
+// status writeback is off.
+//=============================================================================
+uint32_t IntrControlBase::drainStatusRing()
+{
+    uint32_t passes = 0;
+
+    // Fetch the first record the controller has written for us
+    const intr_status_t* record = nextStatus();
+
+    // If we know when the monitor woke up, keep track of how long it took to get here
+    if (latency_ && wakeTsc_) latency_->wakeToPending.record(readTsc() - wakeTsc_);
+
+    // If there's no new record, this wakeup was spurious
+    if (record == nullptr)
+    {
+        bump(spurious_);
+        TraceRing::record(TRACE_HANDLER_EXIT);
+        return 0;
+    }
+
+    // We only need to look at the clock if there is a time budget
+    uint64_t startNs = maxTimeNs_ ? nowNs() : 0;
+
+    while (true)
+    {
+        // Service every interrupt in this record
+        TraceRing::record(TRACE_PENDING, 0, record->pending);
+        serviceCounts(record->pending, record->count);
+        ++statusSeq_;
+
+        // If we've used up our pass budget or our time budget, we're done
+        if (++passes >= maxPasses_) break;
+        if (maxTimeNs_ && nowNs() - startNs >= maxTimeNs_) break;
+
+        // If there isn't another record waiting, we've drained the ring
+        if ((record = nextStatus()) == nullptr) break;
+    }
+
+    // Hand the slots back to the controller.  If there are records left in the
+    // ring, the controller keeps IRQ_REQ asserted and we'll be called again.
+    writeReg(REG_STATUS_CONSUMED, statusSeq_ - 1);
+
+    // Keep track of how many passes we made
+    bump(passes_, passes);
+
+    // If we stopped with records still waiting, make a note of it
+    record = nextStatus();
+    if (maxPasses_ > 1 && record) bump(budgetExhausted_);
+    TraceRing::record(TRACE_HANDLER_EXIT, 0, passes);
+    return record ? record->pending : 0;
+}
+//=============================================================================
+
+
+//=============================================================================
+// enableLatencyTracking() - Creates or destroys the latency histograms
+//
+// This must not be called while interrupts are being serviced
+//=============================================================================
+void IntrControlBase::enableLatencyTracking(bool enable)
+{
+    // Make sure the TSC calibration is done before it's needed
+    nsPerTsc();
+
+    wakeTsc_ = 0;
+    latency_.reset(enable ? new latency_t : nullptr);
+}
+//=============================================================================
+
+
+//=============================================================================
+// noteReenabled() - Records how long it took to re-enable interrupts, and how
+//                   long it's been since the monitor woke up
+//=============================================================================
+void IntrControlBase::noteReenabled(uint64_t startTsc, uint64_t endTsc)
+{
+    // If we're not tracking latency or don't know when we woke up, ignore this
+    if (!latency_ || wakeTsc_ == 0) return;
+
+    uint64_t now = endTsc ? endTsc : readTsc();
+    latency_->reenable.record(now - startTsc);
+    latency_->total.record(now - wakeTsc_);
+    wakeTsc_ = 0;
+}
+//=============================================================================
+
+
+//=============================================================================
+// getLatency() - Returns the latency summary for a stage of interrupt handling
+//=============================================================================
+latency_summary_t IntrControlBase::getLatency(latency_stage_t stage, int irq)
+{
+    // If we're not tracking latency, there's nothing to report
+    if (!latency_) return latency_summary_t();
+
+    irq &= 31;
+
+    switch (stage)
+    {
+        case STAGE_WAKE_TO_PENDING: return latency_->wakeToPending.summarize();
+        case STAGE_COUNTER_READ:    return latency_->counterRead[irq].summarize();
+        case STAGE_ISR:             return latency_->isr[irq].summarize();
+        case STAGE_REENABLE:        return latency_->reenable.summarize();
+        case STAGE_TOTAL:           return latency_->total.summarize();
+        default:                    return latency_summary_t();
+    }
+}
+//=============================================================================
+
+
+//=============================================================================
+// waitForIrq() - Sleeps until topLevelHandler() delivers more of an IRQ
+//
+// We only register as a waiter (which is what makes topLevelHandler() issue
+// a wake-up) if the count hasn't already moved on.
+//=============================================================================
+uint64_t IntrControlBase::waitForIrq(int irq, uint64_t lastSeen, uint64_t timeoutNs, uint64_t spinNs)
+{
+    irq_seq_t& state = irqSeq_[irq & 31];
+
+    // If the count has already changed, there's no need to sleep
+    uint64_t count = state.count.load(std::memory_order_acquire);
+    if (count != lastSeen) return count;
+
+    uint64_t start    = nowNs();
+    uint64_t deadline = timeoutNs ? start + timeoutNs : 0;
+
+    // If the caller would rather spin for a while first, do so
+    if (spinNs)
+    {
+        if (deadline && spinNs > timeoutNs) spinNs = timeoutNs;
+        while (nowNs() - start < spinNs)
+        {
+            count = state.count.load(std::memory_order_acquire);
+            if (count != lastSeen) return count;
+            cpuRelax();
+        }
+    }
+
+    // Tell topLevelHandler() that it has to wake us up
+    state.waiters.fetch_add(1);
+
+    while (true)
+    {
+        // Fetch the sequence number before the count, so that if the count changes after
+        // we've looked at it, futexWait() won't go to sleep
+        uint32_t seq = state.seq.load(std::memory_order_acquire);
+        count = state.count.load(std::memory_order_acquire);
+        if (count != lastSeen) break;
+
+        // Find out how long we're allowed to sleep
+        uint64_t remaining = 0;
+        if (deadline)
+        {
+            uint64_t now = nowNs();
+            if (now >= deadline) break;
+            remaining = deadline - now;
+        }
+
+        futexWait(&state.seq, seq, remaining);
+    }
+
+    state.waiters.fetch_sub(1);
+    return count;
+}
+//=============================================================================
+
+
+//=============================================================================
+// updateRates() - Folds the counts since the last update into each IRQ's
+//                 moving average.  Called from inside the seqlock.
+//
+// Each update weights the rate since the last one by 1 - e^(-dt/tau), so
+// the average behaves the same no matter how often it's updated.
+//=============================================================================
+void IntrControlBase::updateRates()
+{
+    uint64_t now = nowNs();
+    double   dt  = now - rateNs_.load(std::memory_order_relaxed);
+    if (dt <= 0) return;
+    double   weight = 1 - exp(-dt / rateTauNs_);
+
+    for (auto& state : irqSeq_)
+    {
+        uint64_t count = state.count.load(std::memory_order_relaxed);
+        double   rate  = (count - state.rateCount.load(std::memory_order_relaxed)) * 1e9 / dt;
+        double   ewma  = state.rate.load(std::memory_order_relaxed);
+        state.rate.store(ewma + weight * (rate - ewma), std::memory_order_relaxed);
+        state.rateCount.store(count, std::memory_order_relaxed);
+    }
+
+    rateNs_.store(now, std::memory_order_relaxed);
+    rateTsc_ = readTsc();
+}
+//=============================================================================
+
+
+//=============================================================================
+// getIrqSnapshot() - Copies the totals under the seqlock, then brings the
+//                    rates up to date
+//
+// The rates are only updated when interrupts are serviced, so a quiet IRQ's
+// rate would never decay.  We do here what updateRates() would have done if
+// it had been called just now, using the counts it hasn't seen yet.
+//=============================================================================
+IntrControlBase::irq_snapshot_t IntrControlBase::getIrqSnapshot()
+{
+    irq_snapshot_t snapshot;
+    uint64_t       rateCount[32], rateNs;
+    uint32_t       seq;
+
+    // Copy everything, and start over if topLevelHandler() changed it while we were copying
+    do
+    {
+        seq = statsSeq_.load(std::memory_order_acquire);
+        if (seq & 1) {cpuRelax(); continue;}
+
+        for (int i=0; i<32; ++i)
+        {
+            snapshot.total[i]       = irqSeq_[i].count.load(std::memory_order_relaxed);
+            snapshot.saturations[i] = irqSeq_[i].saturations.load(std::memory_order_relaxed);
+            snapshot.rate[i]        = irqSeq_[i].rate.load(std::memory_order_relaxed);
+            rateCount[i]            = irqSeq_[i].rateCount.load(std::memory_order_relaxed);
+        }
+        rateNs            = rateNs_.load(std::memory_order_relaxed);
+        snapshot.wakeups  = wakeups_;
+        snapshot.spurious = spurious_;
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+    }
+    while ((seq & 1) || statsSeq_.load(std::memory_order_relaxed) != seq);
+
+    // Bring the rates up to date
+    snapshot.timeNs = nowNs();
+    double dt = (double)snapshot.timeNs - rateNs;
+    if (dt > 0)
+    {
+        double weight = 1 - exp(-dt / rateTauNs_);
+        for (int i=0; i<32; ++i)
+        {
+            double rate = (snapshot.total[i] - rateCount[i]) * 1e9 / dt;
+            snapshot.rate[i] += weight * (rate - snapshot.rate[i]);
+        }
+    }
+
+    return snapshot;
+}
+//=============================================================================
+
+
+//=============================================================================
+// setStormLimit() - Sets the rate limits of one IRQ, starting the storm
+//                   poller the first time it's called
+//=============================================================================
+void IntrControlBase::setStormLimit(int irq, double maxRate, double releaseRate,
+                                    uint32_t pollUs, uint32_t holdMs)
+{
+    if (irq < 0 || irq > 31) throw std::runtime_error("setStormLimit(): invalid IRQ");
+
+    if (!storm_)
+    {
+        storm_.reset(new storm_t);
+        storm_->thread = std::thread(&IntrControlBase::pollStorms, this);
+    }
+
+    std::lock_guard<std::mutex> lock(storm_->mutex);
+    storm_irq_t& state = storm_->irq[irq];
+
+    state.maxRate     = maxRate;
+    state.releaseRate = (releaseRate > 0) ? releaseRate : maxRate / 2;
+    state.pollNs      = (pollUs ? pollUs : 1) * 1000ULL;
+    state.holdNs      = holdMs * 1000000ULL;
+    state.lastCount   = irqSeq_[irq].count;
+
+    // If storm control is being turned off for an IRQ that's being polled, let it go
+    if (maxRate <= 0 && state.stats.active) releaseStorm(irq, nowNs());
+}
+//=============================================================================
+
+
+//=============================================================================
+// getStormStats() - Returns what storm control has done with one IRQ
+//=============================================================================
+IntrControlBase::storm_stats_t IntrControlBase::getStormStats(int irq)
+{
+    if (!storm_) return storm_stats_t{};
+
+    std::lock_guard<std::mutex> lock(storm_->mutex);
+    storm_irq_t&  state = storm_->irq[irq & 31];
+    storm_stats_t stats = state.stats;
+
+    // Include the storm that's still going on
+    if (stats.active) stats.stormNs += nowNs() - state.sinceNs;
+
+    return stats;
+}
+//=============================================================================
+
+
+//=============================================================================
+// checkStorms() - Works out the rate of every IRQ since the last check, and
+//                 masks and polls those that are over their limit.  Called
+//                 from the storm poller, and does nothing unless it has been
+//                 STORM_CHECK_MS since the last check.
+//
+// The moving averages are too slow to catch a storm quickly, so this uses
+// the raw rate over the last interval.  It runs on the poller's schedule,
+// not when the IRQs are serviced, so a storm is caught just as quickly
+// whether the counts arrive in many calls to isr() or in a few big ones.
+//=============================================================================
+void IntrControlBase::checkStorms()
+{
+    uint32_t entered = 0;
+    uint64_t now     = nowNs();
+
+    std::lock_guard<std::mutex> lock(storm_->mutex);
+
+    // The first time through, there's nothing to compare the counts against
+    bool   first = storm_->lastCheckNs == 0;
+    if (!first && now - storm_->lastCheckNs < STORM_CHECK_MS * 1000000ULL) return;
+    double dt    = now - storm_->lastCheckNs;
+    storm_->lastCheckNs = now;
+
+    for (int irq=0; irq<32; ++irq)
+    {
+        storm_irq_t& state = storm_->irq[irq];
+        uint64_t     count = irqSeq_[irq].count.load(std::memory_order_relaxed);
+        double       rate  = (count - state.lastCount) * 1e9 / dt;
+        state.lastCount    = count;
+
+        if (first || state.maxRate <= 0 || state.stats.active || rate <= state.maxRate) continue;
+
+        // This IRQ is storming.  Mask it, and let the poller re-arm it in a while.
+        state.stats.active = true;
+        state.stats.lastTransitionNs = now;
+        state.stats.triggerRate = state.stats.sourceRate = rate;
+        ++state.stats.storms;
+        state.sinceNs = state.windowNs = now;
+        state.nextPollNs = now + state.pollNs;
+        state.armNs = state.armedNs = state.armedCount = 0;
+        entered |= (1u << irq);
+    }
+
+    if (entered == 0) return;
+
+    stormIrqs_ |= entered;
+    shadow_->stormMask |= entered;
+    shadow_->dirty |= SHADOW_MASK;
+    flush();
+}
+//=============================================================================
+
+
+//=============================================================================
+// servicePolled() - Masks polled IRQs again once they've delivered, and
+//                   keeps track of how fast they counted while they were
+//                   armed
+//=============================================================================
+void IntrControlBase::servicePolled(uint32_t polled, const uint32_t* counter)
+{
+    uint32_t remask = 0;
+    uint64_t now    = nowNs();
+
+    std::lock_guard<std::mutex> lock(storm_->mutex);
+
+    for (uint32_t bits = polled; bits; bits &= bits - 1)
+    {
+        int          irq   = __builtin_ctz(bits);
+        storm_irq_t& state = storm_->irq[irq];
+        if (!state.stats.active) continue;
+
+        state.stats.polledInterrupts += counter[irq];
+
+        // Counts that arrived while it was armed tell us how fast the source is going
+        if (state.armNs)
+        {
+            state.armedNs    += now - state.armNs;
+            state.armedCount += counter[irq];
+            state.armNs       = 0;
+            remask |= (1u << irq);
+        }
+    }
+
+    if (remask == 0) return;
+
+    shadow_->stormMask |= remask;
+    shadow_->dirty |= SHADOW_MASK;
+    flush();
+}
+//=============================================================================
+
+
+//=============================================================================
+// pollStorms() - The storm poller's thread.  Every STORM_CHECK_MS, it looks
+//                for IRQs that have started storming.  Every IRQ that's
+//                being polled is unmasked once per poll period, so that it
+//                can deliver once.  At the end of every hold window, if the
+//                source's rate while it was armed has fallen below the
+//                release rate, the IRQ is unmasked for good.
+//
+// A masked IRQ doesn't count at all, so the only way to see what a source is
+// doing is to leave it unmasked for a while and see how quickly it fires.
+//=============================================================================
+void IntrControlBase::pollStorms()
+{
+    while (!storm_->stopping)
+    {
+        uint32_t wake = storm_->wake;
+        uint64_t next = 0, now;
+        uint32_t arm  = 0;
+
+        // Look for IRQs that have started storming
+        checkStorms();
+
+        {
+            std::lock_guard<std::mutex> lock(storm_->mutex);
+            now  = nowNs();
+            next = storm_->lastCheckNs + STORM_CHECK_MS * 1000000ULL;
+
+            for (uint32_t bits = stormIrqs_; bits; bits &= bits - 1)
+            {
+                int          irq   = __builtin_ctz(bits);
+                storm_irq_t& state = storm_->irq[irq];
+
+                // Account for the time it has spent armed so far
+                if (state.armNs)
+                {
+                    state.armedNs += now - state.armNs;
+                    state.armNs    = now;
+                }
+
+                // If it's time to poll it and it isn't still armed from last time, arm it
+                if (now >= state.nextPollNs)
+                {
+                    if (state.armNs == 0)
+                    {
+                        state.armNs = now;
+                        arm |= (1u << irq);
+                        ++state.stats.polls;
+                    }
+                    state.nextPollNs += state.pollNs;
+                    if (state.nextPollNs <= now) state.nextPollNs = now + state.pollNs;
+                }
+
+                // At the end of each hold window, decide whether the storm is over
+                if (now - state.windowNs >= state.holdNs)
+                {
+                    state.stats.sourceRate = state.armedNs ? state.armedCount * 1e9 / state.armedNs : 0;
+                    if (state.stats.sourceRate < state.releaseRate)
+                    {
+                        arm &= ~(1u << irq);
+                        releaseStorm(irq, now);
+                        continue;
+                    }
+                    state.windowNs   = now;
+                    state.armedNs    = 0;
+                    state.armedCount = 0;
+                }
+
+                if (state.nextPollNs < next) next = state.nextPollNs;
+            }
+
+            if (arm)
+            {
+                shadow_->stormMask &= ~arm;
+                shadow_->dirty |= SHADOW_MASK;
+                flush();
+            }
+        }
+
+        // Sleep until the next IRQ is due to be polled, or it's time to look for storms again
+        futexWait(&storm_->wake, wake, next > now ? next - now : 1);
+    }
+}
+//=============================================================================
+
+
+//=============================================================================
+// releaseStorm() - Takes an IRQ out of polled mode and unmasks it
+//=============================================================================
+void IntrControlBase::releaseStorm(int irq, uint64_t now)
+{
+    storm_irq_t& state = storm_->irq[irq];
+
+    state.stats.active = false;
+    state.stats.stormNs += now - state.sinceNs;
+    state.stats.lastTransitionNs = now;
+    ++state.stats.releases;
+    state.armNs = 0;
+
+    // Don't let checkStorms() count what arrived during the storm against it
+    state.lastCount = irqSeq_[irq].count.load(std::memory_order_relaxed);
+
+    stormIrqs_ &= ~(1u << irq);
+    shadow_->stormMask &= ~(1u << irq);
+    shadow_->dirty |= SHADOW_MASK;
+    flush();
+}
+//=============================================================================
@@ -1,4 +1,3 @@
-
 //==========================================================================================================
 // IntrControlBase.h - Defines a class that manages an interrrupt controller
 //
@@ -7,38 +6,566 @@
 #pragma once
 #include <stdint.h>
 #include <string>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "IsrWorkerPool.h"
+#include "LatencyHistogram.h"
+#include "RegisterModel.h"
+#include "StatusRing.h"
+#include "CpuUtil.h"
+#include "Futex.h"
+#include "TraceRing.h"
 
 class IntrControlBase
 {
 
 protected:
 
+    // These are the control and status registers of the interrupt controller
+    enum
+    {
+        REG_IRQ_PENDING        =  0,
+        REG_IRQ_ACK            =  1,
+        REG_IRQ_MASK           =  2,
+        REG_GLOB_ENABLE        =  3,
+
+        // These control status writeback (see StatusRing.h).  Writing a slot count of 0
+        // turns writeback off.
+        REG_STATUS_ADDR_LO     =  4,
+        REG_STATUS_ADDR_HI     =  5,
+        REG_STATUS_SLOTS       =  6,
+        REG_STATUS_CONSUMED    =  7,
+
+        REG_COUNTERS           = 32
+    };
+
+    // The hardware counters stop counting when they reach this value
+    enum : uint32_t {COUNTER_SATURATED = 0xFFFFFFFE};
+
     // This gets called any time an interrupt occurs
     virtual void isr(uint32_t pending, int IRQ, uint32_t count) = 0;
 
+    // Reads the counters of the pending IRQs and calls the interrupt service routines.
+    // Derived classes can override this to provide a faster dispatcher.
+    virtual void servicePending(uint32_t pending);
+
+    // Calls the interrupt service routines for the IRQs in "pending", whose counters have
+    // already been read into counter[irq].  Derived classes that override servicePending()
+    // should override this too.
+    virtual void serviceCounts(uint32_t pending, const uint32_t* counter);
+
+    // Reads (and thereby clears) the interrupt counter of the specified IRQ
+    uint32_t    readCounter(int irq) {return readReg(REG_COUNTERS + irq);}
+
+    // Clears the counters of the specified IRQs with a posted write
+    void        acknowledgeIrqs(uint32_t irqs) {writeReg(REG_IRQ_ACK, irqs);}
+
+    // Adds to the "isrCalls" and "interrupts" statistics
+    void        recordDispatch(uint64_t isrCalls, uint64_t interrupts)
+    {
+        bump(isrCalls_, isrCalls);
+        bump(interrupts_, interrupts);
+    }
+
+    // Adds the counts of the IRQs in "pending" to their accumulated counts, and wakes any
+    // thread that's sleeping in waitForIrq() on one of them.  Derived classes that override
+    // serviceCounts() should call this once they've dispatched the IRQs.
+    void        publishCounts(uint32_t pending, const uint32_t* counter)
+    {
+        // Readers of the totals retry if they see an odd sequence number, or if it changes
+        uint32_t statsSeq = statsSeq_.load(std::memory_order_relaxed);
+        statsSeq_.store(statsSeq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        for (uint32_t bits = pending; bits; bits &= bits - 1)
+        {
+            int        irq   = __builtin_ctz(bits);
+            irq_seq_t& state = irqSeq_[irq];
+            TraceRing::recordAtLast(TRACE_COUNT, irq, counter[irq]);
+            state.count.store(state.count.load(std::memory_order_relaxed) + counter[irq], std::memory_order_relaxed);
+            state.seq.store(state.seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+
+            // A hardware counter that has saturated has stopped counting
+            if (counter[irq] >= COUNTER_SATURATED) bump(state.saturations);
+        }
+
+        // Every so often, fold the totals into the rates.  Even reading the clock costs
+        // more than the rest of this, so we only look at it every RATE_POLL passes.
+        if ((++ratePolls_ & (RATE_POLL - 1)) == 0 && readTsc() - rateTsc_ >= rateIntervalTsc_) updateRates();
+
+        statsSeq_.store(statsSeq + 2, std::memory_order_release);
+
+        // A waiter registers itself and then reads "seq", while we've written "seq" and are
+        // about to look for waiters.  Without a full fence between the two, we could both miss
+        // each other.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        for (uint32_t bits = pending; bits; bits &= bits - 1)
+        {
+            irq_seq_t& state = irqSeq_[__builtin_ctz(bits)];
+            if (state.waiters.load(std::memory_order_relaxed)) futexWake(&state.seq);
+        }
+
+        // IRQs that storm control is polling are masked again as soon as they've been serviced
+        uint32_t polled = pending & stormIrqs_.load(std::memory_order_relaxed);
+        if (polled) servicePolled(polled, counter);
+    }
+
 public:
 
+    // Destructor
+    virtual ~IntrControlBase();
+
+    // Statistics that describe how much work each call to topLevelHandler() did
+    struct dispatch_stats_t
+    {
+        // How many times topLevelHandler() was called
+        uint64_t    wakeups;
+
+        // How many of those calls found no interrupts pending
+        uint64_t    spurious;
+
+        // How many times the pending register was found non-zero and serviced
+        uint64_t    passes;
+
+        // How many calls to isr() were made (or handed to the worker pool)
+        uint64_t    isrCalls;
+
+        // The sum of the "count" values handed to isr()
+        uint64_t    interrupts;
+
+        // How many times we stopped draining because the batch or time budget ran out
+        uint64_t    budgetExhausted;
+
+        // Adds the statistics of another controller to these, e.g. to total up several cards
+        dispatch_stats_t& operator+=(const dispatch_stats_t& rhs)
+        {
+            wakeups         += rhs.wakeups;
+            spurious        += rhs.spurious;
+            passes          += rhs.passes;
+            isrCalls        += rhs.isrCalls;
+            interrupts      += rhs.interrupts;
+            budgetExhausted += rhs.budgetExhausted;
+            return *this;
+        }
+    };
+
+    // The lifetime totals and recent rates of every IRQ
+    struct irq_snapshot_t
+    {
+        // When the snapshot was taken, in nowNs() time
+        uint64_t    timeNs;
+
+        // How many times topLevelHandler() was called, and how many of those calls found no
+        // interrupts pending
+        uint64_t    wakeups;
+        uint64_t    spurious;
+
+        // For each IRQ, the sum of every count delivered for it, and how many of those counts
+        // came from a saturated hardware counter (meaning interrupts were lost)
+        uint64_t    total[32];
+        uint64_t    saturations[32];
+
+        // For each IRQ, an exponentially weighted moving average of its rate, in interrupts
+        // per second
+        double      rate[32];
+    };
+
+    // What storm control has done with one IRQ
+    struct storm_stats_t
+    {
+        // True while the IRQ is masked and being polled
+        bool        active;
+
+        // How many times the IRQ has gone into polled mode, and how many times it has come out
+        uint64_t    storms;
+        uint64_t    releases;
+
+        // How many times it has been re-armed while polled, and the sum of the counts that
+        // were delivered for it while it was polled
+        uint64_t    polls;
+        uint64_t    polledInterrupts;
+
+        // The total time it has spent in polled mode, and when it last went in or out (in
+        // nowNs() time)
+        uint64_t    stormNs;
+        uint64_t    lastTransitionNs;
+
+        // The rate that put it into polled mode the last time, and the rate of the source
+        // as measured while it was polled, in interrupts per second
+        double      triggerRate;
+        double      sourceRate;
+    };
+
+    // These are the stages of interrupt handling whose durations we can track
+    enum latency_stage_t
+    {
+        // From the monitor waking up to the pending register having been read
+        STAGE_WAKE_TO_PENDING = 0,
+
+        // Reading the counter of a single IRQ (tracked per IRQ)
+        STAGE_COUNTER_READ    = 1,
+
+        // A single call to isr() (tracked per IRQ)
+        STAGE_ISR             = 2,
+
+        // Re-enabling interrupts in PCI config-space
+        STAGE_REENABLE        = 3,
+
+        // From the monitor waking up to interrupts having been re-enabled
+        STAGE_TOTAL           = 4,
+
+        STAGE_COUNT           = 5
+    };
+
     // We need the userspace pointer to the PCI device and the AXI base address 
-    // of the interrupt controller
+    // of the interrupt controller.  Every object initialized with the same registers shares
+    // one set of shadow registers (see below), so that, e.g, the handlers of several MSI
+    // vectors can each change the mask without undoing each other's changes.
     void        initialize(uint8_t* userspacePtr, uint32_t baseAddress);
 
+    // Or we can be pointed at a software model of the interrupt controller
+    void        initialize(RegisterModel* model);
+
     // Causes an interrupt on one or more IRQs
     void        generateInterrupt(uint32_t irqs);
 
+    // Returns the bitmap of IRQs that are currently pending, or 0 while the controller is
+    // offline after a hot-reset
+    uint32_t    getPendingIrqs();
+
+    // A device that has gone away (in a hot-reset, say) reads as all-ones.  The global
+    // enable register only ever reads 0 or 1, so this tells a lost device apart from a
+    // controller with all 32 IRQs pending.  Only the monitor thread calls this.
+    bool        isControllerPresent() {return readReg(REG_GLOB_ENABLE) != 0xFFFFFFFF;}
+
+    // Returns the bitmap of IRQs that topLevelHandler() would service right now.  With status
+    // writeback on, the controller clears its counters as it takes each snapshot, so the
+    // pending register reads 0 and it's the next status record that says what's waiting.
+    uint32_t    getWaitingIrqs();
+
     // Set and get the global-interrupt-disable bit
     bool        getGlobalEnable();
     void        setGlobalEnable(bool enable);
 
-    // Get and set the per-IRQ interrupt mask
+    // Get and set the per-IRQ interrupt mask (a 1 bit enables that IRQ)
     uint32_t    getIrqMask();
     void        setIrqMask(uint32_t mask);
 
+    // Disable or enable the IRQs in "irqs", leaving the others alone.  These are safe to call
+    // from any number of threads at once: concurrent changes are merged into a single write
+    // of the mask register.  If "flush" is false, only the shadow of the mask changes, and
+    // the controller sees it on the next call to flush().
+    void        maskIrqs(uint32_t irqs, bool flush = true);
+    void        unmaskIrqs(uint32_t irqs, bool flush = true);
+
+    // Writes any shadow registers that have changed since they were last written.  Those
+    // writes are posted.  If another thread is already writing the shadows, this leaves our
+    // changes to it and returns straight away, so they may not even be on their way yet.
+    void        flush();
+
+    // Flushes the shadow registers, then waits until the controller has received every
+    // change made to them before the call, whichever thread ends up writing it
+    void        fence();
+
+    // Tells us that the controller has been reset, so its registers no longer hold what the
+    // shadows say.  Until restoreConfig() is called, changes are only made to the shadows and
+    // generateInterrupt() does nothing.  Once this returns, no other thread is touching the
+    // registers, so the monitor thread can re-map them with initialize().
+    void        invalidateShadows();
+
+    // Re-writes the mask and global-enable settings that were last set through any object
+    // using this controller, and the status writeback settings of this object.  After a
+    // hot-reset, the controller comes back with all of them cleared; this puts it back the
+    // way it was.
+    void        restoreConfig();
+
+    // Allows topLevelHandler() to keep re-reading the pending register and servicing
+    // interrupts for up to "maxPasses" passes or "maxTimeUs" microseconds (0 = no time
+    // limit) before returning.  The default of 1 pass means "don't coalesce".
+    void        setCoalescing(uint32_t maxPasses, uint32_t maxTimeUs = 0);
+
+    // Returns statistics about the work done by topLevelHandler()
+    dispatch_stats_t getDispatchStats();
+
+    // Makes topLevelHandler() hand the interrupts it finds to a pool of "workerCount" threads
+    // that call isr(), instead of calling isr() itself.  Calls to isr() for any one IRQ remain
+    // in order, but calls for different IRQs may run concurrently.  A workerCount of 0 goes
+    // back to calling isr() from topLevelHandler().  Call this before enabling interrupts.
+    void        enableDeferredIsr(int workerCount, uint32_t ringSize = 1024);
+
+    // Stops the worker pool once it has serviced every event posted to it.  The workers call
+    // the derived class's isr(), so a derived class that may run with deferred ISRs must call
+    // this from its destructor; our destructor terminates the program if the pool is still
+    // running.  Nothing else may be calling topLevelHandler() at the time.
+    void        stopDeferredIsr();
+
+    // Makes the controller DMA a status record into "ring" every time it would interrupt us,
+    // so that topLevelHandler() never has to read its registers.  "busAddr" is the address
+    // the controller uses to reach the ring, and "slots" must be a power of two.  The ring
+    // must stay in place until disableStatusRing() is called.
+    //
+    // pcie_intr_controller.v doesn't implement status writeback (it has no registers 4-7),
+    // so for now this only works against IntrControllerModel.  The slot count is read back
+    // to make sure the controller took it, and if it didn't, this throws: otherwise no record
+    // would ever arrive, nothing would clear the counters, and IRQ_REQ would stay asserted.
+    void        enableStatusRing(intr_status_t* ring, uint64_t busAddr, uint32_t slots);
+
+    // Turns status writeback back off
+    void        disableStatusRing();
+
+    // Returns the total of the counts that have been delivered for IRQ "irq"
+    uint64_t    getIrqCount(int irq) {return irqSeq_[irq & 31].count.load(std::memory_order_acquire);}
+
+    // Sleeps until the total count of IRQ "irq" is no longer "lastSeen", or until "timeoutNs"
+    // nanoseconds have passed (0 = forever), and returns the total count.  Call it in a loop,
+    // handing it what it returned the last time.  Safe to call from any number of threads.
+    // Spinning for up to "spinNs" nanoseconds before going to sleep trades CPU time for a
+    // faster hand-off when interrupts arrive close together.
+    uint64_t    waitForIrq(int irq, uint64_t lastSeen, uint64_t timeoutNs = 0, uint64_t spinNs = 0);
+
+    // Returns a consistent picture of the totals and rates of every IRQ.  Safe to call from any
+    // thread, and never makes topLevelHandler() wait.
+    irq_snapshot_t getIrqSnapshot();
+
+    // Sets the time constant of the rates in irq_snapshot_t (default 1000 ms)
+    void        setRateTimeConstant(uint32_t ms) {rateTauNs_ = (ms ? ms : 1) * 1000000.0;}
+    uint32_t    getRateTimeConstant() {return (uint32_t)(rateTauNs_ / 1000000.0);}
+
+    // Turns on storm control for IRQ "irq".  If it interrupts faster than "maxRate" times a
+    // second, it's masked and then re-armed for a single delivery every "pollUs" microseconds,
+    // so that it can't keep the thread that calls topLevelHandler() from servicing the other
+    // IRQs.  Once its rate has stayed below "releaseRate" (default maxRate / 2) for "holdMs"
+    // milliseconds, it's unmasked again.  A maxRate of 0 turns storm control off for that IRQ.
+    // Storm control masks IRQs on top of setIrqMask(): getIrqMask() doesn't show them.  Call
+    // this before enabling interrupts.
+    void        setStormLimit(int irq, double maxRate, double releaseRate = 0,
+                              uint32_t pollUs = 1000, uint32_t holdMs = 1000);
+
+    // Returns what storm control has done with IRQ "irq", and the bitmap of IRQs that are
+    // currently being polled
+    storm_stats_t getStormStats(int irq);
+    uint32_t    getStormIrqs() {return stormIrqs_;}
+
+    // Returns the worker pool that is running deferred ISRs (or nullptr)
+    IsrWorkerPool* workerPool() {return workerPool_.get();}
+
+    // Turns on (or off) tracking of how long each stage of interrupt handling takes
+    void        enableLatencyTracking(bool enable);
+
+    // Returns the latency summary for a stage.  STAGE_COUNTER_READ and STAGE_ISR are
+    // tracked per IRQ, the others ignore "irq".  Safe to call from any thread.
+    latency_summary_t getLatency(latency_stage_t stage, int irq = 0);
+
+    // The interrupt monitor calls this when it wakes up to service interrupts
+    inline void noteWakeup() {if (latency_) wakeTsc_ = readTsc();}
+
+    // The interrupt monitor calls this after it has re-enabled interrupts.  "startTsc" is
+    // the readTsc() value from just before it started re-enabling them, and "endTsc" the
+    // one from when they were re-enabled, if that wasn't just now.
+    void        noteReenabled(uint64_t startTsc, uint64_t endTsc = 0);
+
+    // Returns true if latency tracking is turned on
+    bool        isTrackingLatency() {return latency_ != nullptr;}
+
     // This is the top-level interrupt handler
-    void        topLevelHandler();
+    void        topLevelHandler() {topLevelHandler(0xFFFFFFFF);}
+
+    // A top-level interrupt handler that only services the IRQs in "irqFilter".  This is for
+    // interrupt backends that deliver different groups of IRQs on different vectors.  Returns
+    // non-zero if it stopped because the coalescing budget ran out (so more interrupts may be
+    // waiting) and 0 if it found nothing left pending.
+    uint32_t    topLevelHandler(uint32_t irqFilter);
 
 
 private:
 
-    volatile uint32_t* axiReg_;
-};
+    // servicePending() for when we're tracking latency
+    void        servicePendingTimed(uint32_t pending);
+
+    // topLevelHandler() for when status records are being DMA'd to us
+    uint32_t    drainStatusRing();
+
+    // Returns the next status record if the controller has written it, otherwise nullptr
+    inline const intr_status_t* nextStatus()
+    {
+        const intr_status_t* record = &statusRing_[(statusSeq_ - 1) & statusMask_];
+        return __atomic_load_n(&record->seq, __ATOMIC_ACQUIRE) == statusSeq_ ? record : nullptr;
+    }
+
+    // Writes the shadow registers that have changed.  Only the thread that holds
+    // shadow_->writer calls this.
+    void        writeShadows();
+
+    // Shares the shadow registers of every other object that's using the registers at "key",
+    // or if there are none, reads the mask and global-enable registers into new shadows
+    void        attachShadows(const volatile void* key);
+
+    // Bracket a register access made from a thread other than the monitor's.  If the
+    // controller is offline, enterRegisters() returns false and the registers mustn't be
+    // touched.  invalidateShadows() waits for every thread that got in to leave.
+    inline bool enterRegisters()
+    {
+        shadow_->users.fetch_add(1);
+        if (!shadow_->offline) return true;
+        shadow_->users.fetch_sub(1);
+        return false;
+    }
+    inline void leaveRegisters() {shadow_->users.fetch_sub(1);}
+
+    // Reads or writes one of the interrupt controller's registers
+    inline uint32_t readReg(int index)
+    {
+        return model_ ? model_->readReg(index) : axiReg_[index];
+    }
+    inline void writeReg(int index, uint32_t value)
+    {
+        if (model_) model_->writeReg(index, value); else axiReg_[index] = value;
+    }
+
+    // The memory-mapped registers of the interrupt controller...
+    volatile uint32_t* axiReg_ = nullptr;
+
+    // ...or a software model of them
+    RegisterModel*     model_  = nullptr;
 
+    // When status writeback is on, this is the ring, the slot-index mask, and the sequence
+    // number of the next record we expect
+    intr_status_t*     statusRing_ = nullptr;
+    uint32_t           statusMask_ = 0;
+    uint32_t           statusSeq_  = 1;
+    uint64_t           statusBusAddr_ = 0;
+
+    // The host is the only one that ever writes the mask and global-enable registers, so we
+    // keep a shadow of each and never have to read them.  The shadows belong to the controller,
+    // not to us: every object that uses the same registers shares them.  "dirty" says which
+    // shadows have changed since they were written to the controller, "writer" is held by the
+    // one thread that's writing them, and "offline" means the controller has been reset and
+    // mustn't be written until restoreConfig() is called.  "stormMask" is the bitmap of IRQs
+    // that storm control has masked, which the controller's mask register leaves out.
+    enum {SHADOW_MASK = 1, SHADOW_ENABLE = 2};
+    struct shadow_t
+    {
+        std::atomic<uint32_t> mask{0}, enable{0}, dirty{0}, stormMask{0};
+        std::atomic<bool>     writer{false}, offline{false};
+
+        // How many threads are in the middle of an enterRegisters()/leaveRegisters() access
+        std::atomic<uint32_t> users{0};
+
+        // The registers these are the shadows of
+        const volatile void*  key = nullptr;
+    };
+    std::shared_ptr<shadow_t> shadow_ = std::make_shared<shadow_t>();
+
+    // The total count and sequence number of each IRQ, which topLevelHandler() updates and
+    // waitForIrq() sleeps on, and how many threads are sleeping on it.  Each IRQ has a
+    // cache-line of its own, so that a waiter on one IRQ doesn't slow down the others.
+    struct alignas(64) irq_seq_t
+    {
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint32_t> seq{0};
+        std::atomic<uint32_t> waiters{0};
+
+        // How many times this IRQ's counter was found saturated
+        std::atomic<uint64_t> saturations{0};
+
+        // The rate as of the last call to updateRates(), and the count it was computed from
+        std::atomic<double>   rate{0};
+        std::atomic<uint64_t> rateCount{0};
+    };
+    irq_seq_t   irqSeq_[32];
+
+    // The seqlock that lets getIrqSnapshot() read the totals and rates consistently
+    std::atomic<uint32_t> statsSeq_{0};
+
+    // Folds the totals into the rates
+    void        updateRates();
+
+    // The rates are updated every "rateIntervalTsc_" TSC ticks (checked every RATE_POLL
+    // passes), with a time constant of "rateTauNs_".  "rateNs_" is when they were last updated.
+    // The interval is worked out when we're constructed, because the first call to nsPerTsc()
+    // can sleep while it calibrates, and that mustn't happen in topLevelHandler().
+    enum {RATE_INTERVAL_MS = 100, RATE_POLL = 64};
+    uint32_t              ratePolls_ = 0;
+    uint64_t              rateTsc_ = 0;
+    uint64_t              rateIntervalTsc_ = RATE_INTERVAL_MS * 1000000ull / nsPerTsc();
+    std::atomic<uint64_t> rateNs_{nowNs()};
+    double                rateTauNs_ = 1e9;
+
+    // Storm control's per-IRQ state and the thread that polls storming IRQs.  "stormIrqs_" is
+    // the bitmap of our IRQs that are being polled, and those that are masked right now are
+    // in shadow_->stormMask.  The controller's mask register is mask & ~stormMask.
+    struct storm_irq_t
+    {
+        // The limits, as given to setStormLimit()
+        double      maxRate = 0, releaseRate = 0;
+        uint64_t    pollNs = 0, holdNs = 0;
+
+        // The IRQ's total count the last time checkStorms() looked at it
+        uint64_t    lastCount = 0;
+
+        // While the IRQ is polled: when it went into polled mode, when it's next due to be
+        // re-armed, and when it was armed (0 if it's masked)
+        uint64_t    sinceNs = 0, nextPollNs = 0, armNs = 0;
+
+        // How long it has spent armed in the current hold window, the counts delivered while
+        // it was armed, and when the window started
+        uint64_t    armedNs = 0, armedCount = 0, windowNs = 0;
+
+        storm_stats_t stats = {};
+    };
+    struct storm_t
+    {
+        // Everything in here is protected by "mutex"
+        storm_irq_t irq[32];
+        std::mutex  mutex;
+
+        // When checkStorms() last looked at the counts.  The poller has it look every
+        // STORM_CHECK_MS, whether or not interrupts are being serviced.
+        uint64_t    lastCheckNs = 0;
+
+        // The poller sleeps on "wake", and stops when "stopping" is set
+        std::thread thread;
+        std::atomic<uint32_t> wake{0};
+        std::atomic<bool>     stopping{false};
+    };
+    std::unique_ptr<storm_t> storm_;
+    std::atomic<uint32_t> stormIrqs_{0};
+    enum {STORM_CHECK_MS = 10};
+
+    // Looks for IRQs whose rate has gone over their limit, and puts them into polled mode
+    void        checkStorms();
+
+    // Masks the polled IRQs in "polled" again, now that they've been serviced
+    void        servicePolled(uint32_t polled, const uint32_t* counter);
+
+    // The thread that re-arms polled IRQs, and decides when they're quiet enough to release
+    void        pollStorms();
+
+    // Takes IRQ "irq" out of polled mode and unmasks it.  Called with storm_->mutex held.
+    void        releaseStorm(int irq, uint64_t now);
+
+    // If this exists, it runs our interrupt service routines
+    std::unique_ptr<IsrWorkerPool> workerPool_;
+
+    // When latency tracking is on, these hold the histograms for each stage
+    struct latency_t
+    {
+        LatencyHistogram wakeToPending, reenable, total;
+        LatencyHistogram counterRead[32], isr[32];
+    };
+    std::unique_ptr<latency_t> latency_;
+
+    // The readTsc() value from when the monitor last woke up
+    uint64_t    wakeTsc_ = 0;
+
+    // The batch and time budgets for a single call to topLevelHandler()
+    uint32_t    maxPasses_ = 1;
+    uint64_t    maxTimeNs_ = 0;
+
+    // These are only ever written by the thread that calls topLevelHandler()
+    std::atomic<uint64_t> wakeups_{0}, spurious_{0}, passes_{0}, isrCalls_{0};
+    std::atomic<uint64_t> interrupts_{0}, budgetExhausted_{0};
+};
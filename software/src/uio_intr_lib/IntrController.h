@@ -0,0 +1,169 @@
+//==========================================================================================================
+// IntrController.h - Defines an interrupt controller whose interrupt service routines are known at
+//                    compile time
+//
+// Instead of overriding isr(), the caller supplies one handler type per IRQ.  A handler is any
+// default-constructible type with a "void operator()(uint32_t pending, uint32_t count)".  IRQs
+// that aren't used get the type "UnusedIrq".  For example:
+//
+//      struct TimerHandler {void operator()(uint32_t pending, uint32_t count) {...}};
+//      struct DmaHandler   {void operator()(uint32_t pending, uint32_t count) {...}};
+//
+//      IntrController<TimerHandler, UnusedIrq, DmaHandler> controller;
+//
+// This controller (a) visits only the IRQs that are pending, using count-trailing-zeros rather
+// than testing all 32 bits, (b) calls the handlers directly, so that they can be inlined, and
+// (c) never reads the counters of IRQs that are unused: those are cleared with a single posted
+// write instead of a non-posted read apiece.
+//
+// Since this is still an IntrControlBase, it works with UioInterface, UioReactor and deferred
+// ISRs exactly as a class that overrides isr() does.  With deferred ISRs or latency tracking
+// on, the base class does the dispatching (calling the handlers through isr()), so that the
+// counter-read and ISR stages are measured just as they are for any other controller.
+//==========================================================================================================
+#pragma once
+#include <tuple>
+#include <utility>
+#include <type_traits>
+#include "IntrControlBase.h"
+
+// This is the handler type for an IRQ that is never used
+struct UnusedIrq {};
+
+//==========================================================================================================
+// usedIrqMask() - Computes the bitmap of IRQs whose handler type isn't UnusedIrq
+//==========================================================================================================
+template <class... Handlers> constexpr uint32_t usedIrqMask()
+{
+    uint32_t mask = 0, bit = 1;
+    ((mask |= std::is_same<Handlers, UnusedIrq>::value ? 0 : bit, bit <<= 1), ...);
+    return mask;
+}
+//==========================================================================================================
+
+template <class... Handlers> class IntrController : public IntrControlBase
+{
+public:
+
+    // The number of IRQs this controller handles
+    static constexpr int IRQ_COUNT = sizeof...(Handlers);
+    static_assert(IRQ_COUNT >= 1 && IRQ_COUNT <= 32, "An interrupt controller has 1 to 32 IRQs");
+
+    // A bitmap of the IRQs that have handlers
+    static constexpr uint32_t USED_MASK = usedIrqMask<Handlers...>();
+
+    // Returns a reference to the handler object for the specified IRQ
+    template <int IRQ> auto& handler() {return std::get<IRQ>(handler_);}
+
+    // Deferred ISRs call into our handlers, so the workers have to stop before they go
+    ~IntrController() {stopDeferredIsr();}
+
+protected:
+
+    //------------------------------------------------------------------------------------------
+    // servicePending() - Reads the counters of the pending IRQs and calls their handlers
+    //------------------------------------------------------------------------------------------
+    void servicePending(uint32_t pending) override
+    {
+        uint32_t counter[IRQ_COUNT];
+
+        // Clear any IRQ that doesn't have a handler with a single posted write
+        uint32_t unused = pending & ~USED_MASK;
+        if (unused) acknowledgeIrqs(unused);
+
+        // From here on, we only care about IRQs that have handlers
+        pending &= USED_MASK;
+
+        // If the ISRs are being deferred to worker threads or timed, let the base class do it
+        if (workerPool() || isTrackingLatency())
+        {
+            if (pending) IntrControlBase::servicePending(pending);
+            return;
+        }
+
+        // Read the counter of every pending IRQ so that IRQ_REQ can de-assert quickly
+        for (uint32_t bits = pending; bits; bits &= bits - 1)
+        {
+            int irq = __builtin_ctz(bits);
+            counter[irq] = readCounter(irq);
+        }
+
+        // Now call the handlers
+        IntrController::serviceCounts(pending, counter);
+    }
+    //------------------------------------------------------------------------------------------
+
+
+    //------------------------------------------------------------------------------------------
+    // serviceCounts() - Calls the handlers of the pending IRQs whose counters have been read.
+    //                   This is called directly when the counts come from a status record.
+    //------------------------------------------------------------------------------------------
+    void serviceCounts(uint32_t pending, const uint32_t* counter) override
+    {
+        uint64_t interrupts = 0;
+
+        // IRQs without handlers are ignored: their counters have already been cleared
+        pending &= USED_MASK;
+
+        // If the ISRs are being deferred to worker threads or timed, let the base class do it
+        if (workerPool() || isTrackingLatency())
+        {
+            if (pending) IntrControlBase::serviceCounts(pending, counter);
+            return;
+        }
+
+        // Call the handler of every pending IRQ
+        for (uint32_t bits = pending; bits; bits &= bits - 1)
+        {
+            int irq = __builtin_ctz(bits);
+            interrupts += counter[irq];
+            TraceRing::record(TRACE_ISR_ENTER, irq);
+            dispatch(irq, pending, counter[irq], std::index_sequence_for<Handlers...>{});
+            TraceRing::record(TRACE_ISR_EXIT, irq);
+        }
+
+        // Keep track of how many interrupts we've serviced, and wake anyone waiting for them
+        recordDispatch(__builtin_popcount(pending), interrupts);
+        publishCounts(pending, counter);
+    }
+    //------------------------------------------------------------------------------------------
+
+
+    //------------------------------------------------------------------------------------------
+    // isr() - Only called by the base class, when ISRs are deferred or timed
+    //------------------------------------------------------------------------------------------
+    void isr(uint32_t pending, int irq, uint32_t count) override
+    {
+        dispatch(irq, pending, count, std::index_sequence_for<Handlers...>{});
+    }
+    //------------------------------------------------------------------------------------------
+
+private:
+
+    //------------------------------------------------------------------------------------------
+    // call() - Calls the handler for IRQ "I", if there is one
+    //------------------------------------------------------------------------------------------
+    template <size_t I> void call(uint32_t pending, uint32_t count)
+    {
+        using handler_t = typename std::tuple_element<I, std::tuple<Handlers...>>::type;
+        if constexpr (!std::is_same<handler_t, UnusedIrq>::value)
+        {
+            std::get<I>(handler_)(pending, count);
+        }
+    }
+    //------------------------------------------------------------------------------------------
+
+
+    //------------------------------------------------------------------------------------------
+    // dispatch() - Calls the handler for "irq".  The compiler turns this into a jump table.
+    //------------------------------------------------------------------------------------------
+    template <size_t... I> void dispatch(int irq, uint32_t pending, uint32_t count,
+                                         std::index_sequence<I...>)
+    {
+        ((irq == (int)I ? (call<I>(pending, count), true) : false) || ...);
+    }
+    //------------------------------------------------------------------------------------------
+
+    // One handler object per IRQ
+    std::tuple<Handlers...> handler_;
+};
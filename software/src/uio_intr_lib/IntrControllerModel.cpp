@@ -0,0 +1,379 @@
+//=================================================================================================
+// IntrControllerModel.cpp - Implements a software model of pcie_intr_controller.v
+//=================================================================================================
+#include <unistd.h>
+#include <stdio.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
+#include <fcntl.h>
+#include <stdexcept>
+#include "IntrControllerModel.h"
+
+
+//=================================================================================================
+// Constructor - Resets the model and creates the stand-in file descriptors
+//=================================================================================================
+IntrControllerModel::IntrControllerModel(int irqCount)
+{
+    // An interrupt controller has between 1 and 32 IRQs
+    if (irqCount < 1 ) irqCount = 1;
+    if (irqCount > 32) irqCount = 32;
+    irqCount_  = irqCount;
+    validMask_ = (irqCount == 32) ? 0xFFFFFFFF : (1u << irqCount) - 1;
+
+    // Coming out of reset, every counter is zero
+    for (auto& counter : counter_) counter = 0;
+
+    // This stands in for /dev/uioN
+    uiofd_ = eventfd(0, EFD_CLOEXEC);
+    if (uiofd_ < 0) throw std::runtime_error("Can't create eventfd for interrupt controller model");
+
+    // This stands in for the PCI config-space.  The command word says "memory space and
+    // bus-mastering enabled, interrupts disabled", which is how uio_pci_generic leaves it.
+    // We'd like an unnamed file that inotify can watch (a memfd can't be watched), but if
+    // there's nowhere to put one, a memfd will do.
+    configfd_ = open("/dev/shm", O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (configfd_ < 0) configfd_ = memfd_create("intr_model_config", MFD_CLOEXEC);
+    if (configfd_ < 0) throw std::runtime_error("Can't create config-space for interrupt controller model");
+    uint8_t config[256] = {0};
+    config[4] = 0x06;
+    config[5] = 0x04;
+    if (pwrite(configfd_, config, sizeof config, 0) != sizeof config)
+    {
+        throw std::runtime_error("Can't initialize config-space for interrupt controller model");
+    }
+
+    // Watch for the host re-enabling interrupts in the config-space
+    char filename[64];
+    sprintf(filename, "/proc/self/fd/%d", configfd_);
+    inotifyfd_ = inotify_init1(IN_CLOEXEC);
+    if (inotifyfd_ >= 0 && inotify_add_watch(inotifyfd_, filename, IN_MODIFY) >= 0)
+    {
+        configWatcher_ = std::thread(&IntrControllerModel::watchConfig, this);
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// Destructor - Closes the stand-in file descriptors
+//=================================================================================================
+IntrControllerModel::~IntrControllerModel()
+{
+    // Wake the config-space watcher by rewriting the command word, and wait for it to stop
+    if (configWatcher_.joinable())
+    {
+        uint8_t command;
+        stopping_ = true;
+        if (pread(configfd_, &command, 1, 5) == 1 && pwrite(configfd_, &command, 1, 5) == 1)
+        {
+            configWatcher_.join();
+        }
+        else configWatcher_.detach();
+    }
+    if (inotifyfd_ >= 0) close(inotifyfd_);
+
+    close(uiofd_);
+    close(configfd_);
+    for (auto& vector : vector_) close(vector.fd);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// watchConfig() - Runs in its own thread.  Every time the host writes the config-space with
+//                 "Interrupt disable" clear, IRQ_REQ is seen again, just as a real INTx line
+//                 that's still asserted interrupts the host as soon as it's unmasked.
+//
+// Without this, IRQs that the host leaves pending (when its coalescing budget runs out, say)
+// wouldn't be serviced until something else was raised.
+//=================================================================================================
+void IntrControllerModel::watchConfig()
+{
+    char    events[4096];
+    uint8_t command;
+
+    while (read(inotifyfd_, events, sizeof events) > 0 && !stopping_)
+    {
+        if (pread(configfd_, &command, 1, 5) == 1 && (command & 0x4) == 0) signalIfRequested();
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// addVector() - Creates the eventfd that stands in for a message-signalled interrupt vector
+//=================================================================================================
+int IntrControllerModel::addVector(uint32_t irqGroup)
+{
+    int fd = eventfd(0, EFD_CLOEXEC);
+    if (fd < 0) throw std::runtime_error("Can't create eventfd for interrupt controller model");
+    vector_.push_back({irqGroup, fd});
+    return fd;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// count() - Adds "amount" to the counter of every IRQ in "irqs", saturating at 0xFFFF_FFFE
+//=================================================================================================
+void IntrControllerModel::count(uint32_t irqs, uint32_t amount)
+{
+    for (int i=0; i<irqCount_; ++i) if (irqs & (1u << i))
+    {
+        uint32_t value = counter_[i].load();
+        uint32_t total;
+        do
+        {
+            total = (value >= SATURATE || SATURATE - value < amount) ? SATURATE : value + amount;
+        } while (!counter_[i].compare_exchange_weak(value, total));
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// pendingIrqs() - An interrupt is pending whenever its counter is greater than zero
+//=================================================================================================
+uint32_t IntrControllerModel::pendingIrqs()
+{
+    uint32_t pending = 0;
+    for (int i=0; i<irqCount_; ++i) if (counter_[i].load(std::memory_order_relaxed)) pending |= (1u << i);
+    return pending;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// irqRequest() - IRQ_REQ is asserted when any IRQ is pending and interrupts are globally enabled
+//=================================================================================================
+bool IntrControllerModel::irqRequest()
+{
+    return globalEnable_ && pendingIrqs() != 0;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// signalIfRequested() - If IRQ_REQ is asserted, notify whoever is waiting on the uio stand-in
+//=================================================================================================
+void IntrControllerModel::signalIfRequested()
+{
+    uint64_t one = 1;
+
+    // With status writeback on, IRQ_REQ is asserted while the ring holds unconsumed records
+    if (statusSlots_)
+    {
+        if (!writeStatus()) return;
+    }
+    else if (!irqRequest()) return;
+
+    // With message-signalled interrupts, every vector that serves a pending IRQ gets a message
+    if (!vector_.empty())
+    {
+        uint32_t pending = statusSlots_ ? validMask_ : pendingIrqs();
+        for (auto& vector : vector_) if (vector.irqGroup & pending)
+        {
+            if (write(vector.fd, &one, sizeof one) == sizeof one) ++signals_;
+        }
+        return;
+    }
+
+    if (write(uiofd_, &one, sizeof one) == sizeof one) ++signals_;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// takeCounter() - Reads and clears the counter of an IRQ, exactly the way an AXI read does
+//=================================================================================================
+uint32_t IntrControllerModel::takeCounter(int irq)
+{
+    // The RTL returns "irq_counter + irq_in" and, on the next clock, sets irq_counter to irq_in.
+    // So if the IRQ is being held high, it's counted in what we return and counts once more.
+    uint32_t irqIn = ((level_ & mask_) >> irq) & 1;
+    return counter_[irq].exchange(irqIn) + irqIn;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// writeStatus() - If IRQ_REQ would be asserted and there's room in the status ring, snapshots
+//                 the counters of the pending IRQs into the next slot.  Returns true if the
+//                 ring holds records that the host hasn't consumed yet.
+//=================================================================================================
+bool IntrControllerModel::writeStatus()
+{
+    std::lock_guard<std::mutex> lock(statusMutex_);
+
+    uint32_t slots    = statusSlots_;
+    uint32_t produced = statusProduced_;
+
+    // If writeback has been turned off, there's nothing to do
+    if (slots == 0 || statusRing_ == nullptr) return false;
+
+    // If something is pending and there's a free slot, write a record
+    if (irqRequest() && produced - statusConsumed_ < slots)
+    {
+        intr_status_t& record = statusRing_[produced & (slots - 1)];
+        uint32_t       pending = pendingIrqs();
+
+        // Snapshot the counters (clearing them) exactly as the host would have
+        for (int i=0; i<irqCount_; ++i)
+        {
+            record.count[i] = (pending & (1u << i)) ? takeCounter(i) : 0;
+        }
+        record.pending = pending;
+
+        // The sequence number goes last, which makes the record visible to the host
+        __atomic_store_n(&record.seq, ++produced, __ATOMIC_RELEASE);
+        statusProduced_ = produced;
+    }
+
+    // IRQ_REQ stays asserted as long as there are records the host hasn't consumed
+    return produced != statusConsumed_;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// raise() - Strobes IRQ_IN high for one clock cycle on each of the specified IRQs.  Just like
+//           the RTL, a masked IRQ doesn't count.
+//=================================================================================================
+void IntrControllerModel::raise(uint32_t irqs)
+{
+    count(irqs & mask_ & validMask_, 1);
+    signalIfRequested();
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// pulse() - Holds IRQ_IN high on the specified IRQs for a number of clock cycles.  The RTL counts
+//           a masked-in IRQ once for every clock that it's high.
+//=================================================================================================
+void IntrControllerModel::pulse(uint32_t irqs, uint32_t clocks)
+{
+    if (clocks == 0) return;
+    count(irqs & mask_ & validMask_, clocks);
+    signalIfRequested();
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// setLevel() - Holds IRQ_IN high on the specified IRQs.  They are counted by tick().
+//=================================================================================================
+void IntrControllerModel::setLevel(uint32_t irqs)
+{
+    level_ = irqs & validMask_;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// tick() - Advances time by "clocks" clock cycles
+//=================================================================================================
+void IntrControllerModel::tick(uint32_t clocks)
+{
+    uint32_t irqIn = level_ & mask_;
+    if (irqIn == 0 || clocks == 0) return;
+    count(irqIn, clocks);
+    signalIfRequested();
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// readReg() - Performs the equivalent of an AXI read of the specified register
+//=================================================================================================
+uint32_t IntrControllerModel::readReg(int index)
+{
+    switch (index)
+    {
+        case REG_IRQ_PENDING:   return pendingIrqs();
+        case REG_IRQ_ACK:       return pendingIrqs();
+        case REG_IRQ_MASK:      return mask_;
+        case REG_GLOB_ENABLE:   return globalEnable_;
+        case REG_STATUS_ADDR_LO:  return statusAddrLo_;
+        case REG_STATUS_ADDR_HI:  return statusAddrHi_;
+        case REG_STATUS_SLOTS:    return statusSlots_;
+        case REG_STATUS_CONSUMED: return statusConsumed_;
+    }
+
+    // Any other register had better be one of the interrupt counters
+    int irq = index - REG_COUNTERS;
+    if (irq < 0 || irq >= irqCount_) return 0;
+
+    uint32_t value = takeCounter(irq);
+
+    // If the IRQ is still pending, IRQ_REQ stays asserted and the host will be interrupted again
+    if ((level_ & mask_) & (1u << irq)) signalIfRequested();
+
+    return value;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// writeReg() - Performs the equivalent of an AXI write to the specified register
+//=================================================================================================
+void IntrControllerModel::writeReg(int index, uint32_t value)
+{
+    switch (index)
+    {
+        // Writing to the pending register strobes the AXI equivalent of IRQ_IN
+        case REG_IRQ_PENDING:
+            raise(value);
+            break;
+
+        // Writing to the acknowledge register clears the counters of the specified IRQs
+        case REG_IRQ_ACK:
+            for (int i=0; i<irqCount_; ++i) if (value & (1u << i))
+            {
+                counter_[i] = ((level_ & mask_) >> i) & 1;
+            }
+            break;
+
+        // Writing the mask might allow an IRQ that's held high to start counting
+        case REG_IRQ_MASK:
+            mask_ = value & validMask_;
+            break;
+
+        // Enabling interrupts when something is already pending asserts IRQ_REQ
+        case REG_GLOB_ENABLE:
+            globalEnable_ = value & 1;
+            signalIfRequested();
+            break;
+
+        // The address of the status ring is latched when the slot count is written
+        case REG_STATUS_ADDR_LO:
+            statusAddrLo_ = value;
+            break;
+
+        case REG_STATUS_ADDR_HI:
+            statusAddrHi_ = value;
+            break;
+
+        // Writing the slot count turns status writeback on (or, if it's 0, off)
+        case REG_STATUS_SLOTS:
+            {
+                std::lock_guard<std::mutex> lock(statusMutex_);
+                uint64_t address = ((uint64_t)statusAddrHi_ << 32) | statusAddrLo_;
+                statusRing_      = (intr_status_t*)address;
+                statusProduced_  = 0;
+                statusConsumed_  = 0;
+                statusSlots_     = (value & (value - 1)) ? 0 : value;
+            }
+            signalIfRequested();
+            break;
+
+        // The host hands slots back by writing the sequence number of the last record it consumed
+        case REG_STATUS_CONSUMED:
+            statusConsumed_ = value;
+            signalIfRequested();
+            break;
+    }
+}
+//=================================================================================================
@@ -0,0 +1,145 @@
+//=================================================================================================
+// IntrControllerModel.h - Defines a software model of pcie_intr_controller.v, along with stand-ins
+//                         for /dev/uioN and the PCI config-space of the device
+//
+// An IntrControlBase that's initialized with one of these, and a UioInterface (or UioReactor)
+// that's handed its uioFd() and configFd(), run exactly as they would against the real hardware.
+// This allows the host software to be exercised and benchmarked on any Linux machine.
+//
+// The model also implements status writeback (see StatusRing.h).  Since the model runs in the
+// same process as the host software, the "bus address" of the status ring is simply its
+// virtual address.
+//=================================================================================================
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "RegisterModel.h"
+#include "StatusRing.h"
+
+class IntrControllerModel : public RegisterModel
+{
+public:
+
+    // The number of interrupt sources, just like the IRQ_COUNT parameter of the RTL
+    explicit IntrControllerModel(int irqCount = 32);
+
+    // Closes the stand-in file descriptors
+    ~IntrControllerModel();
+
+    // No copy or assignment constructor - objects of this class can't be copied
+    IntrControllerModel (const IntrControllerModel&) = delete;
+    IntrControllerModel& operator= (const IntrControllerModel&) = delete;
+
+    // AXI register reads and writes, with the same semantics as the RTL
+    uint32_t readReg(int index) override;
+    void     writeReg(int index, uint32_t value) override;
+
+    // Strobes IRQ_IN high for one clock cycle on each of the specified IRQs
+    void     raise(uint32_t irqs);
+
+    // Holds IRQ_IN high on each of the specified IRQs for "clocks" clock cycles, then lets them
+    // go.  The IRQs count "clocks" times, all at once.
+    void     pulse(uint32_t irqs, uint32_t clocks);
+
+    // Holds IRQ_IN high on each of the specified IRQs (and low on all others)
+    void     setLevel(uint32_t irqs);
+
+    // Advances time by "clocks" clock cycles: IRQs held high by setLevel() count once per clock
+    void     tick(uint32_t clocks = 1);
+
+    // The state of the IRQ_REQ output
+    bool     irqRequest();
+
+    // The eventfd that stands in for /dev/uioN.  It's signalled whenever IRQ_REQ is asserted.
+    int      uioFd() {return uiofd_;}
+
+    // Switches the model from a legacy interrupt to message-signalled interrupts, and returns
+    // an eventfd that stands in for the vector that serves the IRQs in "irqGroup".  Once any
+    // vector exists, uioFd() is never signalled again.  Add every vector before raising IRQs.
+    int      addVector(uint32_t irqGroup);
+
+    // A 256-byte in-memory file that stands in for the device's PCI config-space.  Writing
+    // it with "Interrupt disable" clear re-asserts any interrupt that's still pending.
+    int      configFd() {return configfd_;}
+
+    // How many times the uioFd() has been signalled
+    uint64_t signalCount() {return signals_;}
+
+    // How many status records have been written to the status ring
+    uint64_t statusCount() {return statusProduced_;}
+
+protected:
+
+    // These are the control and status registers of the interrupt controller
+    enum
+    {
+        REG_IRQ_PENDING        =  0,
+        REG_IRQ_ACK            =  1,
+        REG_IRQ_MASK           =  2,
+        REG_GLOB_ENABLE        =  3,
+
+        // These control status writeback (see StatusRing.h).  Writing a slot count of 0
+        // turns writeback off.
+        REG_STATUS_ADDR_LO     =  4,
+        REG_STATUS_ADDR_HI     =  5,
+        REG_STATUS_SLOTS       =  6,
+        REG_STATUS_CONSUMED    =  7,
+
+        REG_COUNTERS           = 32
+    };
+
+    // The counters saturate at this value, so that "counter + irq_in" can't overflow
+    static const uint32_t SATURATE = 0xFFFFFFFE;
+
+    // Adds "amount" to the counter of every IRQ in "irqs", saturating
+    void     count(uint32_t irqs, uint32_t amount);
+
+    // Returns the bitmap of IRQs whose counter is non-zero
+    uint32_t pendingIrqs();
+
+    // Signals the stand-in for /dev/uioN if IRQ_REQ is asserted
+    void     signalIfRequested();
+
+    // Signals IRQ_REQ again each time the host re-enables interrupts in the config-space
+    void     watchConfig();
+
+    // Reads and clears the counter of a single IRQ
+    uint32_t takeCounter(int irq);
+
+    // If status writeback is on and there's room in the ring, writes a status record.
+    // Returns true if the ring holds records that haven't been consumed.
+    bool     writeStatus();
+
+    // The number of IRQs, and a bitmap with a 1 for each of them
+    int      irqCount_;
+    uint32_t validMask_;
+
+    // The per-IRQ counters, the mask, the global enable, and the IRQ_IN lines held high
+    std::atomic<uint32_t> counter_[32];
+    std::atomic<uint32_t> mask_{0}, globalEnable_{0}, level_{0};
+
+    // The stand-in file descriptors
+    int      uiofd_, configfd_;
+
+    // The thread that watches the config-space for writes, through "inotifyfd_"
+    int               inotifyfd_ = -1;
+    std::thread       configWatcher_;
+    std::atomic<bool> stopping_{false};
+
+    // When message-signalled interrupts are in use, the IRQ group and eventfd of each vector
+    struct vector_t {uint32_t irqGroup; int fd;};
+    std::vector<vector_t> vector_;
+
+    // The status writeback registers, and the sequence number of the last record written.
+    // Status records are written under the lock.
+    std::mutex         statusMutex_;
+    intr_status_t*     statusRing_     = nullptr;
+    uint32_t           statusAddrLo_   = 0, statusAddrHi_ = 0;
+    std::atomic<uint32_t> statusSlots_{0}, statusConsumed_{0}, statusProduced_{0};
+
+    // How many times we've signalled the uio stand-in
+    std::atomic<uint64_t> signals_{0};
+};
@@ -0,0 +1,180 @@
+//=================================================================================================
+// IoUring.cpp - Implements a minimal wrapper around a Linux io_uring
+//=================================================================================================
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "IoUring.h"
+#include "CpuUtil.h"
+
+
+//=================================================================================================
+// open() - Creates the io_uring and maps its submission and completion queues
+//=================================================================================================
+bool IoUring::open(uint32_t entries, bool sqPoll, std::string* error)
+{
+    io_uring_params params;
+
+    // If we're already open, start over
+    close();
+
+    // Create the io_uring
+    memset(&params, 0, sizeof params);
+    if (sqPoll)
+    {
+        params.flags          = IORING_SETUP_SQPOLL;
+        params.sq_thread_idle = 1000;
+    }
+    ringfd_ = syscall(__NR_io_uring_setup, entries, &params);
+    if (ringfd_ < 0)
+    {
+        if (error) *error = std::string("io_uring_setup: ") + strerror(errno);
+        return false;
+    }
+    sqPoll_ = sqPoll;
+
+    // Map the submission queue ring and the completion queue ring.  On newer kernels
+    // they're a single mapping.
+    sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    cqRingSize_ = params.cq_off.cqes  + params.cq_entries * sizeof(io_uring_cqe);
+    bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single && cqRingSize_ > sqRingSize_) sqRingSize_ = cqRingSize_;
+
+    sqRing_ = mmap(0, sqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd_, IORING_OFF_SQ_RING);
+    if (sqRing_ == MAP_FAILED) sqRing_ = nullptr;
+
+    if (single)
+        cqRing_ = sqRing_;
+    else
+    {
+        cqRing_ = mmap(0, cqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd_, IORING_OFF_CQ_RING);
+        if (cqRing_ == MAP_FAILED) cqRing_ = nullptr;
+    }
+
+    // And map the submission queue entries themselves
+    sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(0, sqesSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd_, IORING_OFF_SQES);
+    sqes_ = (sqes == MAP_FAILED) ? nullptr : (io_uring_sqe*)sqes;
+
+    if (sqRing_ == nullptr || cqRing_ == nullptr || sqes_ == nullptr)
+    {
+        if (error) *error = std::string("io_uring mmap: ") + strerror(errno);
+        close();
+        return false;
+    }
+
+    // Find the fields of the submission queue...
+    uint8_t* sq = (uint8_t*)sqRing_;
+    sqHead_    = (uint32_t*)(sq + params.sq_off.head);
+    sqTail_    = (uint32_t*)(sq + params.sq_off.tail);
+    sqMask_    = (uint32_t*)(sq + params.sq_off.ring_mask);
+    sqFlags_   = (uint32_t*)(sq + params.sq_off.flags);
+    sqArray_   = (uint32_t*)(sq + params.sq_off.array);
+    sqEntries_ = params.sq_entries;
+
+    // ...and of the completion queue
+    uint8_t* cq = (uint8_t*)cqRing_;
+    cqHead_ = (uint32_t*)(cq + params.cq_off.head);
+    cqTail_ = (uint32_t*)(cq + params.cq_off.tail);
+    cqMask_ = (uint32_t*)(cq + params.cq_off.ring_mask);
+    cqes_   = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    sqPending_ = 0;
+    syscalls_  = 0;
+    return true;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// close() - Unmaps the rings and closes the io_uring
+//=================================================================================================
+void IoUring::close()
+{
+    if (sqes_) munmap(sqes_, sqesSize_);
+    if (cqRing_ && cqRing_ != sqRing_) munmap(cqRing_, cqRingSize_);
+    if (sqRing_) munmap(sqRing_, sqRingSize_);
+    if (ringfd_ >= 0) ::close(ringfd_);
+
+    sqes_   = nullptr;
+    cqRing_ = sqRing_ = nullptr;
+    ringfd_ = -1;
+    sqPoll_ = false;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// getSqe() - Returns the next free submission queue entry
+//
+// Submission queue entry "i" always lives in slot "i" of the array, so the array only ever has
+// to be filled in once per entry.
+//=================================================================================================
+io_uring_sqe* IoUring::getSqe()
+{
+    uint32_t head = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+    uint32_t tail = *sqTail_ + sqPending_;
+
+    // If the kernel hasn't consumed enough entries yet, there's no room
+    if (tail - head >= sqEntries_) return nullptr;
+
+    uint32_t index = tail & *sqMask_;
+    sqArray_[index] = index;
+    ++sqPending_;
+
+    io_uring_sqe* sqe = &sqes_[index];
+    memset(sqe, 0, sizeof *sqe);
+    return sqe;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// submit() - Publishes the entries we've filled in, and waits for completions if asked to
+//
+// Without SQPOLL, io_uring_enter() both submits and waits, in a single system call.  With SQPOLL,
+// the kernel thread sees the new tail on its own; we only have to make a system call if it has
+// gone to sleep, or if we have to wait.
+//=================================================================================================
+bool IoUring::submit(uint32_t waitNr)
+{
+    uint32_t submitted = sqPending_;
+    uint32_t flags     = 0;
+
+    // Make the new entries visible to the kernel
+    __atomic_store_n(sqTail_, *sqTail_ + sqPending_, __ATOMIC_RELEASE);
+    sqPending_ = 0;
+
+    if (sqPoll_)
+    {
+        // The kernel thread will submit the entries, so we don't
+        submitted = 0;
+
+        // If the kernel thread has gone to sleep, it has to be woken up
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (__atomic_load_n(sqFlags_, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP)
+        {
+            flags |= IORING_ENTER_SQ_WAKEUP;
+        }
+
+        // If there's nothing to do, we don't need to make a system call at all
+        if (flags == 0 && waitNr == 0) return true;
+    }
+
+    if (waitNr) flags |= IORING_ENTER_GETEVENTS;
+
+    // Hand the entries to the kernel and/or wait for completions
+    while (true)
+    {
+        bump(syscalls_);
+        int err = syscall(__NR_io_uring_enter, ringfd_, submitted, waitNr, flags, nullptr, 0);
+        if (err >= 0) return true;
+        if (errno != EINTR) return false;
+
+        // If we were interrupted, the entries were already submitted
+        submitted = 0;
+    }
+}
+//=================================================================================================
@@ -0,0 +1,94 @@
+//=================================================================================================
+// IoUring.h - Defines a minimal wrapper around a Linux io_uring, driven by raw system calls
+//=================================================================================================
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <atomic>
+#include <linux/io_uring.h>
+
+//-------------------------------------------------------------------
+// This is just enough of an io_uring to submit a handful of
+// operations at a time and wait for them to complete: a submission
+// queue, a completion queue, and a count of the system calls it has
+// made.
+//
+// With SQPOLL, a kernel thread picks submissions up on its own, so
+// submitting costs no system call at all unless that thread has
+// gone to sleep.
+//-------------------------------------------------------------------
+class IoUring
+{
+public:
+
+    // Default constructor
+    IoUring() {}
+
+    // Destructor - Unmaps the rings and closes the io_uring
+    ~IoUring() {close();}
+
+    // No copy or assignment constructor - objects of this class can't be copied
+    IoUring (const IoUring&) = delete;
+    IoUring& operator= (const IoUring&) = delete;
+
+    // Creates an io_uring with room for "entries" submissions.  Returns false (and describes
+    // why in "error") if this kernel can't give us one, e.g. because io_uring is disabled.
+    bool        open(uint32_t entries, bool sqPoll = false, std::string* error = nullptr);
+
+    // Releases the io_uring
+    void        close();
+
+    // Returns true if the io_uring is open, and whether it's being polled by a kernel thread
+    bool        isOpen() {return ringfd_ >= 0;}
+    bool        isSqPoll() {return sqPoll_;}
+
+    // Returns a cleared submission queue entry to fill in, or nullptr if the queue is full.
+    // Entries aren't seen by the kernel until submit() is called.
+    io_uring_sqe* getSqe();
+
+    // Hands the entries we've filled in to the kernel, then waits until at least "waitNr"
+    // completions are available.  A signal can cut the wait short, so check peekCqe() rather
+    // than assuming they're there.  Returns false (with errno set) on error.
+    bool        submit(uint32_t waitNr = 0);
+
+    // Returns the next completion, or nullptr if there isn't one yet
+    io_uring_cqe* peekCqe()
+    {
+        uint32_t head = *cqHead_;
+        if (head == __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE)) return nullptr;
+        return &cqes_[head & *cqMask_];
+    }
+
+    // Tells the kernel we're done with the completion that peekCqe() returned
+    void        cqeSeen() {__atomic_store_n(cqHead_, *cqHead_ + 1, __ATOMIC_RELEASE);}
+
+    // Returns the number of system calls we've made since open()
+    uint64_t    syscalls() {return syscalls_;}
+
+protected:
+
+    int         ringfd_ = -1;
+    bool        sqPoll_ = false;
+
+    // The regions we mapped, and their sizes
+    void*       sqRing_ = nullptr, *cqRing_ = nullptr;
+    size_t      sqRingSize_ = 0, cqRingSize_ = 0;
+    io_uring_sqe* sqes_ = nullptr;
+    size_t      sqesSize_ = 0;
+
+    // The fields of the submission queue ring
+    uint32_t*   sqHead_ = nullptr, *sqTail_ = nullptr, *sqMask_ = nullptr;
+    uint32_t*   sqFlags_ = nullptr, *sqArray_ = nullptr;
+    uint32_t    sqEntries_ = 0;
+
+    // The submission queue entries we've filled in but not yet handed to the kernel
+    uint32_t    sqPending_ = 0;
+
+    // The fields of the completion queue ring
+    uint32_t*   cqHead_ = nullptr, *cqTail_ = nullptr, *cqMask_ = nullptr;
+    io_uring_cqe* cqes_ = nullptr;
+
+    // Only the thread that owns the io_uring writes this
+    std::atomic<uint64_t> syscalls_{0};
+};
+//-------------------------------------------------------------------
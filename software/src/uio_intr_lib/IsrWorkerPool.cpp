@@ -0,0 +1,180 @@
+//=================================================================================================
+// IsrWorkerPool.cpp - Implements a pool of threads that run interrupt service routines on behalf
+//                     of the thread that detects the interrupts
+//=================================================================================================
+#include "IsrWorkerPool.h"
+#include "CpuUtil.h"
+#include "Futex.h"
+
+// How many times an idle worker checks its ring before it goes to sleep
+static const int IDLE_SPINS = 1000;
+
+//=================================================================================================
+// Constructor - Creates the workers and starts their threads
+//=================================================================================================
+IsrWorkerPool::IsrWorkerPool(int workerCount, uint32_t ringSize,
+                             std::function<void(const irq_event_t&)> handler)
+{
+    handler_ = handler;
+
+    // There must be at least one worker, and there's no use for more than 32
+    if (workerCount < 1 ) workerCount = 1;
+    if (workerCount > 32) workerCount = 32;
+
+    // Create the workers
+    for (int i=0; i<workerCount; ++i) worker_.emplace_back(new worker_t(ringSize));
+
+    // By default, the IRQs are spread across the workers
+    for (int irq=0; irq<32; ++irq) irqWorker_[irq] = worker_[irq % workerCount].get();
+
+    // And start the worker threads
+    for (auto& worker : worker_)
+    {
+        worker->thread = std::thread(&IsrWorkerPool::runWorker, this, worker.get());
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// Destructor - Tells the workers to exit once their rings are empty, and waits for them
+//=================================================================================================
+IsrWorkerPool::~IsrWorkerPool()
+{
+    stopping_ = true;
+
+    for (auto& worker : worker_)
+    {
+        wake(worker.get());
+        worker->thread.join();
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// setIrqWorker() - Assigns an IRQ to a specific worker.  
+//
+// Changing the assignment of an IRQ that has events in flight would allow those events to be
+// serviced out of order, so this should be called before interrupts are enabled
+//=================================================================================================
+void IsrWorkerPool::setIrqWorker(int irq, int worker)
+{
+    if (irq < 0 || irq > 31) return;
+    irqWorker_[irq] = worker_[worker % worker_.size()].get();
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// wake() - Wakes a worker if it's sleeping
+//=================================================================================================
+void IsrWorkerPool::wake(worker_t* worker)
+{
+    // This fence pairs with the one in runWorker(): either the worker sees what we just
+    // pushed into its ring, or we see that it's going to sleep
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (worker->sleeping.load(std::memory_order_relaxed))
+    {
+        worker->sleeping.store(0, std::memory_order_relaxed);
+        futexWake(&worker->sleeping);
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// post() - Places an event in the ring of the worker that services its IRQ.  If that ring is
+//          full we wait for room: events are never dropped.
+//=================================================================================================
+void IsrWorkerPool::post(const irq_event_t& event)
+{
+    worker_t* worker = irqWorker_[event.irq & 31];
+
+    // If the ring is full, make sure the worker is awake and wait for room
+    if (!worker->ring.push(event))
+    {
+        uint64_t startNs = nowNs();
+        bump(overflows_);
+        do
+        {
+            wake(worker);
+            cpuRelax();
+        } while (!worker->ring.push(event));
+        bump(overflowNs_, nowNs() - startNs);
+    }
+
+    // Keep track of how many events have been posted
+    bump(posted_);
+
+    // Make sure the worker knows there's work to do
+    wake(worker);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// runWorker() - Services the events in a worker's ring, sleeping when there's nothing to do
+//=================================================================================================
+void IsrWorkerPool::runWorker(worker_t* worker)
+{
+    irq_event_t event;
+    int         idle = 0;
+
+    while (true)
+    {
+        // If there's an event waiting, service it
+        if (worker->ring.pop(event))
+        {
+            handler_(event);
+            bump(worker->serviced);
+            idle = 0;
+            continue;
+        }
+
+        // If we've been told to stop and our ring is empty, we're done
+        if (stopping_) break;
+
+        // Spin for a little while before we go to sleep
+        if (++idle < IDLE_SPINS)
+        {
+            cpuRelax();
+            continue;
+        }
+
+        // Tell the producer that we're going to sleep
+        worker->sleeping.store(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        // If something arrived after all, or if we're being told to stop, don't sleep
+        if (!worker->ring.empty() || stopping_)
+        {
+            worker->sleeping.store(0, std::memory_order_relaxed);
+            continue;
+        }
+
+        // Sleep until the producer wakes us
+        futexWait(&worker->sleeping, 1);
+        idle = 0;
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// getStats() - Returns statistics about the work done by the pool
+//=================================================================================================
+IsrWorkerPool::pool_stats_t IsrWorkerPool::getStats()
+{
+    pool_stats_t stats;
+
+    stats.posted     = posted_;
+    stats.overflows  = overflows_;
+    stats.overflowNs = overflowNs_;
+    stats.serviced   = 0;
+    for (auto& worker : worker_) stats.serviced += worker->serviced;
+
+    return stats;
+}
+//=================================================================================================
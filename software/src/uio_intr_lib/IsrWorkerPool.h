@@ -0,0 +1,103 @@
+//=================================================================================================
+// IsrWorkerPool.h - Defines a pool of threads that run interrupt service routines on behalf of
+//                   the thread that detects the interrupts
+//=================================================================================================
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "SpscRing.h"
+
+//-------------------------------------------------------------------
+// This is the compact record that the top-half hands to the 
+// bottom-half for every IRQ that needs servicing
+//-------------------------------------------------------------------
+struct irq_event_t
+{
+    uint32_t pending;
+    uint32_t irq;
+    uint32_t count;
+};
+//-------------------------------------------------------------------
+
+
+//-------------------------------------------------------------------
+// Every IRQ is assigned to exactly one worker, and each worker has
+// its own single-producer/single-consumer ring, so events for any
+// one IRQ are always serviced in the order they were posted.
+//
+// If a worker's ring is full, post() waits for room rather than 
+// dropping the event, and counts the overflow.
+//-------------------------------------------------------------------
+class IsrWorkerPool
+{
+public:
+
+    // Statistics about the work done by the pool
+    struct pool_stats_t
+    {
+        // How many events have been posted and how many have been serviced
+        uint64_t    posted;
+        uint64_t    serviced;
+
+        // How many times post() found a ring full and had to wait
+        uint64_t    overflows;
+
+        // Total nanoseconds post() spent waiting for room in a full ring
+        uint64_t    overflowNs;
+    };
+
+    // Starts "workerCount" workers, each of which calls "handler" for the events posted to it
+    IsrWorkerPool(int workerCount, uint32_t ringSize, std::function<void(const irq_event_t&)> handler);
+
+    // Destructor - Services whatever is left in the rings, then stops the workers
+    ~IsrWorkerPool();
+
+    // No copy or assignment constructor - objects of this class can't be copied
+    IsrWorkerPool (const IsrWorkerPool&) = delete;
+    IsrWorkerPool& operator= (const IsrWorkerPool&) = delete;
+
+    // Assigns an IRQ to a specific worker.  By default, IRQ n is serviced by worker n % workers
+    void    setIrqWorker(int irq, int worker);
+
+    // Hands an event to the worker that services event.irq.  Only one thread may call this.
+    void    post(const irq_event_t& event);
+
+    // Returns statistics about the work done by the pool
+    pool_stats_t getStats();
+
+protected:
+
+    // Everything that one worker thread needs
+    struct worker_t
+    {
+        worker_t(uint32_t ringSize) : ring(ringSize) {}
+        SpscRing<irq_event_t> ring;
+        alignas(64) std::atomic<uint32_t> sleeping{0};
+        std::atomic<uint64_t> serviced{0};
+        std::thread           thread;
+    };
+
+    // This runs in each worker thread
+    void    runWorker(worker_t* worker);
+
+    // Wakes a worker if it's sleeping
+    void    wake(worker_t* worker);
+
+    // The interrupt service routine
+    std::function<void(const irq_event_t&)> handler_;
+
+    // The workers, and which worker services each IRQ
+    std::vector<std::unique_ptr<worker_t>> worker_;
+    worker_t* irqWorker_[32];
+
+    // This is set to true when the workers should exit
+    std::atomic<bool> stopping_{false};
+
+    // These are only ever written by the thread that calls post()
+    std::atomic<uint64_t> posted_{0}, overflows_{0}, overflowNs_{0};
+};
+//-------------------------------------------------------------------
@@ -0,0 +1,77 @@
+//=================================================================================================
+// LatencyHistogram.cpp - Implements a log-linear histogram of durations
+//=================================================================================================
+#include "LatencyHistogram.h"
+#include "CpuUtil.h"
+
+
+//=================================================================================================
+// bucketLimit() - Returns the largest value that is counted by the specified bucket
+//=================================================================================================
+uint64_t LatencyHistogram::bucketLimit(int index)
+{
+    // The first SUB_COUNT buckets each hold exactly one value
+    if (index < SUB_COUNT) return index;
+
+    // Otherwise, figure out which power of two and which sub-bucket this is
+    int exponent = index / SUB_COUNT + SUB_BITS - 1;
+    int sub      = index % SUB_COUNT;
+    uint64_t width = 1ULL << (exponent - SUB_BITS);
+
+    // The bucket starts at (SUB_COUNT + sub) * width and is "width" values wide
+    return (SUB_COUNT + sub) * width + width - 1;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// summarize() - Takes a snapshot of the histogram and computes its percentiles in nanoseconds
+//
+// The snapshot isn't atomic as a whole: a duration recorded while we're reading may or may not
+// be included, which is harmless for a histogram
+//=================================================================================================
+latency_summary_t LatencyHistogram::summarize()
+{
+    latency_summary_t summary = {};
+    uint64_t          snapshot[BUCKET_COUNT];
+    uint64_t          total = 0;
+
+    // Take a copy of the buckets, and count how many values they hold
+    for (int i=0; i<BUCKET_COUNT; ++i)
+    {
+        snapshot[i] = bucket_[i].load(std::memory_order_relaxed);
+        total += snapshot[i];
+    }
+
+    // If nothing has been recorded, there's nothing to summarize
+    if (total == 0) return summary;
+
+    // The percentiles are clamped to this, so that none of them is reported above the maximum
+    uint64_t maxTicks = max_.load(std::memory_order_relaxed);
+
+    // These are the ranks of the percentiles we're interested in
+    const double fraction[3] = {0.50, 0.99, 0.999};
+    double*      result[3]   = {&summary.p50Ns, &summary.p99Ns, &summary.p999Ns};
+
+    // Walk through the buckets, finding the bucket that contains each percentile.  We report
+    // the top of that bucket, unless the largest value recorded is smaller than that.
+    uint64_t seen = 0;
+    int      p    = 0;
+    for (int i=0; i<BUCKET_COUNT && p < 3; ++i)
+    {
+        seen += snapshot[i];
+        while (p < 3 && seen >= fraction[p] * total)
+        {
+            uint64_t limit = bucketLimit(i);
+            *result[p++] = tscToNs(limit < maxTicks ? limit : maxTicks);
+        }
+    }
+
+    // Fill in the rest of the summary
+    summary.count  = total;
+    summary.meanNs = tscToNs(sum_.load(std::memory_order_relaxed)) / total;
+    summary.maxNs  = tscToNs(maxTicks);
+
+    return summary;
+}
+//=================================================================================================
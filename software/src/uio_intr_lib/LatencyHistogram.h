@@ -0,0 +1,81 @@
+//=================================================================================================
+// LatencyHistogram.h - Defines a log-linear histogram of durations that one thread records into
+//                      and any thread can read from, without locks
+//=================================================================================================
+#pragma once
+#include <stdint.h>
+#include <atomic>
+
+//-------------------------------------------------------------------
+// The summary of a histogram, converted to nanoseconds
+//-------------------------------------------------------------------
+struct latency_summary_t
+{
+    uint64_t count;
+    double   meanNs;
+    double   p50Ns;
+    double   p99Ns;
+    double   p999Ns;
+    double   maxNs;
+};
+//-------------------------------------------------------------------
+
+
+//-------------------------------------------------------------------
+// Values are recorded in readTsc() ticks.  Each power of two is
+// split into 16 linear sub-buckets, so any reported percentile is
+// within 1/16th (6.25%) of the true value, and never more than the
+// maximum.
+//
+// record() must only be called by one thread at a time, and costs a
+// handful of relaxed loads and stores.  summarize() can be called 
+// from any thread while recording is going on.
+//-------------------------------------------------------------------
+class LatencyHistogram
+{
+public:
+
+    // 16 sub-buckets per power of two, for values up to 2^40 ticks
+    enum {SUB_BITS = 4, SUB_COUNT = 1 << SUB_BITS, MAX_BITS = 40};
+    enum {BUCKET_COUNT = (MAX_BITS - SUB_BITS + 1) * SUB_COUNT};
+
+    // Records one duration, measured in readTsc() ticks
+    inline void record(uint64_t ticks)
+    {
+        if (ticks >= (1ULL << MAX_BITS)) ticks = (1ULL << MAX_BITS) - 1;
+        add(bucket_[bucketIndex(ticks)], 1);
+        add(count_, 1);
+        add(sum_, ticks);
+        if (ticks > max_.load(std::memory_order_relaxed)) max_.store(ticks, std::memory_order_relaxed);
+    }
+
+    // Computes the count, mean, percentiles and maximum of the recorded durations
+    latency_summary_t summarize();
+
+    // Returns the number of durations recorded
+    uint64_t count() {return count_.load(std::memory_order_relaxed);}
+
+protected:
+
+    // Maps a value to the index of the bucket that counts it
+    static inline int bucketIndex(uint64_t value)
+    {
+        if (value < SUB_COUNT) return value;
+        int exponent = 63 - __builtin_clzll(value);
+        int sub      = (value >> (exponent - SUB_BITS)) & (SUB_COUNT - 1);
+        return (exponent - SUB_BITS + 1) * SUB_COUNT + sub;
+    }
+
+    // Returns the largest value that maps to the specified bucket
+    static uint64_t bucketLimit(int index);
+
+    // Single-writer add
+    static inline void add(std::atomic<uint64_t>& counter, uint64_t value)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> bucket_[BUCKET_COUNT] = {};
+    std::atomic<uint64_t> count_{0}, sum_{0}, max_{0};
+};
+//-------------------------------------------------------------------
@@ -3,6 +3,7 @@
 //=================================================================================================
 #include <unistd.h>
 #include <string>
+#include <algorithm>
 #include <filesystem>
 #include <fstream>
 #include <stdarg.h>
@@ -10,6 +11,8 @@
 #include <fcntl.h>
 #include <sys/mman.h>
 #include "PciDevice.h"
+#include "PciDiscovery.h"
+#include "CpuUtil.h"
 using namespace std;
 
 #define c(s) s.c_str()
@@ -68,153 +71,57 @@ static void throwRuntime(const char* fmt, ...)
 
 
 //=================================================================================================
-// run() - Runs a shell command and returns it's output as a vector of lines
-//=================================================================================================
-static vector<string> run(const char* fmt, ...)
-{
-    char command[1024];
-    char buffer[1024];
-    std::vector<std::string> result;
-
-    // Format the caller's command into 'cmd'
-    va_list ap;
-    va_start(ap, fmt);
-    vsprintf(command, fmt, ap);
-    va_end(ap);
-
-    // Open the lpsci command as a process
-    FILE* fp = popen(command, "r");
-
-    // If we couldn't do that, give up
-    if (fp == nullptr) throwRuntime("Can't run '%s'", command);
-
-    // Fetch each line of the output
-    while (fgets(buffer, sizeof buffer, fp))
-    {
-        // Chop the linefeed off the end
-        char* p = strchr(buffer, 10); if (p) *p = 0;
-
-        // Append this line to our result
-        result.push_back(buffer);
-
-    }
-
-    // We're done with the program, close it's stdout
-    fclose(fp);
-
-    // Return a vector of string (one per line of output) to the caller
-    return result;
-}
-//=================================================================================================
-
-
-//=================================================================================================
-// getBDF() - Converts a <vendorID:deviceID> into a PCI BDF
+// mapResource() - Maps a memory-mappable resource for this device into user-space
+//
+// The BAR is mapped through the "resourceN" file in the device's sysfs directory (or through
+// "resourceN_wc" if it's prefetchable and the caller asked for write-combining), which needs
+// neither /dev/mem nor the physical address of the BAR.
 //=================================================================================================
-static string getBDF(string device)
+void PciDevice::mapResource(resource_t& bar)
 {
-    char command[64];
-    char buffer[256];
-    string retval = "0000:";
+    // These are the memory protection flags we'll use when mapping the device into memory
+    const int protection = PROT_READ | PROT_WRITE;
 
-    // Build the command "lspci -d {device}"
-    sprintf(command, "lspci -d %s", device.c_str());
+    // Pre-faulting the mapping is optional
+    const int flags = MAP_SHARED | (prefault_ ? MAP_POPULATE : 0);
 
-    // Open the lpsci command as a process
-    FILE* fp = popen(command, "r");
+    // Decide which psuedo-file we're going to map
+    string filename = deviceDir_ + "/resource" + to_string(bar.index);
+    if (writeCombine_ && bar.prefetchable && fs::exists(filename + "_wc")) filename += "_wc";
 
-    // If we couldn't do that, give up
-    if (fp == nullptr) return "";
+    // Open the psuedo-file that represents the BAR
+    FileDes fd = ::open(c(filename), O_RDWR | O_CLOEXEC);
+    if (fd < 0) throwRuntime("Can't open %s", c(filename));
 
-    // Fetch the first line of the output
-    if (!fgets(buffer, sizeof buffer, fp))
-    {
-        fclose(fp);
-        return "";
-    }
+    // Map the resources of this PCI device's BAR into our user-space memory map
+    void* ptr = ::mmap(0, bar.size, protection, flags, fd, 0);
 
-    // Find the first space in the line
-    char* p = strchr(buffer, ' ');
-    if (p == nullptr)
-    {
-        fclose(fp);
-        return "";
-    }
+    // If a mapping error occurs, complain
+    if (ptr == MAP_FAILED) throwRuntime("mmap failed on %s for size 0x%lx", c(filename), bar.size);
 
-    // Terminate the string at the first space. 
-    *p = 0;
-    
-    // The PCI BDF of the device is the first token in the buffer
-    return retval + buffer;
+    // Otherwise, save the user-space address that our PCI resource is mapped to
+    bar.baseAddr = (uint8_t*)ptr;
 }
 //=================================================================================================
 
 
-
-
 //=================================================================================================
-// mapResources() - Maps each memory-mappable resource for this device into user-space
-//
-// On Entry: resource_ = list of memory-mappable resources (the phys addr and the size)
-//
-// On Exit:  resource_ = each entry has userspace "baseAddr" filled in
+// bar() - Returns the userspace address of a BAR, mapping it if it hasn't been mapped yet
 //=================================================================================================
-void PciDevice::mapResources()
+uint8_t* PciDevice::bar(int index)
 {
-    const char* filename = "/dev/mem";
-
-    // These are the memory protection flags we'll use when mapping the device into memory
-    const int protection = PROT_READ | PROT_WRITE;
-
-    // Open the /dev/mem device
-    FileDes fd = ::open(filename, O_RDWR| O_SYNC);
-
-    // If that open failed, we're done here
-    if (fd < 0)
-    {
-        close();
-        throwRuntime("Can't open %s", filename);
-    }
+    std::lock_guard<std::mutex> lock(mutex_);
 
-    // Loop through each entry in the list of memory-mappable resources for this PCI device
-    for (auto& bar : resource_)
+    // Find the resource that describes this BAR
+    for (auto& resource : resource_) if (resource.index == index)
     {
-        // Map the resources of this PCI device's BAR into our user-space memory map
-        void* ptr = ::mmap(0, bar.size, protection, MAP_SHARED, fd, bar.physAddr);
-
-        // If a mapping error occurs, don't continue trying to map resources
-        if (ptr == MAP_FAILED) 
-        {
-            close();
-            throwRuntime("mmap failed on 0x%lx for size 0x%lx", bar.physAddr, bar.size);
-        }
-        
-        // Otherwise, save the user-space address that our PCI resource is mapped to
-        bar.baseAddr = (uint8_t*)ptr;
+        if (resource.baseAddr == nullptr) mapResource(resource);
+        return resource.baseAddr;
     }
-}
-//=================================================================================================
 
-
-//=================================================================================================
-// getIntegerFromFile() - Opens the specified file, reads the first line, expects to find an 
-//                        integer encoded as an ASCII string, and returns the value of that string
-//=================================================================================================
-static int getIntegerFromFile(string filename)
-{
-    string line;
-   
-    // Open the specified file.  It will contain a line of ASCII data
-    ifstream file(filename);
-
-    // If we couldn't open the file, hand the caller an invalid value   
-    if (!file.is_open()) return -1;
-    
-    // Fetch the first line of the file
-    getline(file, line);
-
-    // And hand the caller that line, decoded as an integer
-    return stoi(line, 0, 0);
+    // If we get here, the device doesn't have that BAR
+    throwRuntime("Device has no memory-mappable BAR %d", index);
+    return nullptr;
 }
 //=================================================================================================
 
@@ -224,6 +131,8 @@ static int getIntegerFromFile(string filename)
 //=================================================================================================
 void PciDevice::close()
 {
+    std::lock_guard<std::mutex> lock(mutex_);
+
     // Loop through each resource slot, and if it's memory mapped, unmap it
     for (auto& resource : resource_)
     {
@@ -232,6 +141,7 @@ void PciDevice::close()
 
     // Delete the list of memory-mapped resources
     resource_.clear();
+    deviceDir_.clear();
 }
 //=================================================================================================
 
@@ -248,12 +158,18 @@ void PciDevice::close()
 //        Each line contains 3 fields separated one space character:
 //           (1) The physical starting address of the memory mapped resource
 //           (2) The physical ending address of the memory mapped resource
-//           (3) A set of flags that we don't care about    
+//           (3) A set of flags, of which we only care about "prefetchable"
+//
+//        Line N describes BAR N
 //=================================================================================================
 std::vector<PciDevice::resource_t> PciDevice::getResourceList(std::string deviceDir)
 {
     string             line;
     vector<resource_t> result;
+    int                index = -1;
+
+    // This is IORESOURCE_PREFETCH from <linux/ioport.h>
+    const uint64_t PREFETCHABLE = 0x2000;
     
     // This file will contain 1 line per potential resource
     string filename = deviceDir + "/resource";
@@ -267,13 +183,19 @@ std::vector<PciDevice::resource_t> PciDevice::getResourceList(std::string device
     // Loop through each line of the file...
     while (getline(file, line))
     {
-        // Get pointers to the 1st and 2nd text fields of that line
+        // Keep track of which BAR this line describes
+        ++index;
+
+        // Get pointers to the 1st, 2nd, and 3rd text fields of that line
         const char* p1 = c(line);
         const char* p2 = strchr(p1, ' ');
+        if (p2 == nullptr) continue;
+        const char* p3 = strchr(p2 + 1, ' ');
         
         // Parse the physical starting and ending address of this memory-mappable resource
         off_t starting_address = strtoll(p1, 0, 0);
         off_t ending_address   = strtoll(p2, 0, 0);
+        uint64_t flags         = p3 ? strtoull(p3, 0, 0) : 0;
 
         // A starting address of 0 means "this line doesn't define a memory-mappable resource"
         if (starting_address == 0) continue;
@@ -282,7 +204,7 @@ std::vector<PciDevice::resource_t> PciDevice::getResourceList(std::string device
         size_t size = ending_address - starting_address + 1;
 
         // Append the description of this mappable resource into our result vector        
-        result.push_back({0, size, starting_address});
+        result.push_back({0, size, starting_address, index, (flags & PREFETCHABLE) != 0});
     }
 
     // If there are no memory-mappable resources, create an error message
@@ -299,64 +221,33 @@ std::vector<PciDevice::resource_t> PciDevice::getResourceList(std::string device
 //=================================================================================================
 // open() - Opens a connection to the specified PCIe device
 //
-// Passed: deviceStr = The vendorID:deviceID of the PCIe device we're looking for
+// Passed: deviceStr = The vendorID:deviceID of the PCIe device we're looking for, or the BDF
+//                     of one specific device
 //         deviceDir = Name of the file-system directory where PCI device information can
 //                     be found.   If empty-string, a sensible default is used
 //=================================================================================================
 void PciDevice::open(string deviceStr, string deviceDir)
 {
-    string  dirName;
-
-    // We have not yet found the device that we're looking for
-    bool found = false;
-
-    // Get a const char* to the name of the device
-    const char* device = deviceStr.c_str();    
-
-    // Extract the Vendor ID from the device string
-    int vendorID = strtoul(device, nullptr, 16);
-
-    // Extract the Device ID from the device string
-    const char* p = strchr(device, ':');
-    if (p == nullptr) throwRuntime("Malformed device ID %s", device);
-    int deviceID = strtoul(p+1, nullptr, 16);
-
     // If we already have a PCIe device mapped, unmap it
     close();
 
     // If the caller didn't specify a device-directory, use the default
-    if (deviceDir.empty()) deviceDir = "/sys/bus/pci/devices";
-
-    // Loop through the entry for each device in the specified directory...
-    for (auto const& entry : fs::directory_iterator(deviceDir)) 
-    {
-        // Ignore any directory entry that isn't itself a directory
-        if (!entry.is_directory()) continue;
-
-        // Fetch the name of the directory that we're about to examine
-        dirName = entry.path().string();
+    if (deviceDir.empty()) deviceDir = PciDiscovery::DEFAULT_DEVICE_DIR;
 
-        // Fetch the vendor ID and device ID of this device
-        int thisVendorID = getIntegerFromFile(dirName + "/vendor");
-        int thisDeviceID = getIntegerFromFile(dirName + "/device");
+    // Find the device the caller is looking for
+    string bdf = PciDiscovery::resolve(deviceStr, deviceDir);
 
-        // If this vendor ID and device ID match the caller's, we have found 
-        // the droid we're looking for.
-        if (thisVendorID == vendorID && thisDeviceID == deviceID)
-        {
-            found = true;
-            break;
-        }
-    }
+    // If we couldn't find it, complain
+    if (bdf.empty()) throwRuntime("No PCI device found for %s", c(deviceStr));
 
-    // If we couldn't find a device with that vendor ID and device ID, complain
-    if (!found) throwRuntime("No PCI device found for vendor=0x%X, device=0x%X", vendorID, deviceID);
+    // This is the directory that contains the files that describe our device
+    string dirName = deviceDir + "/" + bdf;
 
     // Fetch the physical address and size of each resource (i.e. BAR) that our device supports
     resource_ = getResourceList(dirName);
 
-    // Memory map each of the PCI device resources into userspace
-    mapResources();
+    // BARs will be mapped from this directory when they're asked for
+    deviceDir_ = dirName;
 }
 //=================================================================================================
 
@@ -423,20 +314,96 @@ static void writeDeviceFile(string filename, const char* s)
 //=================================================================================================
 
 
+//=================================================================================================
+// readConfig() - Reads a 1, 2, or 4 byte value from a PCI config-space file.  If the read fails,
+//                returns all-ones of that size, which is what a device that isn't there returns.
+//=================================================================================================
+static uint32_t readConfig(int fd, int offset, int size)
+{
+    uint32_t value = 0;
+    if (pread(fd, &value, size, offset) != size) return (size < 4) ? (1u << (8 * size)) - 1 : 0xFFFFFFFF;
+    return value;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// writeConfig() - Writes a 1, 2, or 4 byte value to a PCI config-space file
+//=================================================================================================
+static void writeConfig(int fd, int offset, int size, uint32_t value)
+{
+    if (pwrite(fd, &value, size, offset) != size) throwRuntime("Can't write PCI config-space");
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// findPcieCapability() - Walks the capability list in config-space and returns the offset of the
+//                        PCI Express capability, or 0 if there isn't one
+//=================================================================================================
+static int findPcieCapability(int fd)
+{
+    // If the status register says there's no capability list, we're done
+    if ((readConfig(fd, 0x06, 2) & 0x10) == 0) return 0;
+
+    // Walk the list, being careful not to loop forever on a corrupt one
+    int offset = readConfig(fd, 0x34, 1) & 0xFC;
+    for (int i=0; i<48 && offset; ++i)
+    {
+        if (readConfig(fd, offset, 1) == 0x10) return offset;
+        offset = readConfig(fd, offset + 1, 1) & 0xFC;
+    }
+
+    return 0;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// elapsedUs() - Returns the number of microseconds since "startNs", and resets "startNs" to now
+//=================================================================================================
+static uint32_t elapsedUs(uint64_t& startNs)
+{
+    uint64_t now = nowNs();
+    uint32_t us  = (now - startNs) / 1000;
+    startNs = now;
+    return us;
+}
+//=================================================================================================
+
+
 //=================================================================================================
 // hotReset() - Performs a PCI hot-reset of the specified device
 //
-// Passed: device = vendorID:deviceID
+// Passed: device    = vendorID:deviceID, or the BDF of a specific device
+//         timeoutMs = how long to wait for the link to come up and the device to be ready
+//
+// Rather than sleeping for a fixed amount of time, we wait for the bridge to report that the
+// link is up (if it's able to) and then poll until the device is back on the bus
 //
 // Can throw std::runtime_error
 //=================================================================================================
-void PciDevice::hotReset(string device)
+PciDevice::reset_timing_t PciDevice::hotReset(string device, uint32_t timeoutMs)
 {
-    // Force a rescan for PCI-bus endpoints
-    writeDeviceFile("/sys/bus/pci/rescan", "1\n");
+    reset_timing_t timing = {};
+
+    // In the bridge's Bridge Control register, this is the "Secondary Bus Reset" bit
+    const int BRIDGE_CONTROL = 0x3E, SECONDARY_BUS_RESET = 0x40;
 
-    // Find the BDF that corresponds to this device
-    string bdf = getBDF(device);
+    // In the PCIe capability, these are the "Data Link Layer Link Active" bits
+    const int LINK_CAP = 0x0C, LINK_STATUS = 0x12;
+    const uint32_t DLLLA_REPORTING = 1 << 20, DLLLA = 1 << 13;
+
+    uint64_t startNs = nowNs(), phaseNs = startNs;
+
+    // Find the BDF that corresponds to this device.  If we can't, a rescan might turn it up
+    string bdf = PciDiscovery::resolve(device);
+    if (bdf.empty())
+    {
+        writeDeviceFile("/sys/bus/pci/rescan", "1\n");
+        PciDiscovery::invalidate();
+        bdf = PciDiscovery::resolve(device);
+    }
 
     // If we didn't find the PCI device we are looking for, complain
     if (bdf.empty()) throwRuntime("Can't locate device %s", c(device));
@@ -444,31 +411,73 @@ void PciDevice::hotReset(string device)
     // Find out which PCI bridge this device is attached to
     string port = getPortFromBdf(bdf);
 
-    // Construct the name of the device file that manipulates that port
-    string pdf = "/sys/bus/pci/devices/" + port;
+    // Open the bridge's config-space
+    string pcf = "/sys/bus/pci/devices/" + port + "/config";
+    FileDes bridge = ::open(c(pcf), O_RDWR | O_CLOEXEC);
+    if (bridge < 0) throwRuntime("Can't open %s", c(pcf));
 
-    // Make sure the port device file actually exists
-    if (!fs::exists(pdf)) throwRuntime("Can't find %s", c(pdf));
+    // Find out whether the bridge can tell us when the link is up
+    int pcie = findPcieCapability(bridge);
+    timing.linkPolled = pcie && (readConfig(bridge, pcie + LINK_CAP, 4) & DLLLA_REPORTING);
 
     // Remove our device from its bridge
+    PciDiscovery::invalidate();
     writeDeviceFile("/sys/bus/pci/devices/"+bdf+"/remove", "1\n");
+    timing.removeUs = elapsedUs(phaseNs);
 
-    // Perform the PCI hot-reset
-    run("setpci -s %s BRIDGE_CONTROL=40:40", c(port));
-    usleep(500000);
-    run("setpci -s %s BRIDGE_CONTROL=00:40", c(port));
-    usleep(500000);
+    // Perform the PCI hot-reset.  The spec requires reset to be held for at least 1ms.
+    uint32_t control = readConfig(bridge, BRIDGE_CONTROL, 2);
+    writeConfig(bridge, BRIDGE_CONTROL, 2, control | SECONDARY_BUS_RESET);
+    usleep(2000);
+    writeConfig(bridge, BRIDGE_CONTROL, 2, control & ~SECONDARY_BUS_RESET);
+    timing.resetUs = elapsedUs(phaseNs);
+
+    // This is when we give up
+    uint64_t deadlineNs = phaseNs + timeoutMs * 1000000ULL;
+
+    // Wait for the link to come back up
+    if (timing.linkPolled)
+    {
+        uint32_t status;
+        while ((status = readConfig(bridge, pcie + LINK_STATUS, 2)) == 0xFFFF || !(status & DLLLA))
+        {
+            if (nowNs() > deadlineNs) throwRuntime("Link to %s didn't come up within %u ms", c(bdf), timeoutMs);
+            usleep(1000);
+        }
+        timing.linkUpUs = elapsedUs(phaseNs);
+    }
 
     // Determine the name of the psuedo-file that is used to rescan our PCI bridge
     string pf = "/sys/bus/pci/devices/" + port + "/dev_rescan";
     if (!filesystem::exists(pf)) pf = "/sys/bus/pci/devices/" + port + "/rescan";
 
-    // Rescan our PCI bridge for endpoints
-    writeDeviceFile(pf, "1\n");
+    // Rescan our PCI bridge until the device is back and answering config-space reads.  Until
+    // it is, the vendor ID reads as 0xFFFF, or as 0x0001 while the device is still answering
+    // with Configuration Request Retry Status.
+    string dcf = "/sys/bus/pci/devices/" + bdf + "/config";
+    for (uint32_t backoffUs = 1000; ; backoffUs = std::min(backoffUs * 2, 32000u))
+    {
+        writeDeviceFile(pf, "1\n");
 
-    // Enable bus-mastering from this PCI device
-    run("setpci -s %s COMMAND=0106", c(bdf));
-}
-//=================================================================================================
+        FileDes  fd     = ::open(c(dcf), O_RDWR | O_CLOEXEC);
+        uint32_t vendor = (fd >= 0) ? readConfig(fd, 0, 2) : 0xFFFF;
+        if (vendor != 0xFFFF && vendor != 0x0001)
+        {
+            // Enable memory-space and bus-mastering from this PCI device
+            writeConfig(fd, 0x04, 2, 0x0106);
+            break;
+        }
 
+        if (nowNs() > deadlineNs) throwRuntime("%s didn't come back within %u ms of reset", c(bdf), timeoutMs);
+        usleep(backoffUs);
+    }
+    timing.readyUs = elapsedUs(phaseNs);
+
+    // The rescan may have changed which devices exist
+    PciDiscovery::invalidate();
 
+    // Tell the caller how long it all took
+    timing.totalUs = (nowNs() - startNs) / 1000;
+    return timing;
+}
+//=================================================================================================
@@ -0,0 +1,98 @@
+//=================================================================================================
+// PciDevice.h - Defines a generic class for mapping PCIe devices into user-space
+//=================================================================================================
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <mutex>
+
+class PciDevice
+{
+public:
+   
+    // How long each phase of a hot-reset took, in microseconds
+    struct reset_timing_t
+    {
+        // Removing the device from the kernel's view of the bus
+        uint32_t removeUs;
+
+        // Holding the bridge's secondary bus in reset
+        uint32_t resetUs;
+
+        // Waiting for the link to train after the reset was released
+        uint32_t linkUpUs;
+
+        // Waiting for the device to answer config-space reads and be rediscovered
+        uint32_t readyUs;
+
+        // The whole thing, start to finish
+        uint32_t totalUs;
+
+        // False if the bridge can't report whether the link is up, so linkUpUs is 0
+        bool     linkPolled;
+    };
+
+    // Performs a PCI hot-reset of the specified device, waiting at most "timeoutMs" for it to
+    // come back.  Throws std::runtime_error if it doesn't.
+    static reset_timing_t hotReset(std::string device, uint32_t timeoutMs = 1000);
+
+    // Default constructor
+    PciDevice() {};
+
+    // Destructor
+    ~PciDevice() {close();}
+
+    // No copy or assignment constructor - objects of this class can't be copied
+    PciDevice (const PciDevice&) = delete;
+    PciDevice& operator= (const PciDevice&) = delete;
+
+    // These each describe a memory mapped resource from a PCI device.  "index" is the BAR
+    // number, and "baseAddr" is nullptr until the BAR has been mapped by bar()
+    struct resource_t {uint8_t* baseAddr; size_t size; off_t physAddr; int index; bool prefetchable;};
+
+    // Opens a connection to a PCIe device.  No BARs are mapped until they're asked for.
+    void    open(std::string device, std::string deviceDir = "");
+
+    // Returns the userspace address of the specified BAR, mapping it the first time it's
+    // asked for.  Safe to call from any thread.
+    uint8_t* bar(int index);
+
+    // Prefetchable BARs are mapped write-combined (through resourceN_wc) when this is on
+    void    setWriteCombine(bool flag) {writeCombine_ = flag;}
+
+    // When this is on, BARs are pre-faulted when they're mapped, so the first access to each
+    // page doesn't take a page fault
+    void    setPrefault(bool flag) {prefault_ = flag;}
+
+    // Fetches the list of memory mappable resources
+    std::vector<resource_t>& resourceList() {return resource_;}
+
+    // Returns the sysfs directory of the device we opened
+    std::string deviceDir() {return deviceDir_;}
+    
+    // Stop access to the PCI device
+    void    close();
+
+protected:
+
+
+    // Fetches the list of memory-mappable resources
+    std::vector<resource_t> getResourceList(std::string deviceDir);
+
+    // Memory maps a single resource through its resourceN file in sysfs
+    void mapResource(resource_t& bar);
+
+    // Contains one entry for each resource (i.e, BAR) that is configured in the PCI device
+    std::vector<resource_t> resource_;
+
+    // The sysfs directory of the device, e.g. "/sys/bus/pci/devices/0000:01:00.0"
+    std::string deviceDir_;
+
+    // Serializes the mapping of BARs
+    std::mutex  mutex_;
+
+    // The options that control how BARs are mapped
+    bool        writeCombine_ = false;
+    bool        prefault_     = false;
+};
@@ -0,0 +1,211 @@
+//=================================================================================================
+// PciDiscovery.cpp - Implements a way of finding PCI devices by reading sysfs directly
+//=================================================================================================
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include "PciDiscovery.h"
+
+const char* PciDiscovery::DEFAULT_DEVICE_DIR = "/sys/bus/pci/devices";
+
+// This is one device in the index.  Its device ID isn't read until someone looks for a
+// device with the same vendor ID, since most vendors' devices are never looked for.
+struct pci_entry_t {std::string bdf; long deviceID;};
+
+// This maps a vendor ID to that vendor's devices, in BDF order
+typedef std::unordered_map<uint32_t, std::vector<pci_entry_t>> pci_index_t;
+
+// One index per device directory, and the lock that protects them
+static std::map<std::string, pci_index_t> indexes;
+static std::mutex                         indexLock;
+
+
+//=================================================================================================
+// readHexFile() - Reads a small sysfs file that contains a number such as "0x10ee".  The filename
+//                 is relative to the directory "dirfd".  Returns -1 if the file can't be read.
+//=================================================================================================
+static long readHexFile(int dirfd, const char* filename)
+{
+    char buffer[32];
+
+    int fd = openat(dirfd, filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    int length = read(fd, buffer, sizeof(buffer) - 1);
+    close(fd);
+
+    if (length <= 0) return -1;
+    buffer[length] = 0;
+    return strtol(buffer, nullptr, 0);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// parseId() - Converts "vendorID:deviceID" into (vendorID << 16 | deviceID).  Returns false if
+//             the string is malformed.
+//=================================================================================================
+static bool parseId(std::string device, uint32_t* id)
+{
+    const char* p = strchr(device.c_str(), ':');
+    if (p == nullptr) return false;
+
+    uint32_t vendorID = strtoul(device.c_str(), nullptr, 16);
+    uint32_t deviceID = strtoul(p+1, nullptr, 16);
+
+    *id = (vendorID << 16) | deviceID;
+    return true;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// buildIndex() - Reads the vendor ID of every device in "deviceDir"
+//=================================================================================================
+static pci_index_t buildIndex(const std::string& deviceDir)
+{
+    pci_index_t index;
+    char        filename[NAME_MAX + 16];
+
+    DIR* dir = opendir(deviceDir.c_str());
+    if (dir == nullptr) return index;
+
+    // Loop through every entry in the directory
+    while (dirent* entry = readdir(dir))
+    {
+        // Skip "." and ".."
+        if (entry->d_name[0] == '.') continue;
+
+        // Fetch the vendor ID of this device
+        snprintf(filename, sizeof filename, "%s/vendor", entry->d_name);
+        long vendorID = readHexFile(::dirfd(dir), filename);
+
+        // If this isn't a device, ignore it
+        if (vendorID < 0) continue;
+
+        // Add this device to the index
+        index[vendorID].push_back({entry->d_name, -1});
+    }
+
+    closedir(dir);
+
+    // Within each vendor, the devices are in BDF order
+    for (auto& it : index) std::sort(it.second.begin(), it.second.end(),
+        [](const pci_entry_t& a, const pci_entry_t& b) {return a.bdf < b.bdf;});
+
+    return index;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// find() - Returns the BDF of every device that matches "vendorID:deviceID"
+//=================================================================================================
+std::vector<std::string> PciDiscovery::find(std::string device, std::string deviceDir)
+{
+    uint32_t id;
+
+    // If the caller didn't specify a device-directory, use the default
+    if (deviceDir.empty()) deviceDir = DEFAULT_DEVICE_DIR;
+
+    // If the device name is malformed, nothing matches it
+    if (!parseId(device, &id)) return {};
+
+    std::lock_guard<std::mutex> lock(indexLock);
+
+    // If we haven't indexed this directory yet, do so
+    auto it = indexes.find(deviceDir);
+    if (it == indexes.end()) it = indexes.emplace(deviceDir, buildIndex(deviceDir)).first;
+
+    // Find the devices from this vendor
+    std::vector<std::string> result;
+    auto vendor = it->second.find(id >> 16);
+    if (vendor == it->second.end()) return result;
+
+    // And return the ones with the right device ID, fetching the ones we don't know yet
+    int dirfd = -1;
+    for (auto& entry : vendor->second)
+    {
+        if (entry.deviceID < 0)
+        {
+            if (dirfd < 0) dirfd = open(deviceDir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            entry.deviceID = readHexFile(dirfd, (entry.bdf + "/device").c_str());
+        }
+        if (entry.deviceID == (long)(id & 0xFFFF)) result.push_back(entry.bdf);
+    }
+    if (dirfd >= 0) close(dirfd);
+
+    return result;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// resolve() - Returns the BDF of the device named by "device"
+//=================================================================================================
+std::string PciDiscovery::resolve(std::string device, std::string deviceDir)
+{
+    // If the caller didn't specify a device-directory, use the default
+    if (deviceDir.empty()) deviceDir = DEFAULT_DEVICE_DIR;
+
+    // If we've been handed a BDF, it just has to exist
+    if (isBdf(device))
+    {
+        return access((deviceDir + "/" + device).c_str(), F_OK) == 0 ? device : "";
+    }
+
+    // Otherwise, it's the first device that matches the vendor and device ID
+    std::vector<std::string> bdf = find(device, deviceDir);
+    return bdf.empty() ? "" : bdf[0];
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// driverOf() - Returns the name of the driver the device is bound to.  In sysfs, "driver" is a
+//              symlink to the driver's directory, whose name is the name of the driver.
+//=================================================================================================
+std::string PciDiscovery::driverOf(std::string bdf, std::string deviceDir)
+{
+    char link[PATH_MAX];
+
+    // If the caller didn't specify a device-directory, use the default
+    if (deviceDir.empty()) deviceDir = DEFAULT_DEVICE_DIR;
+
+    // If there's no "driver" symlink, the device isn't bound to a driver
+    int length = readlink((deviceDir + "/" + bdf + "/driver").c_str(), link, sizeof(link) - 1);
+    if (length < 0) return "";
+    link[length] = 0;
+
+    // The driver name is the last component of the target
+    const char* name = strrchr(link, '/');
+    return name ? name + 1 : link;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// invalidate() - Throws away every index we've built
+//=================================================================================================
+void PciDiscovery::invalidate()
+{
+    std::lock_guard<std::mutex> lock(indexLock);
+    indexes.clear();
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// isBdf() - A BDF looks like "0000:01:00.0", a vendor:device ID looks like "10ee:903f"
+//=================================================================================================
+bool PciDiscovery::isBdf(std::string device)
+{
+    return device.find('.') != std::string::npos;
+}
+//=================================================================================================
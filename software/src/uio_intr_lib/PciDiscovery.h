@@ -0,0 +1,45 @@
+//=================================================================================================
+// PciDiscovery.h - Defines a way of finding PCI devices by vendor and device ID, by reading sysfs
+//                  directly, without running any external programs
+//=================================================================================================
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+//-------------------------------------------------------------------
+// The first lookup in a device directory reads the vendor ID of
+// every device in it and builds an index from vendor to BDFs.  The
+// device IDs of a vendor's devices are read the first time that
+// vendor is looked up.  Every lookup after that is served from the
+// index.
+//
+// Anywhere a device is named, it can either be "vendorID:deviceID",
+// which means the first such device (in BDF order), or a BDF such as
+// "0000:01:00.0", which names one card out of several identical ones.
+//-------------------------------------------------------------------
+class PciDiscovery
+{
+public:
+
+    // This is the directory that the devices live in unless the caller says otherwise
+    static const char* DEFAULT_DEVICE_DIR;
+
+    // Returns the BDF of every device that matches "vendorID:deviceID", in BDF order
+    static std::vector<std::string> find(std::string device, std::string deviceDir = "");
+
+    // Returns the BDF of the device named by "device" (either "vendorID:deviceID" or a BDF),
+    // or an empty string if there isn't one
+    static std::string resolve(std::string device, std::string deviceDir = "");
+
+    // Returns the name of the driver that the device is bound to, or an empty string
+    static std::string driverOf(std::string bdf, std::string deviceDir = "");
+
+    // Throws away every index we've built, so that the next lookup re-reads sysfs.  Call this
+    // after devices have been added or removed, e.g. after a PCI rescan
+    static void invalidate();
+
+    // Returns true if "device" is a BDF rather than "vendorID:deviceID"
+    static bool isBdf(std::string device);
+};
+//-------------------------------------------------------------------
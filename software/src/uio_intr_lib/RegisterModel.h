@@ -0,0 +1,28 @@
+//=================================================================================================
+// RegisterModel.h - Defines the interface to a software model of a block of AXI registers
+//=================================================================================================
+#pragma once
+#include <stdint.h>
+
+//-------------------------------------------------------------------
+// A driver that's been pointed at one of these calls readReg() and
+// writeReg() instead of touching memory-mapped registers, so that
+// registers with side-effects (read-to-clear, write-to-strobe, etc)
+// can be modeled in software.
+//
+// Register indices are the same 32-bit word indices the driver 
+// would use on the memory-mapped registers.
+//-------------------------------------------------------------------
+class RegisterModel
+{
+public:
+
+    virtual ~RegisterModel() {}
+
+    // Performs the equivalent of an AXI read of the register at "index"
+    virtual uint32_t readReg(int index) = 0;
+
+    // Performs the equivalent of an AXI write of "value" to the register at "index"
+    virtual void     writeReg(int index, uint32_t value) = 0;
+};
+//-------------------------------------------------------------------
@@ -0,0 +1,87 @@
+//=================================================================================================
+// SpscRing.h - Defines a lock-free, fixed-capacity, single-producer/single-consumer ring buffer
+//=================================================================================================
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+//-------------------------------------------------------------------
+// Exactly one thread may call push() and exactly one thread may 
+// call pop().  Neither of them ever blocks or takes a lock.
+//
+// The producer and consumer indices live on separate cache lines,
+// and each side keeps a private copy of the other side's index so
+// that it only has to touch the other side's cache line when the
+// ring looks full (or empty).
+//-------------------------------------------------------------------
+template <class T> class SpscRing
+{
+public:
+
+    // Capacity is rounded up to the next power of 2
+    explicit SpscRing(uint32_t capacity)
+    {
+        uint32_t size = 1;
+        while (size < capacity) size <<= 1;
+        slot_.resize(size);
+        mask_ = size - 1;
+    }
+
+    // No copy or assignment constructor - objects of this class can't be copied
+    SpscRing (const SpscRing&) = delete;
+    SpscRing& operator= (const SpscRing&) = delete;
+
+    // Producer side: returns false if the ring is full
+    bool push(const T& value)
+    {
+        uint32_t tail = tail_.load(std::memory_order_relaxed);
+
+        // If the ring looks full, find out where the consumer really is
+        if (tail - cachedHead_ > mask_)
+        {
+            cachedHead_ = head_.load(std::memory_order_acquire);
+            if (tail - cachedHead_ > mask_) return false;
+        }
+
+        slot_[tail & mask_] = value;
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side: returns false if the ring is empty
+    bool pop(T& value)
+    {
+        uint32_t head = head_.load(std::memory_order_relaxed);
+
+        // If the ring looks empty, find out where the producer really is
+        if (head == cachedTail_)
+        {
+            cachedTail_ = tail_.load(std::memory_order_acquire);
+            if (head == cachedTail_) return false;
+        }
+
+        value = slot_[head & mask_];
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Can be called from either side
+    bool     empty()    {return head_.load() == tail_.load();}
+    uint32_t capacity() {return mask_ + 1;}
+
+protected:
+
+    // The consumer's index, and its copy of the producer's index
+    alignas(64) std::atomic<uint32_t> head_{0};
+    uint32_t cachedTail_ = 0;
+
+    // The producer's index, and its copy of the consumer's index
+    alignas(64) std::atomic<uint32_t> tail_{0};
+    uint32_t cachedHead_ = 0;
+
+    // The storage for the ring
+    alignas(64) std::vector<T> slot_;
+    uint32_t mask_;
+};
+//-------------------------------------------------------------------
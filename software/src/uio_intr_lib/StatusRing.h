@@ -0,0 +1,38 @@
+//=================================================================================================
+// StatusRing.h - Defines the status records that the interrupt controller DMAs into host memory
+//
+// When status writeback is enabled, the controller doesn't wait for the host to read the pending
+// register and the counters.  Instead, whenever it would assert IRQ_REQ, it takes a snapshot of
+// the pending bitmap and the counters of the pending IRQs (clearing those counters, just as a
+// read of them would), writes that snapshot into the next slot of a ring in host memory, and
+// then interrupts the host.  The host services the records straight out of its cache, and hands
+// the slots back with a single posted write of the last sequence number it consumed.
+//
+// The controller never overwrites a slot the host hasn't consumed yet: if the ring is full, the
+// counters keep counting until there's room.  IRQ_REQ stays asserted for as long as the ring
+// holds records that the host hasn't consumed.
+//
+// The registers that control writeback are REG_STATUS_ADDR_LO/HI, REG_STATUS_SLOTS and
+// REG_STATUS_CONSUMED (registers 4-7), alongside the controller's other registers.
+//=================================================================================================
+#pragma once
+#include <stdint.h>
+
+//-------------------------------------------------------------------
+// This is one slot of the status ring.  The producer writes the
+// sequence number last, so a record whose sequence number is the
+// one the consumer is expecting is complete.  Sequence numbers
+// start at 1, so a zeroed ring contains no records.
+//-------------------------------------------------------------------
+struct alignas(64) intr_status_t
+{
+    // The number of interrupts counted on each IRQ since the last record
+    uint32_t count[32];
+
+    // The bitmap of IRQs that have a non-zero count
+    uint32_t pending;
+
+    // Record "n" lives in slot (n - 1) % slots
+    uint32_t seq;
+};
+//-------------------------------------------------------------------
@@ -0,0 +1,225 @@
+//=================================================================================================
+// Telemetry.cpp - Implements a shared-memory segment that interrupt statistics are published into
+//=================================================================================================
+#include <unistd.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <stdexcept>
+#include "Telemetry.h"
+#include "CpuUtil.h"
+#include "Futex.h"
+
+
+//=================================================================================================
+// throwRuntime() - Throws a runtime exception
+//=================================================================================================
+static void throwRuntime(const char* fmt, ...)
+{
+    char buffer[1024];
+    va_list ap;
+    va_start(ap, fmt);
+    vsprintf(buffer, fmt, ap);
+    va_end(ap);
+
+    throw std::runtime_error(buffer);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// defaultName() - Returns the name of the segment that a process publishes into by default
+//=================================================================================================
+std::string Telemetry::defaultName(int pid)
+{
+    return "intr_telemetry." + std::to_string(pid);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// open() - Creates the segment and fills in its header
+//=================================================================================================
+void Telemetry::open(std::string name)
+{
+    // If we already have a segment, get rid of it
+    close();
+
+    if (name.empty()) name = defaultName(getpid());
+    std::string path = "/dev/shm/" + name;
+
+    // Create the file that backs the segment, and make it big enough
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) throwRuntime("Can't create %s", path.c_str());
+    if (ftruncate(fd, sizeof(telemetry_segment_t)) < 0)
+    {
+        ::close(fd);
+        unlink(path.c_str());
+        throwRuntime("Can't size %s", path.c_str());
+    }
+
+    // Map it.  MAP_POPULATE means the dispatch path never takes a page fault on it.
+    void* ptr = mmap(0, sizeof(telemetry_segment_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    ::close(fd);
+    if (ptr == MAP_FAILED)
+    {
+        unlink(path.c_str());
+        throwRuntime("Can't map %s", path.c_str());
+    }
+
+    segment_ = (telemetry_segment_t*)ptr;
+    name_    = name;
+
+    // Fill in the header.  The magic number goes last, so a reader that sees it sees the rest.
+    segment_->version = TELEMETRY_VERSION;
+    segment_->pid     = getpid();
+    segment_->startNs = nowNs();
+    FILE* file = fopen("/proc/self/comm", "r");
+    if (file)
+    {
+        if (fgets(segment_->process, sizeof(segment_->process), file))
+        {
+            segment_->process[strcspn(segment_->process, "\n")] = 0;
+        }
+        fclose(file);
+    }
+    __atomic_store_n(&segment_->magic, TELEMETRY_MAGIC, __ATOMIC_RELEASE);
+
+    // Start publishing
+    stopping_ = false;
+    thread_   = std::thread(&Telemetry::run, this);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// close() - Unmaps and removes the segment
+//=================================================================================================
+void Telemetry::close()
+{
+    if (segment_ == nullptr) return;
+
+    // Stop publishing into it
+    stopping_ = true;
+    ++wake_;
+    futexWake(&wake_);
+    thread_.join();
+
+    for (auto& handler : handler_) handler = nullptr;
+    for (auto& uio     : uio_    ) uio     = nullptr;
+
+    munmap(segment_, sizeof(telemetry_segment_t));
+    unlink(("/dev/shm/" + name_).c_str());
+    segment_ = nullptr;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// addDevice() - Gives a device a slot and starts publishing into it
+//=================================================================================================
+int Telemetry::addDevice(std::string name, IntrControlBase* handler, UioInterface* uio)
+{
+    if (segment_ == nullptr) throwRuntime("Telemetry::addDevice() called before open()");
+
+    int slot = segment_->deviceCount;
+    if (slot >= (int)TELEMETRY_MAX_DEVICES) throwRuntime("No room in telemetry for %s", name.c_str());
+
+    // Fill in the parts of the slot that never change
+    telemetry_device_t& device = segment_->device[slot];
+    strncpy(device.name, name.c_str(), sizeof(device.name) - 1);
+    device.hasMonitor  = (uio != nullptr);
+    device.monitor.cpu = uio ? uio->getPlacement().requested.cpu : -1;
+    device.inUse       = 1;
+    handler_[slot]     = handler;
+    uio_[slot]         = uio;
+
+    // Publish what we know so far.  Once the slot is counted, the publishing thread keeps it
+    // up to date.
+    publish(slot);
+    __atomic_store_n(&segment_->deviceCount, slot + 1, __ATOMIC_RELEASE);
+    return slot;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// publish() - Copies the device's statistics into its slot, under the slot's seqlock
+//=================================================================================================
+void Telemetry::publish(int slot)
+{
+    IntrControlBase*    handler = handler_[slot];
+    UioInterface*       uio     = uio_[slot];
+    telemetry_device_t& device  = segment_->device[slot];
+
+    // Gather everything up before we start writing, so that the seqlock is held briefly
+    IntrControlBase::irq_snapshot_t   snapshot = handler->getIrqSnapshot();
+    IntrControlBase::dispatch_stats_t dispatch = handler->getDispatchStats();
+    bool latency = handler->isTrackingLatency();
+
+    // Readers that see an odd sequence number, or see it change, will try again
+    uint32_t seq = device.seq;
+    __atomic_store_n(&device.seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    device.updateNs        = snapshot.timeNs;
+    device.rateTauNs       = handler->getRateTimeConstant() * 1e6;
+    device.wakeups         = dispatch.wakeups;
+    device.spurious        = dispatch.spurious;
+    device.passes          = dispatch.passes;
+    device.isrCalls        = dispatch.isrCalls;
+    device.interrupts      = dispatch.interrupts;
+    device.budgetExhausted = dispatch.budgetExhausted;
+
+    for (int i=0; i<32; ++i)
+    {
+        device.irq[i].total       = snapshot.total[i];
+        device.irq[i].saturations = snapshot.saturations[i];
+        device.irq[i].rate        = snapshot.rate[i];
+    }
+
+    device.latencyTracking = latency;
+    if (latency)
+    {
+        device.wakeToPending = handler->getLatency(IntrControlBase::STAGE_WAKE_TO_PENDING);
+        device.reenable      = handler->getLatency(IntrControlBase::STAGE_REENABLE);
+        device.total         = handler->getLatency(IntrControlBase::STAGE_TOTAL);
+    }
+
+    if (uio)
+    {
+        UioInterface::monitor_stats_t monitor = uio->getMonitorStats();
+        device.monitor.mode            = monitor.config.mode;
+        device.monitor.ioUring         = monitor.ioUring;
+        device.monitor.blockingWakeups = monitor.blockingWakeups;
+        device.monitor.spinDispatches  = monitor.spinDispatches;
+        device.monitor.emptyPolls      = monitor.emptyPolls;
+        device.monitor.spinNs          = monitor.spinNs;
+        device.monitor.reconnects      = monitor.reconnects;
+        device.monitor.lastReconnectUs = monitor.lastReconnectUs;
+        device.monitor.syscalls        = monitor.syscalls;
+    }
+
+    __atomic_store_n(&device.seq, seq + 2, __ATOMIC_RELEASE);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// run() - Publishes every device's statistics every PUBLISH_INTERVAL_MS, until close() is called
+//=================================================================================================
+void Telemetry::run()
+{
+    while (!stopping_)
+    {
+        uint32_t wake  = wake_;
+        uint32_t count = __atomic_load_n(&segment_->deviceCount, __ATOMIC_ACQUIRE);
+
+        for (uint32_t slot=0; slot<count; ++slot) publish(slot);
+
+        futexWait(&wake_, wake, PUBLISH_INTERVAL_MS * 1000000ULL);
+    }
+}
+//=================================================================================================
@@ -0,0 +1,183 @@
+//=================================================================================================
+// Telemetry.h - Defines a shared-memory segment in /dev/shm that a process publishes its interrupt
+//               statistics into, so that other processes (e.g. intr_top) can watch them
+//=================================================================================================
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <atomic>
+#include <thread>
+#include "IntrControlBase.h"
+#include "UioInterface.h"
+#include "LatencyHistogram.h"
+
+// This identifies a telemetry segment, and the version of the layout below.  Any change to the
+// layout must change TELEMETRY_VERSION.
+enum : uint32_t
+{
+    TELEMETRY_MAGIC       = 0x52544E49,     // "INTR"
+    TELEMETRY_VERSION     = 1,
+    TELEMETRY_MAX_DEVICES = 16
+};
+
+//-------------------------------------------------------------------
+// The statistics of one IRQ
+//-------------------------------------------------------------------
+struct telemetry_irq_t
+{
+    // The sum of every count delivered, and how many of them came from a saturated counter
+    uint64_t    total;
+    uint64_t    saturations;
+
+    // Moving average of the rate, in interrupts per second
+    double      rate;
+};
+//-------------------------------------------------------------------
+
+
+//-------------------------------------------------------------------
+// What the monitor thread of a device has been doing
+//-------------------------------------------------------------------
+struct telemetry_monitor_t
+{
+    // A UioInterface::monitor_mode_t, the CPU the monitor was asked to run on (or -1), and
+    // whether the wait/re-enable cycle goes through an io_uring
+    int32_t     mode;
+    int32_t     cpu;
+    int32_t     ioUring;
+    int32_t     reserved;
+
+    // The same as in UioInterface::monitor_stats_t
+    uint64_t    blockingWakeups;
+    uint64_t    spinDispatches;
+    uint64_t    emptyPolls;
+    uint64_t    spinNs;
+    uint64_t    reconnects;
+    uint64_t    lastReconnectUs;
+    uint64_t    syscalls;
+};
+//-------------------------------------------------------------------
+
+
+//-------------------------------------------------------------------
+// Everything published about one device.  It's written under a
+// seqlock: "seq" is odd while the rest is being written, and a
+// reader whose copy started and ended with the same even "seq"
+// has a consistent copy.
+//-------------------------------------------------------------------
+struct alignas(64) telemetry_device_t
+{
+    uint32_t    seq;
+
+    // Non-zero once this slot has been given to a device
+    uint32_t    inUse;
+
+    // The name the device was registered with
+    char        name[64];
+
+    // When this was last written (CLOCK_MONOTONIC nanoseconds), and the time constant of the rates
+    uint64_t    updateNs;
+    double      rateTauNs;
+
+    // The same as in IntrControlBase::dispatch_stats_t
+    uint64_t    wakeups;
+    uint64_t    spurious;
+    uint64_t    passes;
+    uint64_t    isrCalls;
+    uint64_t    interrupts;
+    uint64_t    budgetExhausted;
+
+    // If latency tracking is on, the summaries of the stages that aren't tracked per IRQ
+    uint32_t    latencyTracking;
+    uint32_t    hasMonitor;
+    latency_summary_t wakeToPending;
+    latency_summary_t reenable;
+    latency_summary_t total;
+
+    // Only meaningful if "hasMonitor" is non-zero
+    telemetry_monitor_t monitor;
+
+    telemetry_irq_t irq[32];
+};
+//-------------------------------------------------------------------
+
+
+//-------------------------------------------------------------------
+// The layout of the whole segment
+//-------------------------------------------------------------------
+struct telemetry_segment_t
+{
+    uint32_t    magic;
+    uint32_t    version;
+
+    // The process that owns the segment, and when it created it (CLOCK_MONOTONIC nanoseconds)
+    int32_t     pid;
+    uint32_t    deviceCount;
+    uint64_t    startNs;
+    char        process[64];
+
+    telemetry_device_t device[TELEMETRY_MAX_DEVICES];
+};
+//-------------------------------------------------------------------
+
+
+//-------------------------------------------------------------------
+// A thread of our own writes every device's slot every 100 ms,
+// whether or not interrupts are arriving, so that a quiet device's
+// rates decay and its monitor statistics stay current.  It only
+// reads statistics that the dispatch path already keeps, so it
+// never makes topLevelHandler() wait, and readers only ever read
+// memory, so watching a process costs it nothing.
+//
+// The handlers and interfaces given to addDevice() have to outlive
+// the segment (or close() has to be called before they go away).
+//-------------------------------------------------------------------
+class Telemetry
+{
+public:
+
+    // Default constructor
+    Telemetry() {}
+
+    // Destructor - Removes the segment
+    ~Telemetry() {close();}
+
+    // No copy or assignment constructor - objects of this class can't be copied
+    Telemetry (const Telemetry&) = delete;
+    Telemetry& operator= (const Telemetry&) = delete;
+
+    // Creates the segment /dev/shm/<name>.  The default name is defaultName(getpid()).
+    void        open(std::string name = "");
+
+    // Stops publishing, and unmaps and removes the segment
+    void        close();
+
+    // Returns the name of the segment a process publishes into by default
+    static std::string defaultName(int pid);
+
+    // Gives a device a slot in the segment, and starts publishing the statistics of "handler"
+    // into it.  If the device's interrupts are monitored by "uio", its monitor statistics are
+    // published too.  Returns the slot number.
+    int         addDevice(std::string name, IntrControlBase* handler, UioInterface* uio = nullptr);
+
+protected:
+
+    // How often every slot is published
+    enum {PUBLISH_INTERVAL_MS = 100};
+
+    // Writes the current statistics of the device in "slot" into the segment
+    void        publish(int slot);
+
+    // The thread that publishes every slot every PUBLISH_INTERVAL_MS
+    void        run();
+    std::thread           thread_;
+    std::atomic<uint32_t> wake_{0};
+    std::atomic<bool>     stopping_{false};
+
+    // The segment, its name, and what each slot publishes
+    telemetry_segment_t* segment_ = nullptr;
+    std::string          name_;
+    IntrControlBase*     handler_[TELEMETRY_MAX_DEVICES] = {};
+    UioInterface*        uio_[TELEMETRY_MAX_DEVICES] = {};
+};
+//-------------------------------------------------------------------
@@ -0,0 +1,286 @@
+//=================================================================================================
+// ThreadPlacement.cpp - Functions for pinning a thread to a CPU, giving it a real-time scheduling
+//                       policy, steering a device's host interrupt to a CPU, and placing memory
+//                       on the NUMA node that a device is attached to
+//=================================================================================================
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <new>
+#include "ThreadPlacement.h"
+
+
+//=================================================================================================
+// applyThreadPlacement() - Pins the calling thread to a CPU and applies its scheduling policy
+//
+// Returns: An empty string on success, otherwise a description of what went wrong
+//=================================================================================================
+std::string applyThreadPlacement(const thread_placement_t& placement)
+{
+    char        buffer[256];
+    std::string errors;
+
+    // If the caller wants this thread pinned to a specific CPU, do so
+    if (placement.cpu >= 0)
+    {
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        CPU_SET(placement.cpu, &cpuset);
+        int err = pthread_setaffinity_np(pthread_self(), sizeof cpuset, &cpuset);
+        if (err)
+        {
+            sprintf(buffer, "can't pin thread to CPU %d: %s; ", placement.cpu, strerror(err));
+            errors += buffer;
+        }
+    }
+
+    // If the caller wants a scheduling policy other than the default, apply it
+    if (placement.policy != SCHED_OTHER || placement.priority != 0)
+    {
+        sched_param param = {};
+        param.sched_priority = placement.priority;
+        int err = pthread_setschedparam(pthread_self(), placement.policy, &param);
+        if (err)
+        {
+            sprintf(buffer, "can't set scheduling policy %d priority %d: %s; ",
+                    placement.policy, placement.priority, strerror(err));
+            errors += buffer;
+        }
+    }
+
+    return errors;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// steerHostIrq() - Writes "cpu" to /proc/irq/<hostIrq>/smp_affinity_list
+//
+// Returns: An empty string on success, otherwise a description of what went wrong
+//=================================================================================================
+std::string steerHostIrq(int hostIrq, int cpu)
+{
+    char filename[64], value[16], buffer[256];
+
+    // If we don't know what the host IRQ is, we can't steer it
+    if (hostIrq < 0) return "can't determine the host IRQ of the device; ";
+
+    // Open the psuedo-file that determines which CPUs service this IRQ
+    sprintf(filename, "/proc/irq/%d/smp_affinity_list", hostIrq);
+    int fd = open(filename, O_WRONLY);
+    if (fd < 0)
+    {
+        sprintf(buffer, "can't open %s: %s; ", filename, strerror(errno));
+        return buffer;
+    }
+
+    // And tell the kernel which CPU we want this IRQ serviced by
+    int length = sprintf(value, "%d\n", cpu);
+    if (write(fd, value, length) != length)
+    {
+        sprintf(buffer, "can't steer IRQ %d to CPU %d: %s; ", hostIrq, cpu, strerror(errno));
+        close(fd);
+        return buffer;
+    }
+
+    // We're done
+    close(fd);
+    return "";
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// readLine() - Returns the first line of a file (minus the linefeed), or an empty string
+//=================================================================================================
+static std::string readLine(const char* filename)
+{
+    char buffer[256] = {0};
+
+    FILE* fp = fopen(filename, "r");
+    if (fp == nullptr) return "";
+    if (!fgets(buffer, sizeof buffer, fp)) buffer[0] = 0;
+    fclose(fp);
+
+    // Chop the linefeed off the end
+    char* p = strchr(buffer, 10); if (p) *p = 0;
+    return buffer;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// getUioHostIrq() - Returns the host IRQ of the device at /dev/uio<uioIndex>, or -1
+//=================================================================================================
+int getUioHostIrq(int uioIndex)
+{
+    char filename[64];
+    sprintf(filename, "/sys/class/uio/uio%d/device/irq", uioIndex);
+    std::string line = readLine(filename);
+    return line.empty() ? -1 : atoi(line.c_str());
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// queryPlacement() - Fills in "status" with the current placement of thread "tid" and "hostIrq"
+//
+// We go by kernel thread ID rather than pthread_t: if the thread has exited, asking about it
+// simply fails, where a pthread_t of an exited thread can't be used at all.
+//=================================================================================================
+void queryPlacement(pid_t tid, int hostIrq, placement_status_t& status)
+{
+    cpu_set_t   cpuset;
+    sched_param param;
+    char        filename[64];
+
+    // Find out which CPUs the thread is allowed to run on
+    status.cpus.clear();
+    if (sched_getaffinity(tid, sizeof cpuset, &cpuset) == 0)
+    {
+        for (int cpu=0; cpu<CPU_SETSIZE; ++cpu) if (CPU_ISSET(cpu, &cpuset)) status.cpus.push_back(cpu);
+    }
+
+    // Find out what the thread's scheduling policy is
+    status.policy = sched_getscheduler(tid);
+    if (status.policy >= 0 && sched_getparam(tid, &param) == 0)
+        status.priority = param.sched_priority;
+    else
+        status.policy = status.priority = -1;
+
+    // Find out which CPUs the kernel delivers the host IRQ to
+    status.hostIrq = hostIrq;
+    status.irqAffinity.clear();
+    if (hostIrq >= 0)
+    {
+        sprintf(filename, "/proc/irq/%d/effective_affinity_list", hostIrq);
+        status.irqAffinity = readLine(filename);
+        if (status.irqAffinity.empty())
+        {
+            sprintf(filename, "/proc/irq/%d/smp_affinity_list", hostIrq);
+            status.irqAffinity = readLine(filename);
+        }
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// getPciNumaNode() - Returns the NUMA node of a PCI device, or -1
+//=================================================================================================
+int getPciNumaNode(std::string bdf)
+{
+    std::string line = readLine(("/sys/bus/pci/devices/" + bdf + "/numa_node").c_str());
+    return line.empty() ? -1 : atoi(line.c_str());
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// parseCpuList() - Converts a CPU list such as "0-3,8,10-11" into a list of CPU numbers
+//=================================================================================================
+std::vector<int> parseCpuList(std::string list)
+{
+    std::vector<int> cpus;
+    const char*      p = list.c_str();
+
+    while (*p)
+    {
+        // Each comma-separated entry is either a single CPU or a range of CPUs
+        char* end;
+        int first = strtol(p, &end, 10);
+        if (end == p) break;
+        int last = (*end == '-') ? strtol(end + 1, &end, 10) : first;
+        for (int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+
+        // Skip over the comma
+        p = (*end == ',') ? end + 1 : end;
+    }
+
+    return cpus;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// getPciLocalCpus() - Returns the CPUs that are local to a PCI device
+//=================================================================================================
+std::vector<int> getPciLocalCpus(std::string bdf)
+{
+    std::vector<int> cpus = parseCpuList(readLine(("/sys/bus/pci/devices/" + bdf + "/local_cpulist").c_str()));
+    if (cpus.empty()) cpus = parseCpuList(readLine("/sys/devices/system/cpu/online"));
+    return cpus;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// allocateOnNode() - Allocates memory whose pages live on the specified NUMA node
+//
+// We map the memory, set a "preferred node" policy on it with mbind(), and then touch every page
+// so that they're all allocated (on that node) before anybody uses them.
+//=================================================================================================
+void* allocateOnNode(size_t size, int node)
+{
+    // These are from <linux/mempolicy.h>
+    const int MPOL_PREFERRED = 1;
+
+    void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) throw std::bad_alloc();
+
+    // If the caller cares which node this memory is on, tell the kernel.  If this fails (say,
+    // because the kernel was built without NUMA support), the memory is still usable.
+    if (node >= 0 && node < 64)
+    {
+        unsigned long nodemask = 1UL << node;
+        syscall(SYS_mbind, ptr, size, MPOL_PREFERRED, &nodemask, 64, 0);
+    }
+
+    // Fault in every page now, so that they're allocated according to the policy
+    memset(ptr, 0, size);
+    return ptr;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// freeOnNode() - Frees memory that came from allocateOnNode()
+//=================================================================================================
+void freeOnNode(void* ptr, size_t size)
+{
+    if (ptr) munmap(ptr, size);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// bindThreadToNode() - Keeps the calling thread, and the memory it touches, on one NUMA node
+//
+// malloc() hands a new thread an arena of its own, whose pages are faulted in by the thread that
+// first touches them, so this is what puts ordinary heap allocations on the node.
+//=================================================================================================
+void bindThreadToNode(int node, const std::vector<int>& cpus)
+{
+    // These are from <linux/mempolicy.h>
+    const int MPOL_PREFERRED = 1;
+
+    if (!cpus.empty())
+    {
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        for (int cpu : cpus) if (cpu >= 0 && cpu < CPU_SETSIZE) CPU_SET(cpu, &cpuset);
+        sched_setaffinity(0, sizeof cpuset, &cpuset);
+    }
+
+    if (node >= 0 && node < 64)
+    {
+        unsigned long nodemask = 1UL << node;
+        syscall(SYS_set_mempolicy, MPOL_PREFERRED, &nodemask, 64);
+    }
+}
+//=================================================================================================
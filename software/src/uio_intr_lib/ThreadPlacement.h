@@ -0,0 +1,93 @@
+//=================================================================================================
+// ThreadPlacement.h - Functions for pinning a thread to a CPU, giving it a real-time scheduling
+//                     policy, steering a device's host interrupt to a CPU, and placing memory on
+//                     the NUMA node that a device is attached to
+//=================================================================================================
+#pragma once
+#include <stddef.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <string>
+#include <vector>
+
+//-------------------------------------------------------------------
+// This describes where a thread (and the host IRQ that wakes it)
+// should run
+//-------------------------------------------------------------------
+struct thread_placement_t
+{
+    // The CPU to pin the thread to, or -1 to leave the thread's affinity alone
+    int     cpu = -1;
+
+    // The scheduling policy (SCHED_OTHER, SCHED_FIFO or SCHED_RR) and its priority
+    int     policy = SCHED_OTHER;
+    int     priority = 0;
+
+    // The CPU to steer the device's host IRQ to, -1 to leave it alone, or IRQ_SAME_CPU to
+    // steer it to the same CPU as the thread
+    int     irqCpu = -1;
+    enum   {IRQ_SAME_CPU = -2};
+};
+//-------------------------------------------------------------------
+
+
+//-------------------------------------------------------------------
+// This describes the placement that's actually in effect
+//-------------------------------------------------------------------
+struct placement_status_t
+{
+    // What was asked for
+    thread_placement_t requested;
+
+    // The CPUs the thread is allowed to run on
+    std::vector<int>   cpus;
+
+    // The thread's scheduling policy and priority
+    int                policy;
+    int                priority;
+
+    // The host IRQ number of the device (or -1 if unknown) and the CPUs it's delivered to
+    int                hostIrq;
+    std::string        irqAffinity;
+};
+//-------------------------------------------------------------------
+
+// Applies the CPU affinity and scheduling policy to the calling thread.  Returns a 
+// description of each thing that couldn't be applied, or an empty string on success
+std::string applyThreadPlacement(const thread_placement_t& placement);
+
+// Steers the host IRQ to the specified CPU.  Returns a description of the error or an
+// empty string on success
+std::string steerHostIrq(int hostIrq, int cpu);
+
+// Returns the host IRQ of the device at /dev/uio<uioIndex>, or -1 if it can't be determined
+int         getUioHostIrq(int uioIndex);
+
+// Fills in the parts of "status" that describe the current placement of the thread whose
+// kernel thread ID is "tid", and of "hostIrq"
+void        queryPlacement(pid_t tid, int hostIrq, placement_status_t& status);
+
+// Returns the NUMA node the PCI device with the specified BDF is attached to, or -1 if the
+// system doesn't say (e.g., it only has one node)
+int         getPciNumaNode(std::string bdf);
+
+// Returns the CPUs that are local to the PCI device with the specified BDF.  If the system
+// doesn't say, every online CPU is considered local.
+std::vector<int> getPciLocalCpus(std::string bdf);
+
+// Converts a CPU list such as "0-3,8,10-11" into a list of CPU numbers
+std::vector<int> parseCpuList(std::string list);
+
+// Allocates "size" bytes of zeroed, page-aligned memory whose pages live on NUMA node "node"
+// (if that's possible - if not, the memory comes from wherever the kernel chooses).  A node
+// of -1 means "don't care".  Throws std::bad_alloc if there's no memory at all.
+void*       allocateOnNode(size_t size, int node);
+
+// Frees memory that came from allocateOnNode()
+void        freeOnNode(void* ptr, size_t size);
+
+// Restricts the calling thread to the CPUs in "cpus", and has every page it faults in from
+// now on come from NUMA node "node" (again, if that's possible).  Threads it starts inherit
+// both.  A node of -1 or an empty CPU list leaves that part alone.
+void        bindThreadToNode(int node, const std::vector<int>& cpus);
@@ -0,0 +1,185 @@
+//=================================================================================================
+// TimerSource.cpp - Implements the driver for source.v and the software model of it
+//=================================================================================================
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdexcept>
+#include "TimerSource.h"
+#include "IntrControllerModel.h"
+#include "CpuUtil.h"
+#include "Futex.h"
+
+
+//=================================================================================================
+// throwRuntime() - Throws a runtime exception
+//=================================================================================================
+static void throwRuntime(const char* fmt, ...)
+{
+    char buffer[1024];
+    va_list ap;
+    va_start(ap, fmt);
+    vsprintf(buffer, fmt, ap);
+    va_end(ap);
+
+    throw std::runtime_error(buffer);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// initialize() - Determines the userspace address of the first register of the source
+//=================================================================================================
+void TimerSource::initialize(uint8_t* userspacePtr, uint32_t baseAddress)
+{
+    axiReg_ = (uint32_t*)(userspacePtr + baseAddress);
+    model_  = nullptr;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// initialize() - Points us at a software model of the source instead of the real thing
+//=================================================================================================
+void TimerSource::initialize(RegisterModel* model)
+{
+    axiReg_ = nullptr;
+    model_  = model;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// startTimer() - Starts the timer.  The RTL's period is one millisecond longer than the value
+//                in REG_TIMER, and writing 0 stops it, so 2 ms is as short as it goes.
+//=================================================================================================
+void TimerSource::startTimer(uint32_t periodMs)
+{
+    if (periodMs < 2) throwRuntime("Timer period of %u ms is too short, the minimum is 2", periodMs);
+    writeReg(REG_TIMER, periodMs - 1);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// timerPeriodMs() - Returns the period the timer is running at, or 0 if it's stopped
+//=================================================================================================
+uint32_t TimerSource::timerPeriodMs()
+{
+    uint32_t value = readReg(REG_TIMER);
+    return value ? value + 1 : 0;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// Constructor - Starts the thread that strobes the IRQ
+//=================================================================================================
+TimerSourceModel::TimerSourceModel(IntrControllerModel* controller, int irq, uint32_t clkPerMsec)
+{
+    controller_ = controller;
+    irqBit_     = 1u << (irq & 31);
+    clockNs_    = 1e6 / clkPerMsec;
+    msecNs_     = (clkPerMsec + 1.0) * clockNs_;
+    thread_     = std::thread(&TimerSourceModel::run, this);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// Destructor - Stops the thread
+//=================================================================================================
+TimerSourceModel::~TimerSourceModel()
+{
+    stopping_ = true;
+    ++wake_;
+    futexWake(&wake_);
+    thread_.join();
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// readReg() - Performs the equivalent of an AXI read of the specified register.  Only REG_TIMER
+//             can be read; the RTL answers anything else with a decode error.
+//=================================================================================================
+uint32_t TimerSourceModel::readReg(int index)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return (index == TimerSource::REG_TIMER) ? timerValue_ : 0;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// writeReg() - Performs the equivalent of an AXI write to the specified register
+//=================================================================================================
+void TimerSourceModel::writeReg(int index, uint32_t value)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    switch (index)
+    {
+        // Forcing the interrupt high cancels the timer
+        case TimerSource::REG_FORCE:
+            timerValue_ = 0;
+            controller_->pulse(irqBit_, value);
+            break;
+
+        // Writing the timer restarts it from the beginning of a period (or, if it's 0, stops it)
+        case TimerSource::REG_TIMER:
+            timerValue_ = value;
+            startNs_    = nowNs();
+            strobes_    = 0;
+            break;
+
+        // Writes to any other register are a decode error
+        default:
+            return;
+    }
+
+    ++wake_;
+    futexWake(&wake_);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// run() - Strobes the IRQ every time the timer expires
+//
+// The RTL strobes on the next-to-last clock of each period, so the first strobe comes two clocks
+// short of a full period after the timer is written, and they're a full period apart after that.
+//=================================================================================================
+void TimerSourceModel::run()
+{
+    while (!stopping_)
+    {
+        uint32_t wake   = wake_;
+        uint64_t waitNs = 0;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (timerValue_)
+            {
+                double   periodNs = (timerValue_ + 1) * msecNs_;
+                uint64_t now      = nowNs();
+                auto     due      = [&](uint64_t n)
+                {
+                    return startNs_ + (uint64_t)((n + 1) * periodNs - 2 * clockNs_);
+                };
+
+                // Strobe once for every period that has expired, even if we've fallen behind
+                while (due(strobes_) <= now)
+                {
+                    controller_->raise(irqBit_);
+                    ++strobes_;
+                }
+
+                waitNs = due(strobes_) - now;
+            }
+        }
+
+        // Sleep until the next strobe is due, or until the timer is written
+        futexWait(&wake_, wake, waitNs);
+    }
+}
+//=================================================================================================
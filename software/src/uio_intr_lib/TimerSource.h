@@ -0,0 +1,150 @@
+//=================================================================================================
+// TimerSource.h - Defines a driver for source.v, the programmable interrupt source that drives one
+//                 IRQ_IN line of the interrupt controller, along with a software model of it
+//=================================================================================================
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include "RegisterModel.h"
+
+class IntrControllerModel;
+
+//-------------------------------------------------------------------
+// source.v has two registers:
+//
+//   REG_FORCE - Writing N cancels the timer and holds the interrupt
+//               high for N clocks.  The interrupt controller counts
+//               an IRQ once for every clock it's high, so this is a
+//               burst of exactly N interrupts.  It can't be read.
+//
+//   REG_TIMER - Writing M strobes the interrupt high for one clock
+//               every M+1 "milliseconds", and writing 0 cancels the
+//               timer.  Reading it returns M.
+//
+// The RTL's millisecond is CLK_PER_MSEC + 1 clocks, because it
+// counts down from CLK_PER_MSEC to 0.  With the design's 100 MHz
+// clock, a timer period is 10 ppm longer than it looks.
+//-------------------------------------------------------------------
+class TimerSource
+{
+public:
+
+    // The CLK_PER_MSEC parameter of the RTL, as it's set in the design
+    enum : uint32_t {DEFAULT_CLK_PER_MSEC = 100000};
+
+    // These are the registers of the interrupt source
+    enum
+    {
+        REG_FORCE = 0,
+        REG_TIMER = 1
+    };
+
+    // "clkPerMsec" must match the CLK_PER_MSEC parameter the RTL was built with
+    explicit TimerSource(uint32_t clkPerMsec = DEFAULT_CLK_PER_MSEC) : clkPerMsec_(clkPerMsec) {}
+
+    // No copy or assignment constructor - objects of this class can't be copied
+    TimerSource (const TimerSource&) = delete;
+    TimerSource& operator= (const TimerSource&) = delete;
+
+    // Points us at the registers of the source at "baseAddress" within a mapped BAR
+    void        initialize(uint8_t* userspacePtr, uint32_t baseAddress);
+
+    // Points us at a software model of the source instead of the real thing
+    void        initialize(RegisterModel* model);
+
+    // Strobes the interrupt once every "periodMs" milliseconds.  The shortest period the RTL can
+    // do is 2 milliseconds.
+    void        startTimer(uint32_t periodMs);
+
+    // Stops the timer
+    void        stopTimer() {writeReg(REG_TIMER, 0);}
+
+    // Returns the period the timer is running at in milliseconds, or 0 if it's stopped
+    uint32_t    timerPeriodMs();
+
+    // Holds the interrupt high for "clocks" clock cycles.  This stops the timer.
+    void        force(uint32_t clocks) {writeReg(REG_FORCE, clocks);}
+
+    // Returns the exact length of a "periodMs" timer period, and of one clock, in nanoseconds
+    double      periodNs(uint32_t periodMs) {return periodMs * (clkPerMsec_ + 1.0) * clockNs();}
+    double      clockNs() {return 1e6 / clkPerMsec_;}
+
+    // Returns the number of clocks in a millisecond, as the RTL was built
+    uint32_t    clkPerMsec() {return clkPerMsec_;}
+
+protected:
+
+    // Reads or writes one of the source's registers
+    inline uint32_t readReg(int index)
+    {
+        return model_ ? model_->readReg(index) : axiReg_[index];
+    }
+    inline void writeReg(int index, uint32_t value)
+    {
+        if (model_) model_->writeReg(index, value); else axiReg_[index] = value;
+    }
+
+    // The memory-mapped registers of the source, or a software model of them
+    volatile uint32_t* axiReg_ = nullptr;
+    RegisterModel*     model_  = nullptr;
+
+    uint32_t           clkPerMsec_;
+};
+//-------------------------------------------------------------------
+
+
+//-------------------------------------------------------------------
+// A software model of source.v that drives one IRQ of an
+// IntrControllerModel.  A thread of its own strobes the IRQ on the
+// timer's schedule, in real time.  If that thread falls behind, it
+// catches up by strobing once for every period it missed, so the
+// controller counts what the hardware would have.
+//
+// A force of N clocks counts N in the controller all at once, where
+// the hardware would take N clocks to do it.
+//-------------------------------------------------------------------
+class TimerSourceModel : public RegisterModel
+{
+public:
+
+    // Drives IRQ "irq" of "controller".  "clkPerMsec" is the CLK_PER_MSEC parameter of the RTL.
+    TimerSourceModel(IntrControllerModel* controller, int irq,
+                     uint32_t clkPerMsec = TimerSource::DEFAULT_CLK_PER_MSEC);
+
+    // Stops the thread that strobes the IRQ
+    ~TimerSourceModel();
+
+    // No copy or assignment constructor - objects of this class can't be copied
+    TimerSourceModel (const TimerSourceModel&) = delete;
+    TimerSourceModel& operator= (const TimerSourceModel&) = delete;
+
+    // AXI register reads and writes, with the same semantics as the RTL
+    uint32_t    readReg(int index) override;
+    void        writeReg(int index, uint32_t value) override;
+
+protected:
+
+    // The thread that strobes the IRQ whenever the timer expires
+    void        run();
+
+    IntrControllerModel* controller_;
+    uint32_t             irqBit_;
+
+    // The length of a clock and of an RTL millisecond, in nanoseconds
+    double               clockNs_, msecNs_;
+
+    // The value of REG_TIMER, when it was written, and how many times the timer has strobed
+    // since then.  These are guarded by the mutex.
+    std::mutex           mutex_;
+    uint32_t             timerValue_ = 0;
+    uint64_t             startNs_    = 0;
+    uint64_t             strobes_    = 0;
+
+    // Bumped (and woken) whenever the timer is written, or when it's time to stop
+    std::atomic<uint32_t> wake_{0};
+    std::atomic<bool>     stopping_{false};
+    std::thread           thread_;
+};
+//-------------------------------------------------------------------
@@ -0,0 +1,242 @@
+//=================================================================================================
+// TraceRing.cpp - Implements the per-thread binary trace of interrupt handling
+//=================================================================================================
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <mutex>
+#include <memory>
+#include <deque>
+#include <algorithm>
+#include <thread>
+#include "TraceRing.h"
+#include "Futex.h"
+
+// Every ring that dump() writes, the ones among them whose thread has exited (oldest first),
+// and the size of the next one.  dump() holds a reference to each ring it's copying, so a
+// ring that's freed while it's being copied isn't freed until the copy is done.
+static std::mutex                              registryMutex;
+static std::vector<std::shared_ptr<TraceRing>> registry;
+static std::deque<TraceRing*>                  retired;
+static uint32_t                                ringSize = 65536;
+
+// Where triggered dumps go, how long after the trigger they're written, and how far apart
+// triggers have to be
+static std::mutex              triggerMutex;
+static std::string             triggerPrefix;
+static uint32_t                triggerPostUs;
+static std::atomic<uint64_t>   holdoffTsc{0}, lastTriggerTsc{0};
+static bool                    haveDumpThread = false;
+
+thread_local TraceRing*  TraceRing::local_ = nullptr;
+thread_local TraceRing::owner_t TraceRing::owner_;
+std::atomic<bool>        TraceRing::enabled_{true};
+std::atomic<uint64_t>    TraceRing::triggerTsc_{UINT64_MAX};
+std::atomic<uint64_t>    TraceRing::triggers_{0}, TraceRing::triggerDumps_{0};
+std::atomic<uint32_t>    TraceRing::triggerSeq_{0};
+
+
+//=================================================================================================
+// Constructor - Allocates the ring and notes which thread owns it
+//=================================================================================================
+TraceRing::TraceRing(uint32_t size) : event_(size)
+{
+    mask_ = size - 1;
+    tid_  = syscall(SYS_gettid);
+    memset(name_, 0, sizeof name_);
+    pthread_getname_np(pthread_self(), name_, sizeof name_);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// setRingSize() - Sets the size of rings created from now on, rounded up to a power of 2
+//=================================================================================================
+void TraceRing::setRingSize(uint32_t events)
+{
+    uint32_t size = 2;
+    while (size < events) size <<= 1;
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+    ringSize = size;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// attach() - Creates a ring for the calling thread.  The ring stays there for dump() after
+//            its thread has gone, until enough other threads have exited after it.
+//=================================================================================================
+TraceRing* TraceRing::attach()
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+
+    // Make sure our owner_t is destroyed when this thread exits
+    (void)&owner_;
+
+    local_ = new TraceRing(ringSize);
+    registry.emplace_back(local_);
+    return local_;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// ~owner_t() - Runs as a thread exits.  Its ring is kept, but the oldest ring of a thread that
+//              exited before it may have to go.
+//=================================================================================================
+TraceRing::owner_t::~owner_t()
+{
+    if (local_ == nullptr) return;
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+    retired.push_back(local_);
+    if (retired.size() <= MAX_RETIRED) return;
+
+    TraceRing* oldest = retired.front();
+    retired.pop_front();
+    registry.erase(std::find_if(registry.begin(), registry.end(),
+                                [oldest](const std::shared_ptr<TraceRing>& ring) {return ring.get() == oldest;}));
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// dump() - Writes every ring to a file
+//
+// The threads keep recording while we copy their rings, so the oldest events we copy may be
+// overwritten as we go.  Once we've copied a ring, we look at how far its owner has got, and
+// throw away anything it could have written over.
+//=================================================================================================
+bool TraceRing::dump(const std::string& filename, bool triggered)
+{
+    std::vector<std::shared_ptr<TraceRing>> rings;
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        rings = registry;
+    }
+
+    FILE* file = fopen(filename.c_str(), "wb");
+    if (file == nullptr) return false;
+
+    trace_file_t header;
+    memset(&header, 0, sizeof header);
+    header.magic       = TRACE_MAGIC;
+    header.version     = TRACE_VERSION;
+    header.nsPerTsc    = nsPerTsc();
+    header.dumpTsc     = readTsc();
+    header.dumpNs      = nowNs();
+    header.threadCount = rings.size();
+    header.triggered   = triggered;
+    bool ok = fwrite(&header, sizeof header, 1, file) == 1;
+
+    std::vector<trace_event_t> events;
+    for (auto& ring : rings)
+    {
+        uint64_t size  = ring->mask_ + 1;
+        uint64_t head  = ring->head_.load(std::memory_order_acquire);
+        uint64_t first = (head > size) ? head - size : 0;
+
+        // Copy the events, oldest first
+        events.resize(head - first);
+        for (uint64_t i=first; i<head; ++i) events[i - first] = ring->event_[i & ring->mask_];
+
+        // Anything the owner could have written over since we started is suspect
+        uint64_t now = ring->head_.load(std::memory_order_acquire);
+        uint64_t skip = 0;
+        if (now + 1 > first + size) skip = now + 1 - size - first;
+        if (skip > events.size()) skip = events.size();
+
+        trace_thread_t thread;
+        memset(&thread, 0, sizeof thread);
+        thread.tid        = ring->tid_;
+        thread.eventCount = events.size() - skip;
+        thread.lost       = first + skip;
+        memcpy(thread.name, ring->name_, sizeof thread.name);
+
+        ok = ok && fwrite(&thread, sizeof thread, 1, file) == 1;
+        if (thread.eventCount)
+        {
+            ok = ok && fwrite(&events[skip], sizeof(trace_event_t), thread.eventCount, file) == thread.eventCount;
+        }
+    }
+
+    return (fclose(file) == 0) && ok;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// setTrigger() - Sets the threshold and where triggered dumps go, and starts the thread that
+//                writes them
+//=================================================================================================
+void TraceRing::setTrigger(uint64_t thresholdNs, const std::string& prefix, uint32_t postUs,
+                           uint32_t holdoffMs)
+{
+    std::lock_guard<std::mutex> lock(triggerMutex);
+
+    triggerPrefix = prefix;
+    triggerPostUs = postUs;
+    holdoffTsc    = holdoffMs * 1e6 / nsPerTsc();
+    triggerTsc_   = thresholdNs ? (uint64_t)(thresholdNs / nsPerTsc()) : UINT64_MAX;
+
+    if (thresholdNs && !haveDumpThread)
+    {
+        std::thread(dumpOnTrigger).detach();
+        haveDumpThread = true;
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// trigger() - Called by the owning thread when one of its wakeups took too long
+//=================================================================================================
+void TraceRing::trigger(uint64_t tsc)
+{
+    // If we triggered recently, this one is part of the same incident
+    uint64_t last = lastTriggerTsc;
+    if (last && tsc - last < holdoffTsc) return;
+    if (!lastTriggerTsc.compare_exchange_strong(last, tsc)) return;
+
+    push(tsc, TRACE_TRIGGER, 0, tscToNs(tsc - wakeTsc_) / 1000);
+    ++triggers_;
+
+    // Let the dumping thread know
+    ++triggerSeq_;
+    futexWake(&triggerSeq_);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// dumpOnTrigger() - Waits for the trigger to fire, then writes the rings to a file
+//=================================================================================================
+void TraceRing::dumpOnTrigger()
+{
+    uint32_t seen = triggerSeq_;
+
+    while (true)
+    {
+        futexWait(&triggerSeq_, seen);
+        if (triggerSeq_ == seen) continue;
+        seen = triggerSeq_;
+
+        std::string prefix;
+        uint32_t    postUs;
+        {
+            std::lock_guard<std::mutex> lock(triggerMutex);
+            prefix = triggerPrefix;
+            postUs = triggerPostUs;
+        }
+
+        // Give the threads a moment to record what happened next
+        if (postUs) usleep(postUs);
+
+        std::string filename = prefix + "." + std::to_string(triggerDumps_ + 1) + ".trace";
+        if (dump(filename, true)) ++triggerDumps_;
+    }
+}
+//=================================================================================================
@@ -0,0 +1,215 @@
+//=================================================================================================
+// TraceRing.h - Defines an always-on binary trace of what the interrupt-handling threads are doing,
+//               kept in a ring per thread and written to a file on demand or when something slow
+//               happens
+//=================================================================================================
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <atomic>
+#include <vector>
+#include "CpuUtil.h"
+
+// These are the kinds of event that are recorded
+enum trace_type_t : uint8_t
+{
+    // The monitor woke up to service interrupts.  "irq" is 0 if it was woken by the kernel and 1
+    // if it found them while spinning, "value" is the UIO interrupt count if there is one.
+    TRACE_WAKEUP         = 1,
+
+    // topLevelHandler() was entered, and returned after "value" passes
+    TRACE_HANDLER_ENTER  = 2,
+    TRACE_HANDLER_EXIT   = 3,
+
+    // The pending register (or a status record) said the IRQs in "value" were pending
+    TRACE_PENDING        = 4,
+
+    // IRQ "irq" was serviced with a count of "value"
+    TRACE_COUNT          = 5,
+
+    // The interrupt service routine for IRQ "irq" was called, and returned
+    TRACE_ISR_ENTER      = 6,
+    TRACE_ISR_EXIT       = 7,
+
+    // The monitor is about to re-enable PCI interrupts and wait for the next one
+    TRACE_REENABLE       = 8,
+
+    // The monitor got the device back after a hot-reset, "value" microseconds after losing it
+    TRACE_RECONNECT      = 9,
+
+    // A wakeup took longer than the trigger threshold; "value" is how long, in microseconds
+    TRACE_TRIGGER        = 10
+};
+
+//-------------------------------------------------------------------
+// A single event, as it's stored in a ring and in a trace file
+//-------------------------------------------------------------------
+struct trace_event_t
+{
+    uint64_t    tsc;
+    uint32_t    value;
+    uint8_t     type;
+    uint8_t     irq;
+    uint16_t    reserved;
+};
+//-------------------------------------------------------------------
+
+
+//-------------------------------------------------------------------
+// A trace file is one of these, followed by a trace_thread_t and
+// its events for each thread.  Each thread's events are in the
+// order they happened.
+//-------------------------------------------------------------------
+enum : uint32_t {TRACE_MAGIC = 0x43525449 /* "ITRC" */, TRACE_VERSION = 1};
+
+struct trace_file_t
+{
+    uint32_t    magic;
+    uint32_t    version;
+
+    // For converting TSC ticks to nanoseconds, and the TSC and nowNs() when the file was written
+    double      nsPerTsc;
+    uint64_t    dumpTsc;
+    uint64_t    dumpNs;
+
+    // How many threads follow, and whether this was dumped on demand (0) or by a trigger (1)
+    uint32_t    threadCount;
+    uint32_t    triggered;
+};
+
+struct trace_thread_t
+{
+    int32_t     tid;
+    uint32_t    eventCount;
+
+    // How many older events had already been overwritten when the file was written
+    uint64_t    lost;
+
+    char        name[16];
+};
+//-------------------------------------------------------------------
+
+
+//-------------------------------------------------------------------
+// Each thread that records an event gets a ring of its own the
+// first time it does, so recording never contends with anything.
+// A ring outlives its thread, so a dump still shows what a thread
+// that has exited was doing, but only the rings of the last
+// MAX_RETIRED threads to exit are kept: threads come and go (worker
+// pools, for one), and each ring is a megabyte.
+//
+// Recording costs a thread-local lookup, a read of the TSC, and a
+// 16-byte store.
+//-------------------------------------------------------------------
+class TraceRing
+{
+public:
+
+    // How many rings of threads that have exited are kept for dump()
+    enum {MAX_RETIRED = 16};
+
+    // Turns recording on or off for every thread (it starts on)
+    static void enable(bool flag) {enabled_.store(flag, std::memory_order_relaxed);}
+    static bool isEnabled() {return enabled_.load(std::memory_order_relaxed);}
+
+    // Sets the number of events in each ring created from now on.  It's rounded up to a power
+    // of 2, and defaults to 65536 (1 MB).
+    static void setRingSize(uint32_t events);
+
+    // Records an event in the calling thread's ring
+    static inline void record(trace_type_t type, uint32_t irq = 0, uint32_t value = 0)
+    {
+        if (!enabled_.load(std::memory_order_relaxed)) return;
+        TraceRing* ring = local_ ? local_ : attach();
+        uint64_t   tsc  = readTsc();
+        ring->push(tsc, type, irq, value);
+        ring->lastTsc_ = tsc;
+
+        // A wakeup is timed from the event that starts it to the ones that end it
+        if (type == TRACE_WAKEUP) ring->wakeTsc_ = tsc;
+        if ((type == TRACE_HANDLER_EXIT || type == TRACE_REENABLE) && ring->wakeTsc_)
+        {
+            if (tsc - ring->wakeTsc_ > triggerTsc_.load(std::memory_order_relaxed)) ring->trigger(tsc);
+            if (type == TRACE_REENABLE) ring->wakeTsc_ = 0;
+        }
+    }
+
+    // Records an event with the same timestamp as the calling thread's previous one.  Reading
+    // the TSC is most of the cost of an event, so this is for events that are known to follow
+    // closely on the one before.
+    static inline void recordAtLast(trace_type_t type, uint32_t irq = 0, uint32_t value = 0)
+    {
+        if (!enabled_.load(std::memory_order_relaxed)) return;
+        TraceRing* ring = local_ ? local_ : attach();
+        ring->push(ring->lastTsc_, type, irq, value);
+    }
+
+    // Writes every thread's ring to a file.  "triggered" is recorded in the file.  Returns
+    // false if the file couldn't be written.
+    static bool dump(const std::string& filename, bool triggered = false);
+
+    // Makes any wakeup that takes longer than "thresholdNs" from TRACE_WAKEUP to the end of
+    // servicing write the rings to <prefix>.<n>.trace, "postUs" microseconds later so that the
+    // file shows what happened next.  Dumps are at least "holdoffMs" apart.  A threshold of 0
+    // turns the trigger off.  The files are written by a thread of their own.
+    static void setTrigger(uint64_t thresholdNs, const std::string& prefix,
+                           uint32_t postUs = 1000, uint32_t holdoffMs = 1000);
+
+    // Returns the number of times the trigger has fired, and the number of files it wrote
+    static uint64_t triggerCount() {return triggers_;}
+    static uint64_t triggerDumps() {return triggerDumps_;}
+
+private:
+
+    // Only attach() creates rings
+    TraceRing(uint32_t size);
+
+    // Creates the calling thread's ring and registers it
+    static TraceRing* attach();
+
+    // When a thread that has a ring exits, this retires the ring, and frees the oldest
+    // retired ring if there are more than MAX_RETIRED of them
+    struct owner_t {~owner_t();};
+    static thread_local owner_t owner_;
+
+    // Stores an event in the ring.  Only the owning thread calls this.
+    inline void push(uint64_t tsc, uint8_t type, uint32_t irq, uint32_t value)
+    {
+        uint64_t head = head_.load(std::memory_order_relaxed);
+        trace_event_t& event = event_[head & mask_];
+        event.tsc   = tsc;
+        event.value = value;
+        event.type  = type;
+        event.irq   = irq;
+        head_.store(head + 1, std::memory_order_release);
+    }
+
+    // Records a trigger event and wakes the thread that writes the file
+    void        trigger(uint64_t tsc);
+
+    // The thread that writes files when the trigger fires
+    static void dumpOnTrigger();
+
+    // The events, the number of them ever recorded, and the slot-index mask
+    std::vector<trace_event_t> event_;
+    std::atomic<uint64_t>      head_{0};
+    uint64_t                   mask_;
+
+    // The owning thread, the TSC of its wakeup that hasn't finished yet (or 0), and the TSC of
+    // the last event it recorded
+    int32_t                    tid_;
+    char                       name_[16];
+    uint64_t                   wakeTsc_ = 0, lastTsc_ = 0;
+
+    // The calling thread's ring
+    static thread_local TraceRing* local_;
+
+    static std::atomic<bool>     enabled_;
+
+    // The trigger threshold (in TSC ticks), how many times it has fired and how many files it
+    // has written.  "triggerSeq_" is what the dumping thread sleeps on.
+    static std::atomic<uint64_t> triggerTsc_;
+    static std::atomic<uint64_t> triggers_, triggerDumps_;
+    static std::atomic<uint32_t> triggerSeq_;
+};
+//-------------------------------------------------------------------
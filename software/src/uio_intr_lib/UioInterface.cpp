@@ -4,17 +4,27 @@
 #include <stdarg.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <fcntl.h>
 #include <stdint.h>
+#include <errno.h>
 #include <string.h>
-#include <filesystem>
 #include <string>
 #include <thread>
+#include <future>
 #include <stdexcept>
+#include <dirent.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
 #include "UioInterface.h"
+#include "PciDiscovery.h"
+#include "CpuUtil.h"
+#include "IoUring.h"
+#include "TraceRing.h"
 
 static volatile int bitBucket;
-namespace fs=std::filesystem;
 
 
 //=================================================================================================
@@ -35,43 +45,26 @@ static void throwRuntime(const char* fmt, ...)
 
 
 //=================================================================================================
-// getBDF() - Converts a <vendorID:deviceID> into a PCI BDF
+// vendorDeviceOf() - Returns the "vendorID:deviceID" of the device with the specified BDF
 //=================================================================================================
-static std::string getBDF(std::string device)
+static std::string vendorDeviceOf(std::string bdf)
 {
-    char command[64];
-    char buffer[256];
-    std::string retval = "0000:";
+    char buffer[32] = {0}, filename[PATH_MAX];
+    std::string result;
 
-    // Build the command "lspci -d {device}"
-    sprintf(command, "lspci -d %s", device.c_str());
-
-    // Open the lpsci command as a process
-    FILE* fp = popen(command, "r");
-
-    // If we couldn't do that, give up
-    if (fp == nullptr) return "";
-
-    // Fetch the first line of the output
-    if (!fgets(buffer, sizeof buffer, fp))
+    for (const char* name : {"vendor", "device"})
     {
-        fclose(fp);
-        return "";
+        sprintf(filename, "%s/%s/%s", PciDiscovery::DEFAULT_DEVICE_DIR, bdf.c_str(), name);
+        int fd = open(filename, O_RDONLY);
+        if (fd < 0) throwRuntime("Can't open %s", filename);
+        int length = read(fd, buffer, sizeof(buffer) - 1);
+        close(fd);
+        buffer[length > 0 ? length : 0] = 0;
+        snprintf(filename, sizeof filename, "%04lx", strtoul(buffer, nullptr, 0));
+        result += (result.empty() ? "" : ":") + std::string(filename);
     }
 
-    // Find the first space in the line
-    char* p = strchr(buffer, ' ');
-    if (p == nullptr)
-    {
-        fclose(fp);
-        return "";
-    }
-
-    // Terminate the string at the first space. 
-    *p = 0;
-    
-    // The PCI BDF of the device is the first token in the buffer
-    return retval + buffer;
+    return result;
 }
 //=================================================================================================
 
@@ -112,96 +105,214 @@ static void registerUioDevice(std::string device)
 
 
 //=================================================================================================
-// extractIndexFromUioName() - A UIO name is something like "/sys/class/uio/uio3".
-//                             This routine returns the numeric value at the end of the string
+// findUioIndex() - Returns the UIO index of our device.  A device that is bound to
+//                  uio_pci_generic has a "uio" directory containing a single "uioN" entry.
 //=================================================================================================
-static int extractIndexFromUioName(std::string name)
+static int findUioIndex(std::string bdf)
 {
-    // Find the nul at the end of the string
-    const char* p = strchr(name.c_str(), 0);
+    int  uioIndex = -1;
+    std::string directory = std::string(PciDiscovery::DEFAULT_DEVICE_DIR) + "/" + bdf + "/uio";
+
+    DIR* dir = opendir(directory.c_str());
+    if (dir == nullptr) return -1;
 
-    // Walk backwards until we encounter a character that isn't a digit
-    while (*(p-1) >= '0' && *(p-1) <= '9') --p;
+    // Look for the entry named "uio<index>"
+    while (dirent* entry = readdir(dir))
+    {
+        if (strncmp(entry->d_name, "uio", 3) == 0) uioIndex = atoi(entry->d_name + 3);
+    }
 
-    // And hand the caller the integer value at the end of the string
-    return atoi(p);
+    closedir(dir);
+    return uioIndex;
 }
 //=================================================================================================
 
 
+
 //=================================================================================================
-// findUioIndex() - Returns the UIO index of our device
+// waitForUioDevice() - Waits for the device with the specified BDF to be bound to the UIO
+//                      subsystem, and returns its UIO index
+//
+// Rather than sleeping and retrying, we listen for the kernel's uevents and look again each time
+// one arrives.  If we can't listen for uevents, we fall back to looking every 10 milliseconds.
 //=================================================================================================
-static int findUioIndex(std::string bdf)
+static int waitForUioDevice(std::string bdf)
 {
-    std::string directory = "/sys/class/uio";
-
-    // We're looking for a symlink target that contains "/<bdf>/uio/uio"
-    std::string searchKey = "/" + bdf + "/uio/uio";
-
-    // Loop through the entry for each device in the specified directory...
-    for (auto const& entry : fs::directory_iterator(directory)) 
+    char buffer[4096], filename[64];
+
+    // Subscribe to kernel uevents before we look, so that we can't miss the device appearing
+    int sock = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+    sockaddr_nl address = {};
+    address.nl_family = AF_NETLINK;
+    address.nl_groups = 1;
+    if (sock >= 0 && bind(sock, (sockaddr*)&address, sizeof address) < 0)
     {
-        // Ignore any entry that isn't a symbolic link
-        if (!entry.is_symlink()) continue;
-
-        // Fetch the path of the source of the symlink
-        fs::path source = entry.path();
-
-        // Find the target of the symlink
-        fs::path target = fs::read_symlink(source);
+        close(sock);
+        sock = -1;
+    }
 
-        // Get the filename (or folder name) of the target
-        std::string targetFilename = target.string();
+    while (true)
+    {
+        // If the device is back and its /dev/uioN node exists, we're done
+        int uioIndex = findUioIndex(bdf);
+        sprintf(filename, "/dev/uio%d", uioIndex);
+        if (uioIndex >= 0 && access(filename, R_OK) == 0)
+        {
+            if (sock >= 0) close(sock);
+            return uioIndex;
+        }
 
-        // If we found the key we're looking for, return the associated UIO index
-        if (targetFilename.find(searchKey) != std::string::npos)
+        // If we can't hear uevents, just wait a bit
+        if (sock < 0)
         {
-            return extractIndexFromUioName(source.string());
+            usleep(10000);
+            continue;
         }
-    }
 
-    // If we get here, we couldn't find the BDF we were looking for
-    return -1;
+        // Wait for something to happen, then throw away every uevent that's queued up.  The
+        // timeout is a safety net in case the socket's receive buffer ever overflows.
+        pollfd fd = {sock, POLLIN, 0};
+        if (poll(&fd, 1, 100) > 0) while (recv(sock, buffer, sizeof buffer, MSG_DONTWAIT) > 0);
+    }
 }
 //=================================================================================================
 
 
-
 //=================================================================================================
-// initialize() - Registers our device with the Linux UIO subsystem and returns the 
-//                UIO index that corresponds to our device
+// openUioDevice() - Registers our device with the Linux UIO subsystem and returns the 
+//                   UIO index that corresponds to our device
 //
-// Passed: device = PCI device name in vendorID:deviceID format
+// Passed: device  = PCI device name in vendorID:deviceID format, or the BDF of a device
 //=================================================================================================
-void UioInterface::initialize(std::string device, IntrControlBase* handler)
+int UioInterface::openUioDevice(std::string device)
 {
-    // Store the pointer to the interrupt handler
-    handler_ = handler;
-
     // Convert the device ID into a BDF
-    std::string bdf = getBDF(device);
+    std::string bdf = PciDiscovery::resolve(device);
 
     // If this device isn't installed, drop dead
     if (bdf.empty()) throwRuntime("PCI device %s not found", device.c_str());
 
-    // Make sure the generic UIO PCI device driver is loaded
-    bitBucket = system("modprobe uio_pci_generic");
+    // If the device isn't already bound to the generic UIO PCI driver, bind it
+    if (PciDiscovery::driverOf(bdf) != "uio_pci_generic")
+    {
+        // Make sure the generic UIO PCI device driver is loaded
+        if (access("/sys/bus/pci/drivers/uio_pci_generic", F_OK) != 0)
+        {
+            bitBucket = system("modprobe uio_pci_generic");
+        }
 
-    // Register our device with the UIO subsystem
-    registerUioDevice(device);
+        // Register our device with the UIO subsystem
+        registerUioDevice(PciDiscovery::isBdf(device) ? vendorDeviceOf(bdf) : device);
+    }
 
     // Fetch the UIO index that corresponds to our device
     int uioIndex = findUioIndex(bdf);
+    bdf_ = bdf;
 
     // If we couldn't find a valid index, complain and give up
     if (uioIndex < 0) throwRuntime("Can't initialize UIO subsystem for device %s", device.c_str());
 
+    return uioIndex;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// initialize() - Registers our device with the Linux UIO subsystem and starts monitoring it
+//
+// Passed: device  = PCI device name in vendorID:deviceID format, or the BDF of a device
+//         handler = The interrupt controller that services this device's interrupts
+//         reactor = If not nullptr, the reactor that should monitor this device
+//=================================================================================================
+void UioInterface::initialize(std::string device, IntrControlBase* handler, UioReactor* reactor)
+{
+    // If we've been handed a reactor, it monitors this device instead of a thread of our own
+    if (reactor)
+    {
+        handler_ = {handler};
+        reactor->addDevice(openUioDevice(device), handler);
+        return;
+    }
+
+    initialize(device, std::vector<IntrControlBase*>{handler});
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// initialize() - Registers a device that contains one or more interrupt controllers and starts
+//                monitoring it
+//
+// Passed: device   = PCI device name in vendorID:deviceID format, or the BDF of a device
+//         handlers = The interrupt controllers inside this device, all of which share its
+//                    interrupt
+//=================================================================================================
+void UioInterface::initialize(std::string device, const std::vector<IntrControlBase*>& handlers)
+{
+    if (handlers.empty()) throwRuntime("No interrupt handlers for device %s", device.c_str());
+
+    // Store the pointers to the interrupt handlers
+    handler_ = handlers;
+
+    // Register the device with the UIO subsystem
+    int uioIndex = openUioDevice(device);
+
+    // Find out which host IRQ the kernel delivers this device's interrupts on
+    hostIrq_ = getUioHostIrq(uioIndex);
+
+    // And start the thread that monitors this device
+    startMonitor(uioIndex, device);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// initialize() - Monitors an already open notification fd and PCI config-space fd instead of a
+//                UIO device we find ourselves.  
+//
+// Passed: uiofd    = /dev/uioN, or an eventfd that stands in for one
+//         configfd = the PCI config-space file of the device, a regular file that stands in for 
+//                    one, or -1 if there isn't one
+//         handler  = The interrupt controller that services this device's interrupts
+//=================================================================================================
+void UioInterface::initialize(int uiofd, int configfd, IntrControlBase* handler)
+{
+    handler_  = {handler};
+    uiofd_    = uiofd;
+    configfd_ = configfd;
+    startMonitor(-1, "stand-in device");
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// startMonitor() - Steers the host IRQ (if asked to), then spawns the thread that monitors 
+//                  /dev/uio<uioIndex> (or our pre-opened file descriptors if uioIndex is -1)
+//=================================================================================================
+void UioInterface::startMonitor(int uioIndex, std::string device)
+{
+    // If the caller wants the host IRQ steered to a specific CPU, do so
+    int irqCpu = placement_.irqCpu;
+    if (irqCpu == thread_placement_t::IRQ_SAME_CPU) irqCpu = placement_.cpu;
+    if (irqCpu >= 0)
+    {
+        std::string error = steerHostIrq(hostIrq_, irqCpu);
+        if (!error.empty()) throwRuntime("Can't place monitor for %s: %s", device.c_str(), error.c_str());
+    }
+
+    // The monitor thread tells us whether it was able to apply its placement
+    std::promise<std::string> placed;
+    std::future<std::string>  result = placed.get_future();
+
     // Spawn "monitorInterrupts()" in its own thread
-    std::thread th(&UioInterface::monitorInterrupts, this, uioIndex);
+    std::thread th(&UioInterface::monitorInterrupts, this, uioIndex, &placed);
 
     // Let it keep running, even when "thread" goes out of scope
     th.detach();
+
+    // If the monitor thread couldn't be placed where it was asked to be, it has exited
+    std::string error = result.get();
+    if (!error.empty()) throwRuntime("Can't place monitor for %s: %s", device.c_str(), error.c_str());
 }
 //=================================================================================================
 
@@ -215,7 +326,9 @@ enum
     CRASH_OPEN_CONFIG  = 2,
     CRASH_PREAD_1      = 3,
     CRASH_PREAD_2      = 4,
-    CRASH_READ_LEN     = 5
+    CRASH_READ_LEN     = 5,
+    CRASH_READ         = 6,
+    CRASH_RECONNECT    = 7
 };
 
 class crash
@@ -227,79 +340,459 @@ public:
 //==========================================================================================================
 
 
+//=================================================================================================
+// uringReenableAndWait() - Re-enables interrupts in PCI config-space and waits for the next
+//                          notification, in a single trip through an io_uring.  The write and the
+//                          read are linked, so the read doesn't start until the write is done.
+//
+// Returns what read() would have (-1 with errno set on error).  If the write failed, "writeOk" is
+// set to false.  With SQPOLL, we spin on the completion queue for up to "spinNs" nanoseconds
+// before asking the kernel to wait: if the interrupt arrives by then, no system call is made.
+//
+// If "writeTsc" isn't nullptr, it's set to the readTsc() value from when the completion of the
+// write was reaped.  Without SQPOLL, that means waiting for the write on its own, which costs a
+// second system call, so the caller should only ask for it when it's tracking latency.
+//=================================================================================================
+static int uringReenableAndWait(IoUring& ring, int configfd, uint8_t* commandHigh, int uiofd,
+                                void* notification, int notifySize, uint64_t spinNs, bool* writeOk,
+                                uint64_t* writeTsc)
+{
+    enum {TAG_WRITE = 1, TAG_READ = 2};
+    io_uring_sqe* sqe;
+    bool          writing = (configfd >= 0), reading = true;
+    int           result = 0;
+
+    *writeOk = true;
+
+    // If there's no config-space, interrupts are as re-enabled as they're going to get
+    if (writeTsc) *writeTsc = readTsc();
+
+    // Write the upper byte of the command word, unless there's no config-space to write
+    if (writing)
+    {
+        sqe            = ring.getSqe();
+        sqe->opcode    = IORING_OP_WRITE;
+        sqe->flags     = IOSQE_IO_LINK;
+        sqe->fd        = configfd;
+        sqe->addr      = (uint64_t)commandHigh;
+        sqe->len       = 1;
+        sqe->off       = 5;
+        sqe->user_data = TAG_WRITE;
+    }
+
+    // Then read the notification
+    sqe            = ring.getSqe();
+    sqe->opcode    = IORING_OP_READ;
+    sqe->fd        = uiofd;
+    sqe->addr      = (uint64_t)notification;
+    sqe->len       = notifySize;
+    sqe->off       = 0;
+    sqe->user_data = TAG_READ;
+
+    // Submit both, and unless we're going to spin (or have to time the write), wait for them
+    // in the same system call
+    bool spin = ring.isSqPoll() && spinNs;
+    if (!ring.submit(spin ? 0 : writeTsc ? 1 : writing + reading)) return -1;
+
+    // Collect both completions
+    uint64_t start = spin ? nowNs() : 0;
+    while (writing || reading)
+    {
+        io_uring_cqe* cqe = ring.peekCqe();
+
+        // If nothing has completed yet, spin a while longer or have the kernel wait
+        if (cqe == nullptr)
+        {
+            if (spin && nowNs() - start < spinNs)
+                cpuRelax();
+            else if (!ring.submit(1))
+                return -1;
+            continue;
+        }
+
+        // If the write failed, the kernel cancels the read
+        if (cqe->user_data == TAG_WRITE)
+        {
+            if (writeTsc) *writeTsc = readTsc();
+            if (cqe->res != 1) *writeOk = false;
+            writing = false;
+        }
+        else
+        {
+            result  = cqe->res;
+            reading = false;
+        }
+
+        ring.cqeSeen();
+    }
+
+    if (result < 0)
+    {
+        errno = -result;
+        return -1;
+    }
+
+    return result;
+}
+//=================================================================================================
+
+
 //=================================================================================================
 // monitorInterrupts() - Sits in a loop reading interrupt notifications and distributing 
 //                       notifications to the FIFOs that track each interrupt source
 //=================================================================================================
-void UioInterface::monitorInterrupts(int uioDevice)
+void UioInterface::monitorInterrupts(int uioDevice, std::promise<std::string>* placed)
 {
-    int      uiofd;
-    int      configfd;
+    int      uiofd    = -1;
+    int      configfd = -1;
     int      err;
-    uint32_t notification;
-    uint8_t  commandHigh;
+    int      notifySize;
+    uint64_t notification;
+    uint8_t  commandHigh = 0;
     char     filename[64];
+    uint64_t lostNs = 0;
+    IoUring  ring;
+
+    // Pin ourselves to a CPU and set our scheduling policy, then tell initialize() how that went
+    // Once we're placed, getPlacement() can find us by our thread ID
+    std::string error = applyThreadPlacement(placement_);
+    if (error.empty()) monitorTid_ = syscall(SYS_gettid);
+    placed->set_value(error);
+
+    // If we couldn't be placed where we were asked to be, we don't run at all
+    if (!error.empty()) return;
+
+    // When the device disappears in a hot-reset, stop using it and wait for it to come back.
+    // Pre-opened file descriptors can't be re-opened, so for those it's fatal.
+    auto deviceLost = [&]()
+    {
+        if (uioDevice < 0) throw crash(CRASH_READ);
+        lostNs = nowNs();
+        for (auto handler : handler_) handler->invalidateShadows();
+        close(configfd);
+        close(uiofd);
+        uioDevice = waitForUioDevice(bdf_);
+    };
+
+    // In io_uring mode, get an io_uring if we can.  SQPOLL can need privileges we don't have,
+    // so we'll settle for an io_uring without it.
+    if (config_.mode == MONITOR_IO_URING)
+    {
+        if (!ring.open(4, config_.sqPoll) && config_.sqPoll) ring.open(4, false);
+        ioUring_ = ring.isOpen();
+    }
 
     while (true) try
     {    
-        // Generate the filename of the psudeo-file that notifies us of interrupts
-        sprintf(filename, "/dev/uio%d", uioDevice);
+        // If we were handed pre-opened file descriptors, use them
+        if (uioDevice < 0)
+        {
+            uiofd    = uiofd_;
+            configfd = configfd_;
+        }
+
+        // Otherwise, open the UIO device and its PCI config-space
+        else
+        {
+            // Generate the filename of the psudeo-file that notifies us of interrupts
+            sprintf(filename, "/dev/uio%d", uioDevice);
+
+            // Open the psuedo-file that notifies us of interrupts
+            uiofd = open(filename, O_RDONLY);
+
+            // Generate the filename of the PCI config-space psuedo-file
+            sprintf(filename, "/sys/class/uio/uio%d/device/config", uioDevice);
 
-        // Open the psuedo-file that notifies us of interrupts
-        uiofd = open(filename, O_RDONLY);
-        if (uiofd < 0) throw crash(CRASH_OPEN_PDEVICE);
+            // Open the file that gives us access to the PCI device's confiuration space
+            configfd = (uiofd < 0) ? -1 : open(filename, O_RDWR);
 
-        // Generate the filename of the PCI config-space psuedo-file
-        sprintf(filename, "/sys/class/uio/uio%d/device/config", uioDevice);
+            // If we're reconnecting, we may have caught the old device on its way out
+            if (lostNs && (uiofd < 0 || configfd < 0))
+            {
+                if (uiofd >= 0) close(uiofd);
+                usleep(1000);
+                uioDevice = waitForUioDevice(bdf_);
+                continue;
+            }
+
+            if (uiofd   < 0) throw crash(CRASH_OPEN_PDEVICE);
+            if (configfd < 0) throw crash(CRASH_OPEN_CONFIG);
+        }
 
-        // Open the file that gives us access to the PCI device's confiuration space
-        configfd = open(filename, O_RDWR);
-        if (configfd < 0) throw crash(CRASH_OPEN_CONFIG);
+        // A UIO device is read 4 bytes at a time, an eventfd stand-in 8 bytes at a time
+        notifySize = uioNotificationSize(uiofd);
 
         // Fetch the upper byte of the PCI configuration space command word
-        err = pread(configfd, &commandHigh, 1, 5);
-        if (err != 1) throw crash(CRASH_PREAD_1);
+        if (configfd >= 0)
+        {
+            err = pread(configfd, &commandHigh, 1, 5);
+            if (err != 1) throw crash(CRASH_PREAD_1);
+        }
     
         // Turn off the "Disable interrupts" flag
         commandHigh &= ~0x4;
 
+        // If the device has just come back from a hot-reset, put the controller back the way
+        // it was and pick up any interrupts that happened while we were gone
+        if (lostNs)
+        {
+            try
+            {
+                reconnect(uioDevice);
+            }
+            catch(const std::exception&)
+            {
+                throw crash(CRASH_RECONNECT);
+            }
+
+            // Keep track of how long we were without the device
+            uint64_t us = (nowNs() - lostNs) / 1000;
+            TraceRing::record(TRACE_RECONNECT, 0, us);
+            bump(reconnects_);
+            lastReconnectUs_ = us;
+            if (us > maxReconnectUs_) maxReconnectUs_ = us;
+            lostNs = 0;
+        }
+
+        // In polling mode the device should never interrupt us: we just watch the pending register
+        if (config_.mode == MONITOR_POLLING)
+        {
+            commandHigh |= 0x4;
+            err = (configfd < 0) ? 1 : pwrite(configfd, &commandHigh, 1, 5);
+            if (err != 1) throw crash(CRASH_PREAD_2);
+            if (spinForInterrupts(0)) deviceLost();
+            continue;
+        }
+
         // Loop forever, monitoring incoming interrupt notifications
         while (true)
         {
-            // Enable (or re-enable) interrupts
-            err = pwrite(configfd, &commandHigh, 1, 5);
-            if (err != 1) throw crash(CRASH_PREAD_2);
+            // Enable (or re-enable) interrupts and wait for notification that an interrupt has
+            // occured, either in one trip through the io_uring...
+            uint64_t reenableTsc = readTsc();
+            TraceRing::record(TRACE_REENABLE);
+            if (ring.isOpen())
+            {
+                bool     writeOk, timing = false;
+                uint64_t writeTsc;
+                uint64_t syscalls = ring.syscalls();
+                for (auto handler : handler_) timing |= handler->isTrackingLatency();
+                err = uringReenableAndWait(ring, configfd, &commandHigh, uiofd, &notification,
+                                           notifySize, config_.spinBudgetUs * 1000ULL, &writeOk,
+                                           timing ? &writeTsc : nullptr);
+                bump(syscalls_, ring.syscalls() - syscalls);
+                if (!writeOk) throw crash(CRASH_PREAD_2);
+                if (timing) for (auto handler : handler_) handler->noteReenabled(reenableTsc, writeTsc);
+            }
 
-            // Wait for notification that an interrupt has occured
-            err = read(uiofd, &notification, 4);
+            // ...or with a system call apiece
+            else
+            {
+                err = (configfd < 0) ? 1 : pwrite(configfd, &commandHigh, 1, 5);
+                if (err != 1) throw crash(CRASH_PREAD_2);
+                for (auto handler : handler_) handler->noteReenabled(reenableTsc);
+                err = read(uiofd, &notification, notifySize);
+                bump(syscalls_, (configfd < 0) ? 1 : 2);
+            }
+            for (auto handler : handler_) handler->noteWakeup();
+            TraceRing::record(TRACE_WAKEUP, 0, (uint32_t)notification);
 
-            // If this read fails, it means that a hot-reset of the PCI bus occured
+            // If this read fails, it means that a hot-reset of the PCI bus occured.  Wait for
+            // the device to come back, then start over with it.
             if (err == -1)
             {
-                close(configfd);
-                close(uiofd);
-                usleep(2000000);
+                deviceLost();
                 break;
             }
             
-            // If we didn't read exactly 4 bytes, something is seriously wrong
-            if (err != 4) throw crash(CRASH_READ_LEN);
+            // If we didn't read exactly the right number of bytes, something is seriously wrong
+            if (err != notifySize) throw crash(CRASH_READ_LEN);
 
-            // Give the ISR a chance to handle and clear the interrupts
-            handler_->topLevelHandler();
+            // Keep track of how many times the kernel had to wake us up
+            bump(blockingWakeups_);
+
+            // Give the ISRs a chance to handle and clear the interrupts
+            for (auto handler : handler_) handler->topLevelHandler();
+
+            // If we're in spin-then-block mode, watch for more interrupts before we block again
+            if (config_.mode == MONITOR_SPIN_THEN_BLOCK)
+            {
+                if (spinForInterrupts(config_.spinBudgetUs * 1000ULL)) {deviceLost(); break;}
+            }
         }
     }
 
-    // Call the crash handler, and exit the thread
+    // Call the crash handler
     catch(crash& reason)
     {
         crashHandler(reason.code);
+
+        // Pre-opened file descriptors can't be re-opened, and notifications of the wrong size
+        // won't get any better for trying again, so for those we exit the thread
+        if (uioDevice < 0 || reason.code == CRASH_READ_LEN)
+        {
+            monitorTid_ = 0;
+            return;
+        }
+
+        // Otherwise close whatever we opened, and after a pause (so that a device that stays
+        // broken doesn't keep us spinning) start over
+        if (configfd >= 0) close(configfd);
+        if (uiofd    >= 0) close(uiofd);
+        uiofd = configfd = -1;
+        sleep(1);
     }
 }
 //=================================================================================================
 
 
 
+//=================================================================================================
+// reconnect() - Gets the interrupt controller going again after a hot-reset
+//=================================================================================================
+void UioInterface::reconnect(int uioIndex)
+{
+    // A hot-reset removes the device, which unmaps its BARs.  Map them again.  Since
+    // invalidateShadows(), no other thread has touched the registers, and none will until
+    // restoreConfig() brings the controllers back online.
+    if (pci_)
+    {
+        pci_->open(bdf_);
+        for (size_t i=0; i<handler_.size() && i<pciBaseAddr_.size(); ++i)
+        {
+            handler_[i]->initialize(pci_->bar(pciBar_), pciBaseAddr_[i]);
+        }
+    }
+
+    // The reset cleared the controllers' masks and global enables
+    for (auto handler : handler_) handler->restoreConfig();
+
+    // Service anything that's been counted since the controllers came back
+    for (auto handler : handler_) handler->topLevelHandler();
+
+    // The device may have come back with a different host IRQ
+    hostIrq_ = getUioHostIrq(uioIndex);
+    int irqCpu = placement_.irqCpu;
+    if (irqCpu == thread_placement_t::IRQ_SAME_CPU) irqCpu = placement_.cpu;
+    if (irqCpu >= 0 && !steerHostIrq(hostIrq_, irqCpu).empty()) bump(steerFailures_);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// spinForInterrupts() - Repeatedly reads the interrupt controller's pending register, servicing
+//                       interrupts as they show up, until "budgetNs" nanoseconds have passed
+//                       since the last one.  A budget of 0 means "spin forever".
+//                       Returns true if the device has gone away.
+//
+// Between empty reads of the pending register we back off exponentially, so that we aren't
+// flooding the PCIe link with non-posted reads.  With status writeback on, we look at the
+// status ring in host memory instead of the pending register.
+//
+// A device lost in a hot-reset reads as all-ones, which would otherwise look like 32 pending
+// IRQs.  The status ring never shows us that, so every SPIN_PRESENCE_MS of empty polls we read
+// the controller to make sure it's still there.
+//=================================================================================================
+bool UioInterface::spinForInterrupts(uint64_t budgetNs)
+{
+    uint32_t backoff  = config_.minBackoff;
+    uint64_t now      = nowNs();
+    uint64_t lastHit  = now;
+    uint64_t lastSeen = now;
+
+    while (budgetNs == 0 || now - lastHit < budgetNs)
+    {
+        uint64_t then = now;
+
+        // If there are interrupts pending, service them and start a new spin window
+        bool hit = false;
+        for (auto handler : handler_)
+        {
+            uint32_t waiting = handler->getWaitingIrqs();
+            if (waiting == 0xFFFFFFFF && !handler->isControllerPresent()) return true;
+            if (waiting == 0) continue;
+            if (!hit) TraceRing::record(TRACE_WAKEUP, 1);
+            handler->noteWakeup();
+            handler->topLevelHandler();
+            hit = true;
+        }
+
+        if (hit)
+        {
+            bump(spinDispatches_);
+            backoff = config_.minBackoff;
+            now = lastHit = nowNs();
+        }
+
+        // Otherwise, wait a little longer each time before we look again
+        else
+        {
+            bump(emptyPolls_);
+            for (uint32_t i=0; i<backoff; ++i) cpuRelax();
+            backoff = (backoff * 2 > config_.maxBackoff) ? config_.maxBackoff : backoff * 2;
+            now = nowNs();
+        }
+
+        // Every so often, make sure the device is still there
+        if (now - lastSeen >= SPIN_PRESENCE_MS * 1000000ULL)
+        {
+            for (auto handler : handler_) if (!handler->isControllerPresent()) return true;
+            lastSeen = now;
+        }
+
+        // Keep track of how much time we've spent spinning
+        bump(spinNs_, now - then);
+    }
+
+    return false;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// getMonitorStats() - Returns the monitor configuration and statistics
+//=================================================================================================
+UioInterface::monitor_stats_t UioInterface::getMonitorStats()
+{
+    monitor_stats_t stats;
+
+    stats.config          = config_;
+    stats.blockingWakeups = blockingWakeups_;
+    stats.spinDispatches  = spinDispatches_;
+    stats.emptyPolls      = emptyPolls_;
+    stats.spinNs          = spinNs_;
+    stats.reconnects      = reconnects_;
+    stats.lastReconnectUs = lastReconnectUs_;
+    stats.maxReconnectUs  = maxReconnectUs_;
+    stats.syscalls        = syscalls_;
+    stats.ioUring         = ioUring_;
+    stats.steerFailures   = steerFailures_;
+
+    return stats;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// getPlacement() - Reports where the monitor thread and the device's host IRQ are running
+//=================================================================================================
+placement_status_t UioInterface::getPlacement()
+{
+    placement_status_t status;
+
+    status.requested = placement_;
+    status.policy    = status.priority = -1;
+    status.hostIrq   = hostIrq_;
+
+    // If there's a monitor thread, find out where it is
+    pid_t tid = monitorTid_;
+    if (tid) queryPlacement(tid, hostIrq_, status);
+
+    return status;
+}
+//=================================================================================================
+
+
 //=================================================================================================
 // crashHandler() - Default crash handler - gets called if monitorInterrupts() crashes
 //=================================================================================================
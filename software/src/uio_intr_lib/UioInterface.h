@@ -1,10 +1,15 @@
-
 //=================================================================================================
 // UioInterface.h - Defines an interface to the Linux Userspace-I/O subsystem
 //=================================================================================================
 #pragma once
 #include <string>
+#include <vector>
+#include <atomic>
+#include <future>
 #include "IntrControlBase.h"
+#include "UioReactor.h"
+#include "ThreadPlacement.h"
+#include "PciDevice.h"
 
 //-------------------------------------------------------------------
 // This class manages the Linux Userspace I/O subsystem to receive
@@ -14,19 +19,170 @@ class UioInterface
 {
 public:
 
-    // Initializes the Linux Userspace-I/O subsystem
-    void    initialize(std::string device, IntrControlBase* pHandler);
+    // These are the ways that the monitor thread can wait for interrupts
+    enum monitor_mode_t
+    {
+        // Block in read() until the kernel notifies us of an interrupt
+        MONITOR_BLOCKING        = 0,
+
+        // After each interrupt, spin on the pending register for a while before blocking
+        MONITOR_SPIN_THEN_BLOCK = 1,
+
+        // Never block: spin on the pending register forever with interrupts disabled
+        MONITOR_POLLING         = 2,
+
+        // Like MONITOR_BLOCKING, but the re-enable and the wait are submitted to an io_uring
+        // together, so each interrupt costs at most one system call.  If io_uring isn't
+        // available, this quietly becomes MONITOR_BLOCKING.
+        MONITOR_IO_URING        = 3
+    };
+
+    // This describes how the monitor thread waits for interrupts
+    struct monitor_config_t
+    {
+        monitor_mode_t mode;
+
+        // In MONITOR_SPIN_THEN_BLOCK mode, how long to spin after the most recent interrupt
+        uint32_t       spinBudgetUs;
+
+        // Between reads of the pending register, we execute between "minBackoff" and
+        // "maxBackoff" cpuRelax() instructions, doubling every time nothing is pending
+        uint32_t       minBackoff;
+        uint32_t       maxBackoff;
+
+        // In MONITOR_IO_URING mode, have a kernel thread poll the submission queue, and spin on
+        // the completion queue for up to "spinBudgetUs" before asking the kernel to wait
+        bool           sqPoll;
+    };
+
+    // Statistics that describe how the monitor thread has been spending its time
+    struct monitor_stats_t
+    {
+        monitor_config_t config;
+
+        // How many times a blocking read() woke us up
+        uint64_t       blockingWakeups;
+
+        // How many times we found interrupts pending while spinning or polling
+        uint64_t       spinDispatches;
+
+        // How many times we read the pending register and found nothing
+        uint64_t       emptyPolls;
+
+        // Total nanoseconds spent spinning (i.e., CPU time traded for latency)
+        uint64_t       spinNs;
+
+        // How many times we've reconnected to the device after a hot-reset, and how long
+        // (in microseconds) the most recent and the longest of those took, from the moment
+        // we lost the device to the moment interrupts were enabled again
+        uint64_t       reconnects;
+        uint64_t       lastReconnectUs;
+        uint64_t       maxReconnectUs;
+
+        // The system calls made to re-enable interrupts and wait for them (syscalls divided by
+        // blockingWakeups is the cost per interrupt), and whether they went through an io_uring
+        uint64_t       syscalls;
+        bool           ioUring;
+
+        // How many times, after a reconnect, the host IRQ couldn't be steered back to the CPU
+        // it was placed on
+        uint64_t       steerFailures;
+    };
+
+    // Initializes the Linux Userspace-I/O subsystem.  If a reactor is supplied, the device
+    // is registered with it instead of being given a monitor thread of its own
+    void    initialize(std::string device, IntrControlBase* pHandler, UioReactor* reactor = nullptr);
+
+    // Initializes the Linux Userspace-I/O subsystem for a device that contains several interrupt
+    // controllers that share its interrupt.  Each wakeup services all of them, in order.
+    void    initialize(std::string device, const std::vector<IntrControlBase*>& handlers);
+
+    // Monitors an already open notification fd (a /dev/uioN or an eventfd stand-in) and PCI
+    // config-space fd (or a regular file that stands in for one, or -1) instead of a device
+    // found by name.  This is how the monitor is driven by a software model of the hardware.
+    void    initialize(int uiofd, int configfd, IntrControlBase* pHandler);
+
+    // Selects how the monitor thread waits for interrupts.  Call this before initialize()
+    void    setMonitorConfig(const monitor_config_t& config) {config_ = config;}
+
+    // Returns the monitor configuration and how the monitor thread has been spending its time
+    monitor_stats_t getMonitorStats();
+
+    // Selects the CPU and scheduling policy of the monitor thread, and the CPU that services
+    // the device's host IRQ.  Call this before initialize(), which throws if any part of the
+    // placement can't be applied
+    void    setPlacement(const thread_placement_t& placement) {placement_ = placement;}
+
+    // Reports where the monitor thread and the host IRQ are actually running
+    placement_status_t getPlacement();
+
+    // If the device's BARs are mapped through "pci", a hot-reset unmaps them.  When this has
+    // been called, the monitor re-opens "pci" when the device comes back and points the
+    // handler at BAR "bar" + "baseAddress" again, before it touches any registers.
+    void    setPciDevice(PciDevice* pci, uint32_t baseAddress, int bar = 0)
+    {
+        pci_ = pci; pciBaseAddr_ = {baseAddress}; pciBar_ = bar;
+    }
+
+    // The same, for a device with several interrupt controllers: baseAddress[i] is the base
+    // address of the controller serviced by the i'th handler
+    void    setPciDevice(PciDevice* pci, const std::vector<uint32_t>& baseAddress, int bar = 0)
+    {
+        pci_ = pci; pciBaseAddr_ = baseAddress; pciBar_ = bar;
+    }
 
     // This gets called if "monitorInterrupts" crashes.  Override this!
     virtual void crashHandler(int reason);
 
 protected:
 
-    // This runs in its own thread
-    void    monitorInterrupts(int uioDevice);
+    // Binds the device to the UIO subsystem (if it isn't already) and returns its UIO index
+    int     openUioDevice(std::string device);
+
+    // Steers the host IRQ and spawns the monitor thread
+    void    startMonitor(int uioIndex, std::string device);
+
+    // This runs in its own thread.  It reports how applying "placement_" went via "placed".
+    // A uioDevice of -1 means "use uiofd_ and configfd_"
+    void    monitorInterrupts(int uioDevice, std::promise<std::string>* placed);
 
-    // This points to the class that will serve as an interrupt handler
-    IntrControlBase* handler_;
+    // Called by the monitor thread once the device is back after a hot-reset, before
+    // interrupts are re-enabled
+    void    reconnect(int uioIndex);
+
+    // Services interrupts by spinning on the pending register until "budgetNs" nanoseconds
+    // have passed without an interrupt.  A budget of 0 means "spin forever".  Returns true
+    // if the device went away while we were spinning.
+    enum {SPIN_PRESENCE_MS = 1};
+    bool    spinForInterrupts(uint64_t budgetNs);
+
+    // These point to the classes that will serve as interrupt handlers
+    std::vector<IntrControlBase*> handler_;
+
+    // Determines how the monitor thread waits for interrupts
+    monitor_config_t config_ = {MONITOR_BLOCKING, 50, 1, 64, false};
+
+    // If we were handed pre-opened file descriptors, these are them
+    int     uiofd_ = -1, configfd_ = -1;
+
+    // The BDF of the device, so that we can find it again after a hot-reset
+    std::string bdf_;
+
+    // If this isn't nullptr, it's re-opened after a hot-reset
+    PciDevice* pci_ = nullptr;
+    std::vector<uint32_t> pciBaseAddr_;
+    int        pciBar_ = 0;
+
+    // Where the monitor thread and host IRQ should run, and the kernel thread ID of the
+    // monitor thread while it's running
+    thread_placement_t placement_;
+    std::atomic<pid_t> monitorTid_{0};
+    int                hostIrq_ = -1;
+
+    // These are only ever written by the monitor thread
+    std::atomic<uint64_t> blockingWakeups_{0}, spinDispatches_{0}, emptyPolls_{0}, spinNs_{0};
+    std::atomic<uint64_t> reconnects_{0}, lastReconnectUs_{0}, maxReconnectUs_{0};
+    std::atomic<uint64_t> syscalls_{0}, steerFailures_{0};
+    std::atomic<bool>     ioUring_{false};
 };
 //-------------------------------------------------------------------
-
@@ -0,0 +1,321 @@
+//=================================================================================================
+// UioReactor.cpp - Implements an epoll-based reactor that services the interrupts of many UIO
+//                  devices from a small, fixed number of threads
+//=================================================================================================
+#include <unistd.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <stdexcept>
+#include "UioReactor.h"
+
+//==========================================================================================================
+// This is a list of reasons that a device can be dropped by the reactor
+//==========================================================================================================
+enum
+{
+    FAIL_ENABLE    = 1,
+    FAIL_READ      = 2,
+    FAIL_READ_LEN  = 3
+};
+//==========================================================================================================
+
+
+//=================================================================================================
+// throwRuntime() - Throws a runtime exception
+//=================================================================================================
+static void throwRuntime(const char* fmt, ...)
+{
+    char buffer[1024];
+    va_list ap;
+    va_start(ap, fmt);
+    vsprintf(buffer, fmt, ap);
+    va_end(ap);
+
+    throw std::runtime_error(buffer);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// uioNotificationSize() - A read() of /dev/uioN must ask for exactly 4 bytes, a read() of an
+//                         eventfd must ask for exactly 8.  This tells us which one "fd" is.
+//=================================================================================================
+int uioNotificationSize(int fd)
+{
+    struct stat st;
+
+    // If we can't stat it, assume it's a genuine UIO device
+    if (fstat(fd, &st) < 0) return 4;
+
+    // UIO devices are character devices, eventfds are anonymous inodes
+    return S_ISCHR(st.st_mode) ? 4 : 8;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// Destructor - Stops the reactor threads and closes every device's file descriptors
+//=================================================================================================
+UioReactor::~UioReactor()
+{
+    stop();
+
+    for (auto& device : device_)
+    {
+        if (device->configfd >= 0) close(device->configfd);
+        close(device->uiofd);
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// addDevice() - Opens /dev/uio<uioIndex> and its PCI config-space file and registers them
+//=================================================================================================
+void UioReactor::addDevice(int uioIndex, IntrControlBase* handler)
+{
+    char filename[64];
+
+    // Generate the filename of the psuedo-file that notifies us of interrupts
+    sprintf(filename, "/dev/uio%d", uioIndex);
+
+    // Open the psuedo-file that notifies us of interrupts
+    int uiofd = open(filename, O_RDONLY);
+    if (uiofd < 0) throwRuntime("Can't open %s", filename);
+
+    // Generate the filename of the PCI config-space psuedo-file
+    sprintf(filename, "/sys/class/uio/uio%d/device/config", uioIndex);
+
+    // Open the file that gives us access to the PCI device's configuration space
+    int configfd = open(filename, O_RDWR);
+    if (configfd < 0)
+    {
+        close(uiofd);
+        throwRuntime("Can't open %s", filename);
+    }
+
+    // And register the pair of them
+    addDevice(uiofd, configfd, handler);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// addDevice() - Registers an already open notification fd and config-space fd
+//
+// Passed: uiofd    = /dev/uioN, or an eventfd that stands in for one
+//         configfd = the PCI config-space file of the device, or -1 if there isn't one
+//         handler  = the interrupt controller whose topLevelHandler() we call
+//=================================================================================================
+void UioReactor::addDevice(int uiofd, int configfd, IntrControlBase* handler)
+{
+    uint8_t commandHigh = 0;
+
+    // Devices are assigned to threads in start(), so they have to be added before then
+    if (isRunning()) throwRuntime("Can't add a device to a running UioReactor");
+
+    // Fetch the upper byte of the PCI configuration space command word
+    if (configfd >= 0 && pread(configfd, &commandHigh, 1, 5) != 1)
+    {
+        throwRuntime("Can't read PCI config-space of device");
+    }
+
+    // Turn off the "Disable interrupts" flag
+    commandHigh &= ~0x4;
+
+    // Append this device to our list of devices
+    device_.push_back(std::unique_ptr<device_t>
+    (
+        new device_t {uiofd, configfd, uioNotificationSize(uiofd), commandHigh, handler}
+    ));
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// enableInterrupts() - Enables (or re-enables) PCI legacy interrupts for the specified device.
+//                      Returns false if that couldn't be done.
+//=================================================================================================
+bool UioReactor::enableInterrupts(device_t& device)
+{
+    // eventfd stand-ins have no config-space that needs to be written
+    if (device.configfd < 0) return true;
+
+    // Clear the "disable interrupts" bit in the command word
+    return pwrite(device.configfd, &device.commandHigh, 1, 5) == 1;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// start() - Distributes the devices among "threadCount" epoll instances and starts a reactor
+//           thread for each one
+//=================================================================================================
+void UioReactor::start(int threadCount)
+{
+    // If we're already running, there is nothing to do
+    if (isRunning()) return;
+
+    // There is no point in having more threads than devices
+    if (threadCount > (int)device_.size()) threadCount = device_.size();
+    if (threadCount < 1) threadCount = 1;
+
+    // If anything goes wrong part way through, stop() closes whatever we've created (and joins
+    // any threads we've started), so that nothing leaks and a retry starts from scratch
+    try
+    {
+        // Create the eventfd that tells every thread to exit
+        stopfd_ = eventfd(0, EFD_CLOEXEC);
+        if (stopfd_ < 0) throwRuntime("Can't create eventfd");
+        stopping_ = false;
+
+        // Create one epoll instance per thread, each of which watches the "stop" eventfd
+        for (int i=0; i<threadCount; ++i)
+        {
+            int epollfd = epoll_create1(EPOLL_CLOEXEC);
+            if (epollfd < 0) throwRuntime("Can't create epoll instance");
+
+            epoll_event event = {};
+            event.events   = EPOLLIN;
+            event.data.ptr = nullptr;
+            epoll_ctl(epollfd, EPOLL_CTL_ADD, stopfd_, &event);
+
+            epollfd_.push_back(epollfd);
+        }
+
+        // Hand out the devices to the epoll instances round-robin
+        for (size_t i=0; i<device_.size(); ++i)
+        {
+            device_t& device = *device_[i];
+
+            // Make sure the device is able to interrupt us
+            if (!enableInterrupts(device)) throwRuntime("Can't enable interrupts on UIO device");
+
+            // And add it to the list of file descriptors its thread watches
+            epoll_event event = {};
+            event.events   = EPOLLIN;
+            event.data.ptr = &device;
+            if (epoll_ctl(epollfd_[i % threadCount], EPOLL_CTL_ADD, device.uiofd, &event) < 0)
+            {
+                throwRuntime("Can't add UIO device to epoll instance");
+            }
+        }
+
+        // Spawn the reactor threads
+        for (int epollfd : epollfd_)
+        {
+            threads_.push_back(std::thread(&UioReactor::runReactor, this, epollfd));
+        }
+    }
+    catch(...)
+    {
+        stop();
+        throw;
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// stop() - Wakes every reactor thread, waits for them to exit, and releases their resources
+//=================================================================================================
+void UioReactor::stop()
+{
+    uint64_t one = 1;
+
+    // If we're not running, there's nothing to do
+    if (stopfd_ < 0) return;
+
+    // Tell the threads to exit and wake them up
+    stopping_ = true;
+    if (write(stopfd_, &one, sizeof one) != sizeof one) perror("UioReactor::stop");
+
+    // Wait for all of them to exit
+    for (auto& th : threads_) if (th.joinable()) th.join();
+    threads_.clear();
+
+    // Release the epoll instances
+    for (int epollfd : epollfd_) close(epollfd);
+    epollfd_.clear();
+
+    // And the "stop" eventfd
+    close(stopfd_);
+    stopfd_ = -1;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// runReactor() - Waits for interrupt notifications from any of the devices watched by "epollfd"
+//                and hands each notification to that device's interrupt handler
+//=================================================================================================
+void UioReactor::runReactor(int epollfd)
+{
+    const int MAX_EVENTS = 16;
+    epoll_event event[MAX_EVENTS];
+    uint64_t    notification;
+
+    while (!stopping_)
+    {
+        // Wait for one or more of our devices to notify us of an interrupt
+        int count = epoll_wait(epollfd, event, MAX_EVENTS, -1);
+
+        // Being interrupted by a signal is harmless
+        if (count < 0) continue;
+
+        // Loop through each device that has a notification waiting
+        for (int i=0; i<count; ++i)
+        {
+            device_t* device = (device_t*)event[i].data.ptr;
+
+            // A nullptr is the "stop" eventfd
+            if (device == nullptr) continue;
+
+            // Consume the notification
+            int err = read(device->uiofd, &notification, device->notifySize);
+            device->handler->noteWakeup();
+            TraceRing::record(TRACE_WAKEUP, 0, (uint32_t)notification);
+
+            // If this read fails, it means that a hot-reset of the PCI bus occured
+            if (err != device->notifySize)
+            {
+                epoll_ctl(epollfd, EPOLL_CTL_DEL, device->uiofd, nullptr);
+                deviceFailed(device->handler, err < 0 ? FAIL_READ : FAIL_READ_LEN);
+                continue;
+            }
+
+            // Give the ISR a chance to handle and clear the interrupts
+            device->handler->topLevelHandler();
+
+            // And re-enable interrupts for this device
+            uint64_t reenableTsc = readTsc();
+            TraceRing::record(TRACE_REENABLE);
+            if (!enableInterrupts(*device))
+            {
+                epoll_ctl(epollfd, EPOLL_CTL_DEL, device->uiofd, nullptr);
+                deviceFailed(device->handler, FAIL_ENABLE);
+                continue;
+            }
+            device->handler->noteReenabled(reenableTsc);
+        }
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// deviceFailed() - Default failure handler - gets called when a device has to be dropped
+//=================================================================================================
+void UioReactor::deviceFailed(IntrControlBase* handler, int reason)
+{
+    // Find out which of our devices it was
+    size_t index = 0;
+    while (index < device_.size() && device_[index]->handler != handler) ++index;
+
+    printf("UIO reactor dropped device %zu! reason = %d\n", index, reason);
+}
+//=================================================================================================
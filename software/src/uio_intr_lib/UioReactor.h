@@ -0,0 +1,90 @@
+//=================================================================================================
+// UioReactor.h - Defines an epoll-based reactor that services the interrupts of many UIO devices
+//                from a small, fixed number of threads
+//=================================================================================================
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "IntrControlBase.h"
+
+// Returns the number of bytes a read() of "fd" must ask for: 4 for /dev/uioN, 8 for an eventfd
+int uioNotificationSize(int fd);
+
+//-------------------------------------------------------------------
+// Instead of one blocking thread per device, each reactor thread
+// waits in epoll_wait() on the notification file descriptors of
+// every device assigned to it, and calls the topLevelHandler() of
+// whichever devices are ready.
+//
+// Devices are assigned to threads round-robin when start() is
+// called, so every device is only ever serviced by one thread.
+//-------------------------------------------------------------------
+class UioReactor
+{
+public:
+
+    // Default constructor
+    UioReactor() {};
+
+    // Destructor - Stops the reactor threads and closes the device file descriptors
+    virtual ~UioReactor();
+
+    // No copy or assignment constructor - objects of this class can't be copied
+    UioReactor (const UioReactor&) = delete;
+    UioReactor& operator= (const UioReactor&) = delete;
+
+    // Registers the device at /dev/uio<uioIndex>
+    void    addDevice(int uioIndex, IntrControlBase* handler);
+
+    // Registers an already open notification fd (a /dev/uioN or an eventfd stand-in)
+    // and PCI config-space fd (or -1 if there isn't one).  The reactor takes ownership
+    // of both file descriptors.
+    void    addDevice(int uiofd, int configfd, IntrControlBase* handler);
+
+    // Starts the specified number of reactor threads
+    void    start(int threadCount = 1);
+
+    // Stops and joins all of the reactor threads
+    void    stop();
+
+    // Returns true if the reactor threads are running
+    bool    isRunning() {return !threads_.empty();}
+
+    // This gets called if a device's notification fd fails.  Override this!
+    virtual void deviceFailed(IntrControlBase* handler, int reason);
+
+protected:
+
+    // One of these exists for every registered device
+    struct device_t
+    {
+        int              uiofd;
+        int              configfd;
+        int              notifySize;
+        uint8_t          commandHigh;
+        IntrControlBase* handler;
+    };
+
+    // This runs in each reactor thread
+    void    runReactor(int epollfd);
+
+    // Enables (or re-enables) PCI legacy interrupts for the specified device
+    bool    enableInterrupts(device_t& device);
+
+    // One entry per registered device
+    std::vector<std::unique_ptr<device_t>> device_;
+
+    // One entry per reactor thread, and the epoll fd each of them waits on
+    std::vector<std::thread> threads_;
+    std::vector<int>         epollfd_;
+
+    // Writing to this eventfd wakes every reactor thread so that it can exit
+    int     stopfd_ = -1;
+
+    // This is set to true when the reactor threads should exit
+    std::atomic<bool> stopping_{false};
+};
+//-------------------------------------------------------------------
@@ -0,0 +1,449 @@
+//=================================================================================================
+// VfioInterface.cpp - Implements an interface to the Linux VFIO subsystem that receives MSI or
+//                     MSI-X interrupts from a PCI device, one eventfd per vector
+//=================================================================================================
+#include <unistd.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <linux/vfio.h>
+#include <stdexcept>
+#include "VfioInterface.h"
+
+
+//=================================================================================================
+// throwRuntime() - Throws a runtime exception
+//=================================================================================================
+static void throwRuntime(const char* fmt, ...)
+{
+    char buffer[1024];
+    va_list ap;
+    va_start(ap, fmt);
+    vsprintf(buffer, fmt, ap);
+    va_end(ap);
+
+    throw std::runtime_error(buffer);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// Destructor - Stops the dispatch threads and releases everything we've opened or mapped
+//=================================================================================================
+VfioInterface::~VfioInterface()
+{
+    stop();
+
+    for (auto& vector : vector_) close(vector.eventfd);
+
+    for (int i=0; i<6; ++i) if (bar_[i]) munmap(bar_[i], barSize_[i]);
+
+    if (devicefd_    >= 0) close(devicefd_);
+    if (groupfd_     >= 0) close(groupfd_);
+    if (containerfd_ >= 0) close(containerfd_);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// open() - Attaches the device's IOMMU group to a new VFIO container, fetches the device, and
+//          finds out what kind of message-signalled interrupts it supports
+//=================================================================================================
+void VfioInterface::open(std::string bdf)
+{
+    char path[PATH_MAX], link[PATH_MAX];
+
+    // Find out which IOMMU group the device belongs to
+    sprintf(path, "/sys/bus/pci/devices/%s/iommu_group", bdf.c_str());
+    int len = readlink(path, link, sizeof(link) - 1);
+    if (len < 0) throwRuntime("Can't find the IOMMU group of %s", bdf.c_str());
+    link[len] = 0;
+    const char* group = strrchr(link, '/');
+    group = group ? group + 1 : link;
+
+    // Create a container
+    containerfd_ = ::open("/dev/vfio/vfio", O_RDWR | O_CLOEXEC);
+    if (containerfd_ < 0) throwRuntime("Can't open /dev/vfio/vfio");
+    if (ioctl(containerfd_, VFIO_GET_API_VERSION) != VFIO_API_VERSION)
+    {
+        throwRuntime("Unknown VFIO API version");
+    }
+    if (!ioctl(containerfd_, VFIO_CHECK_EXTENSION, VFIO_TYPE1_IOMMU))
+    {
+        throwRuntime("VFIO doesn't support the type-1 IOMMU");
+    }
+
+    // Open the group.  It's only usable if every device in it is bound to VFIO.
+    snprintf(path, sizeof path, "/dev/vfio/%s", group);
+    groupfd_ = ::open(path, O_RDWR | O_CLOEXEC);
+    if (groupfd_ < 0) throwRuntime("Can't open %s", path);
+    vfio_group_status status = {};
+    status.argsz = sizeof status;
+    ioctl(groupfd_, VFIO_GROUP_GET_STATUS, &status);
+    if (!(status.flags & VFIO_GROUP_FLAGS_VIABLE))
+    {
+        throwRuntime("IOMMU group %s has devices that aren't bound to vfio-pci", group);
+    }
+
+    // Put the group in the container and give the container an IOMMU
+    if (ioctl(groupfd_, VFIO_GROUP_SET_CONTAINER, &containerfd_) < 0)
+    {
+        throwRuntime("Can't add IOMMU group %s to a VFIO container", group);
+    }
+    if (ioctl(containerfd_, VFIO_SET_IOMMU, VFIO_TYPE1_IOMMU) < 0)
+    {
+        throwRuntime("Can't set the VFIO IOMMU type");
+    }
+    loadIovaRanges();
+
+    // Fetch the device itself
+    devicefd_ = ioctl(groupfd_, VFIO_GROUP_GET_DEVICE_FD, bdf.c_str());
+    if (devicefd_ < 0) throwRuntime("Can't get VFIO device %s", bdf.c_str());
+
+    // We prefer MSI-X, but will settle for MSI
+    for (int index : {VFIO_PCI_MSIX_IRQ_INDEX, VFIO_PCI_MSI_IRQ_INDEX})
+    {
+        vfio_irq_info info = {};
+        info.argsz = sizeof info;
+        info.index = index;
+        if (ioctl(devicefd_, VFIO_DEVICE_GET_IRQ_INFO, &info) == 0 && info.count > 0)
+        {
+            irqIndex_         = index;
+            vectorsSupported_ = info.count;
+            break;
+        }
+    }
+    if (irqIndex_ < 0) throwRuntime("%s doesn't support MSI or MSI-X", bdf.c_str());
+
+    // Message-signalled interrupts are memory writes, so the device has to be a bus-master
+    vfio_region_info config = {};
+    config.argsz = sizeof config;
+    config.index = VFIO_PCI_CONFIG_REGION_INDEX;
+    uint16_t command;
+    if (ioctl(devicefd_, VFIO_DEVICE_GET_REGION_INFO, &config) < 0
+    ||  pread(devicefd_, &command, 2, config.offset + 4) != 2)
+    {
+        throwRuntime("Can't read the PCI config-space of %s", bdf.c_str());
+    }
+    command |= 0x4;
+    if (pwrite(devicefd_, &command, 2, config.offset + 4) != 2)
+    {
+        throwRuntime("Can't enable bus-mastering on %s", bdf.c_str());
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// bar() - Maps one of the device's BARs into userspace (the first time it's asked for)
+//=================================================================================================
+uint8_t* VfioInterface::bar(int index)
+{
+    if (index < 0 || index > 5) throwRuntime("No such BAR %d", index);
+
+    // If we've already mapped this BAR, we're done
+    if (bar_[index]) return bar_[index];
+
+    // Find out where in the device fd the BAR lives
+    vfio_region_info region = {};
+    region.argsz = sizeof region;
+    region.index = VFIO_PCI_BAR0_REGION_INDEX + index;
+    if (ioctl(devicefd_, VFIO_DEVICE_GET_REGION_INFO, &region) < 0 || region.size == 0)
+    {
+        throwRuntime("Can't get information about BAR %d", index);
+    }
+    if (!(region.flags & VFIO_REGION_INFO_FLAG_MMAP)) throwRuntime("BAR %d can't be mapped", index);
+
+    // And map it
+    void* ptr = mmap(0, region.size, PROT_READ | PROT_WRITE, MAP_SHARED, devicefd_, region.offset);
+    if (ptr == MAP_FAILED) throwRuntime("Can't map BAR %d", index);
+
+    barSize_[index] = region.size;
+    return bar_[index] = (uint8_t*)ptr;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// loadIovaRanges() - Asks the IOMMU which bus addresses it can map.  The answer is a capability
+//                    that follows the info struct, so we ask once to find out how big the whole
+//                    thing is, and again to fetch it.
+//
+// Kernels older than 5.4 don't report the ranges.  For those we assume the narrowest address
+// width that IOMMUs commonly have (39 bits), less the x86 MSI window.
+//=================================================================================================
+void VfioInterface::loadIovaRanges()
+{
+    std::vector<uint8_t> buffer(sizeof(vfio_iommu_type1_info));
+    vfio_iommu_type1_info* info = (vfio_iommu_type1_info*)buffer.data();
+    info->argsz = buffer.size();
+    if (ioctl(containerfd_, VFIO_IOMMU_GET_INFO, info) < 0) throwRuntime("Can't get IOMMU information");
+
+    if (info->argsz > buffer.size())
+    {
+        buffer.resize(info->argsz);
+        info = (vfio_iommu_type1_info*)buffer.data();
+        if (ioctl(containerfd_, VFIO_IOMMU_GET_INFO, info) < 0) throwRuntime("Can't get IOMMU information");
+    }
+
+    // Bus addresses are handed out in multiples of the smallest page the IOMMU can map
+    if ((info->flags & VFIO_IOMMU_INFO_PGSIZES) && info->iova_pgsizes)
+    {
+        iovaPageSize_ = info->iova_pgsizes & -info->iova_pgsizes;
+    }
+
+    // Walk the capability chain looking for the IOVA ranges
+    freeIova_.clear();
+    uint32_t offset = (info->flags & VFIO_IOMMU_INFO_CAPS) ? info->cap_offset : 0;
+    while (offset && offset + sizeof(vfio_info_cap_header) <= buffer.size())
+    {
+        auto header = (vfio_info_cap_header*)(buffer.data() + offset);
+        if (header->id == VFIO_IOMMU_TYPE1_INFO_CAP_IOVA_RANGE)
+        {
+            auto cap = (vfio_iommu_type1_info_cap_iova_range*)header;
+            for (uint32_t i=0; i<cap->nr_iovas; ++i)
+            {
+                uint64_t start = cap->iova_ranges[i].start, end = cap->iova_ranges[i].end;
+                if (end != UINT64_MAX) freeIova_[start] = end + 1; else freeIova_[start] = end;
+            }
+            break;
+        }
+        offset = header->next;
+    }
+
+    if (freeIova_.empty())
+    {
+        freeIova_[0]          = 0xFEE00000;
+        freeIova_[0xFEF00000] = 1ull << 39;
+    }
+
+    // Bus address 0 looks too much like a null pointer to hand out
+    auto first = freeIova_.begin();
+    if (first->first == 0)
+    {
+        uint64_t end = first->second;
+        freeIova_.erase(first);
+        if (end > iovaPageSize_) freeIova_[iovaPageSize_] = end;
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// mapDma() - Maps a buffer through the IOMMU so the device can read and write it, at the first
+//            free bus address that's big enough
+//=================================================================================================
+uint64_t VfioInterface::mapDma(void* buffer, size_t size)
+{
+    // The mapping is made in whole IOMMU pages
+    size = (size + iovaPageSize_ - 1) & ~(iovaPageSize_ - 1);
+
+    // Find a free range the buffer fits in
+    uint64_t iova = 0;
+    for (auto& range : freeIova_)
+    {
+        uint64_t start = (range.first + iovaPageSize_ - 1) & ~(iovaPageSize_ - 1);
+        if (start < range.second && range.second - start >= size) {iova = start; break;}
+    }
+    if (iova == 0) throwRuntime("No room in the IOMMU to map %lu bytes for DMA", size);
+
+    vfio_iommu_type1_dma_map map = {};
+    map.argsz = sizeof map;
+    map.flags = VFIO_DMA_MAP_FLAG_READ | VFIO_DMA_MAP_FLAG_WRITE;
+    map.vaddr = (uint64_t)buffer;
+    map.iova  = iova;
+    map.size  = size;
+
+    if (ioctl(containerfd_, VFIO_IOMMU_MAP_DMA, &map) < 0) throwRuntime("Can't map buffer for DMA");
+
+    // Take the mapping out of the free range it came from
+    auto     range = std::prev(freeIova_.upper_bound(iova));
+    uint64_t start = range->first, end = range->second;
+    freeIova_.erase(range);
+    if (start < iova) freeIova_[start] = iova;
+    if (iova + size < end) freeIova_[iova + size] = end;
+
+    dmaSize_[iova] = size;
+    return iova;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// unmapDma() - Unmaps a buffer that mapDma() mapped, and gives its bus addresses back
+//=================================================================================================
+void VfioInterface::unmapDma(uint64_t iova)
+{
+    auto mapping = dmaSize_.find(iova);
+    if (mapping == dmaSize_.end()) throwRuntime("Nothing is mapped for DMA at 0x%lx", iova);
+    uint64_t size = mapping->second;
+
+    vfio_iommu_type1_dma_unmap unmap = {};
+    unmap.argsz = sizeof unmap;
+    unmap.iova  = iova;
+    unmap.size  = size;
+
+    if (ioctl(containerfd_, VFIO_IOMMU_UNMAP_DMA, &unmap) < 0) throwRuntime("Can't unmap DMA buffer at 0x%lx", iova);
+    dmaSize_.erase(mapping);
+
+    // Give the range back, merging it with the free ranges on either side
+    uint64_t start = iova, end = iova + size;
+    auto next = freeIova_.lower_bound(start);
+    if (next != freeIova_.end() && next->first == end)
+    {
+        end = next->second;
+        next = freeIova_.erase(next);
+    }
+    if (next != freeIova_.begin() && std::prev(next)->second == start)
+    {
+        start = std::prev(next)->first;
+        freeIova_.erase(std::prev(next));
+    }
+    freeIova_[start] = end;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// addVector() - Assigns a group of IRQs to the next vector
+//=================================================================================================
+void VfioInterface::addVector(uint32_t irqGroup, IntrControlBase* handler, int eventfd)
+{
+    // The vectors are handed to the device in start(), so they have to be added before then
+    if (isRunning()) throwRuntime("Can't add a vector to a running VfioInterface");
+
+    // If the caller didn't supply a stand-in, create the eventfd the device will signal.  If
+    // they did, it's theirs to close, so we keep a duplicate of our own.
+    if (eventfd >= 0)
+        eventfd = fcntl(eventfd, F_DUPFD_CLOEXEC, 0);
+    else
+        eventfd = ::eventfd(0, EFD_CLOEXEC);
+    if (eventfd < 0) throwRuntime("Can't create eventfd");
+
+    vector_.push_back({irqGroup, handler, eventfd});
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// setIrqs() - Tells the device to signal the eventfds of the first "count" vectors.  A count
+//             of 0 disables message-signalled interrupts altogether.
+//=================================================================================================
+void VfioInterface::setIrqs(int count)
+{
+    // The eventfds follow the header
+    std::vector<uint8_t> buffer(sizeof(vfio_irq_set) + count * sizeof(int32_t));
+    vfio_irq_set* set = (vfio_irq_set*)buffer.data();
+
+    set->argsz = buffer.size();
+    set->flags = (count ? VFIO_IRQ_SET_DATA_EVENTFD : VFIO_IRQ_SET_DATA_NONE)
+               | VFIO_IRQ_SET_ACTION_TRIGGER;
+    set->index = irqIndex_;
+    set->start = 0;
+    set->count = count;
+    for (int i=0; i<count; ++i) ((int32_t*)set->data)[i] = vector_[i].eventfd;
+
+    if (ioctl(devicefd_, VFIO_DEVICE_SET_IRQS, set) < 0)
+    {
+        throwRuntime("Can't %s message-signalled interrupts", count ? "enable" : "disable");
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// start() - Hands the vectors to the device and starts a dispatch thread for each one
+//=================================================================================================
+void VfioInterface::start()
+{
+    // If we're already running, there is nothing to do
+    if (isRunning()) return;
+
+    // If there's a device, it has to be told which eventfd to signal for each vector
+    if (devicefd_ >= 0)
+    {
+        if ((int)vector_.size() > vectorsSupported_)
+        {
+            throwRuntime("Device supports %d vectors, %d requested", vectorsSupported_, (int)vector_.size());
+        }
+        setIrqs(vector_.size());
+    }
+
+    // Create the eventfd that tells every thread to exit
+    stopfd_ = eventfd(0, EFD_CLOEXEC);
+    if (stopfd_ < 0) throwRuntime("Can't create eventfd");
+    stopping_ = false;
+
+    // Spawn the dispatch threads
+    for (auto& vector : vector_)
+    {
+        threads_.push_back(std::thread(&VfioInterface::dispatchVector, this, vector));
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// stop() - Wakes every dispatch thread, waits for them to exit, and disables the vectors
+//=================================================================================================
+void VfioInterface::stop()
+{
+    uint64_t one = 1;
+
+    // If we're not running, there's nothing to do
+    if (stopfd_ < 0) return;
+
+    // Tell the threads to exit and wake them up
+    stopping_ = true;
+    if (write(stopfd_, &one, sizeof one) != sizeof one) perror("VfioInterface::stop");
+
+    // Wait for all of them to exit
+    for (auto& th : threads_) if (th.joinable()) th.join();
+    threads_.clear();
+
+    // Release the "stop" eventfd
+    close(stopfd_);
+    stopfd_ = -1;
+
+    // And make the device stop signalling our eventfds
+    if (devicefd_ >= 0) setIrqs(0);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// dispatchVector() - Waits for messages on one vector and services that vector's IRQs
+//=================================================================================================
+void VfioInterface::dispatchVector(vector_t vector)
+{
+    uint64_t notification;
+    pollfd   fds[2] = {{vector.eventfd, POLLIN, 0}, {stopfd_, POLLIN, 0}};
+
+    while (true)
+    {
+        // Wait for the vector to be signalled (or to be told to stop)
+        if (poll(fds, 2, -1) < 0) continue;
+        if (stopping_) break;
+        if (!(fds[0].revents & POLLIN)) continue;
+
+        // Consume the notification
+        if (read(vector.eventfd, &notification, sizeof notification) != sizeof notification) continue;
+        vector.handler->noteWakeup();
+        TraceRing::record(TRACE_WAKEUP, 0, (uint32_t)notification);
+
+        // A message only arrives when the vector goes from idle to active, so if we stopped
+        // with IRQs possibly still pending, we have to go back for them before we wait
+        while (vector.handler->topLevelHandler(vector.irqGroup) && !stopping_);
+
+        // There's nothing to re-enable, but this records the end-to-end time
+        vector.handler->noteReenabled(readTsc());
+        TraceRing::record(TRACE_REENABLE);
+    }
+}
+//=================================================================================================
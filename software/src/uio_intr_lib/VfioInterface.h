@@ -0,0 +1,126 @@
+//=================================================================================================
+// VfioInterface.h - Defines an interface to the Linux VFIO subsystem that receives MSI or MSI-X
+//                   interrupts from a PCI device, one eventfd per vector
+//=================================================================================================
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <map>
+#include "IntrControlBase.h"
+
+//-------------------------------------------------------------------
+// Each vector serves a group of IRQs and has a dispatch context of
+// its own: an eventfd, a thread that waits on it, and an interrupt
+// handler whose topLevelHandler() only services the IRQs in that
+// group.  Message-signalled interrupts are never masked by the
+// kernel, so unlike legacy interrupts through UIO there's nothing
+// to re-enable after each one.
+//
+// Every vector needs its own IntrControlBase object, each of them
+// initialized with the same registers.  They share the shadows of
+// the mask and global-enable registers, so the IRQs can be masked
+// and unmasked through any of them.  A message is only sent when
+// a vector's request goes from idle to active, so each dispatch
+// context drains its IRQs until none are pending before it waits
+// again.  Setting a coalescing budget of more than one pass saves
+// the extra call to topLevelHandler() that confirms that.
+//
+// For testing without hardware, each vector can be given an eventfd
+// stand-in (e.g. from IntrControllerModel::addVector()) instead of
+// calling open().
+//-------------------------------------------------------------------
+class VfioInterface
+{
+public:
+
+    // Default constructor
+    VfioInterface() {}
+
+    // Destructor - Stops the dispatch threads, disables the vectors and releases the device
+    ~VfioInterface();
+
+    // No copy or assignment constructor - objects of this class can't be copied
+    VfioInterface (const VfioInterface&) = delete;
+    VfioInterface& operator= (const VfioInterface&) = delete;
+
+    // Opens the PCI device at "bdf" (e.g. "0000:01:00.0"), which must be bound to vfio-pci
+    void        open(std::string bdf);
+
+    // Returns the userspace address of one of the device's BARs
+    uint8_t*    bar(int index);
+
+    // Maps "size" bytes at "buffer" (which must be page-aligned) for DMA by the device, and
+    // returns the bus address the device should use to reach it.  Bus addresses are handed
+    // out from the ranges the IOMMU says are usable, which leave out the MSI window and
+    // anything beyond the IOMMU's address width.
+    uint64_t    mapDma(void* buffer, size_t size);
+
+    // Unmaps a buffer that mapDma() mapped at bus address "iova"
+    void        unmapDma(uint64_t iova);
+
+    // Assigns the IRQs in "irqGroup" to the next vector, serviced by "handler".  If "eventfd"
+    // is supplied, it stands in for the vector.  We use a duplicate of it, so the caller still
+    // owns the one it passed (IntrControllerModel closes its stand-ins itself).
+    void        addVector(uint32_t irqGroup, IntrControlBase* handler, int eventfd = -1);
+
+    // Returns the number of vectors the device supports (0 if no device is open)
+    int         vectorsSupported() {return vectorsSupported_;}
+
+    // Hands the vectors to the device and starts a dispatch thread for each one
+    void        start();
+
+    // Stops and joins the dispatch threads and takes the vectors back from the device
+    void        stop();
+
+    // Returns true if the dispatch threads are running
+    bool        isRunning() {return !threads_.empty();}
+
+protected:
+
+    // One of these exists for every vector
+    struct vector_t
+    {
+        uint32_t         irqGroup;
+        IntrControlBase* handler;
+        int              eventfd;
+    };
+
+    // This runs in each dispatch thread
+    void        dispatchVector(vector_t vector);
+
+    // Tells the device which eventfds to signal (or, if "count" is 0, to stop signalling)
+    void        setIrqs(int count);
+
+    // Fetches the ranges of bus addresses that the IOMMU can map
+    void        loadIovaRanges();
+
+    // The VFIO container, group, and device file descriptors
+    int         containerfd_ = -1, groupfd_ = -1, devicefd_ = -1;
+
+    // VFIO_PCI_MSIX_IRQ_INDEX or VFIO_PCI_MSI_IRQ_INDEX, and how many vectors it has
+    int         irqIndex_ = -1;
+    int         vectorsSupported_ = 0;
+
+    // The BARs we've mapped, and their sizes
+    uint8_t*    bar_[6] = {};
+    size_t      barSize_[6] = {};
+
+    // The ranges of bus addresses that are free, as start -> end (exclusive), the size of each
+    // buffer that's mapped for DMA, by bus address, and the IOMMU's smallest page size
+    std::map<uint64_t, uint64_t> freeIova_, dmaSize_;
+    uint64_t    iovaPageSize_ = 4096;
+
+    // One entry per vector, and one dispatch thread per vector
+    std::vector<vector_t>    vector_;
+    std::vector<std::thread> threads_;
+
+    // Writing to this eventfd wakes every dispatch thread so that it can exit
+    int         stopfd_ = -1;
+
+    // This is set to true when the dispatch threads should exit
+    std::atomic<bool> stopping_{false};
+};
+//-------------------------------------------------------------------
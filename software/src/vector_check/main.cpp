@@ -0,0 +1,374 @@
+//=================================================================================================
+// vector_check - Checks that several IntrControlBase objects pointed at the same interrupt
+//                controller, the way VfioInterface uses one per MSI vector, don't undo each
+//                other's changes to the controller's registers, including the IRQs that storm
+//                control has masked, that a fence through one of them waits for a write
+//                through the other, that VfioInterface delivers every interrupt raised on
+//                the model's stand-in vectors, that the model interrupts the host again
+//                when it re-enables interrupts with some still pending, and that a UioReactor
+//                delivers every interrupt raised on several models' stand-in devices
+//
+// This runs against IntrControllerModel, so it needs no hardware.  Each check prints a line,
+// and the exit code is 0 if they all passed and 2 if any of them failed.
+//=================================================================================================
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <poll.h>
+#include <thread>
+#include <vector>
+#include <stdexcept>
+#include "IntrControllerModel.h"
+#include "IntrControlBase.h"
+#include "VfioInterface.h"
+#include "UioReactor.h"
+#include "CpuUtil.h"
+
+//================================================================================
+// The index of the mask register of the interrupt controller
+//================================================================================
+enum {REG_IRQ_MASK = 2};
+//================================================================================
+
+
+//================================================================================
+// This is the interrupt handler of one vector.  It just counts.
+//================================================================================
+class VectorHandler : public IntrControlBase
+{
+public:
+
+    std::atomic<uint64_t> delivered[32] = {};
+
+protected:
+
+    virtual void isr(uint32_t pending, int IRQ, uint32_t count)
+    {
+        bump(delivered[IRQ], count);
+    }
+};
+//================================================================================
+
+
+//================================================================================
+// A model whose mask register takes a while to be written, the way a write
+// is still on its way across PCIe after the CPU has issued it
+//================================================================================
+class SlowMaskModel : public IntrControllerModel
+{
+public:
+
+    void writeReg(int index, uint32_t value) override
+    {
+        if (index == REG_IRQ_MASK) usleep(50000);
+        IntrControllerModel::writeReg(index, value);
+    }
+};
+//================================================================================
+
+
+//================================================================================
+// Global variables
+//================================================================================
+int failures = 0;
+//================================================================================
+
+
+//================================================================================
+// check() - Reports the result of one check
+//================================================================================
+static void check(const char* what, bool ok)
+{
+    printf("%-60s %s\n", what, ok ? "pass" : "FAIL");
+    if (!ok) ++failures;
+}
+//================================================================================
+
+
+//================================================================================
+// checkMasks() - Two handlers change the mask of one controller, one after the
+//                other and then from many threads at once
+//================================================================================
+static void checkMasks()
+{
+    IntrControllerModel model(32);
+    VectorHandler       a, b;
+
+    a.initialize(&model);
+    b.initialize(&model);
+
+    // Changes made through one handler are seen by the other
+    a.setIrqMask(0x3);
+    b.unmaskIrqs(0xC);
+    a.maskIrqs(0x1);
+    check("changes through either handler are merged",
+          model.readReg(REG_IRQ_MASK) == 0xE && a.getIrqMask() == 0xE && b.getIrqMask() == 0xE);
+
+    // Each of 8 threads owns 4 IRQs and toggles them through one handler or the other,
+    // finishing with the even-numbered ones unmasked
+    a.setIrqMask(0);
+    std::vector<std::thread> threads;
+    for (int t=0; t<8; ++t) threads.emplace_back([&, t]()
+    {
+        VectorHandler& h    = (t & 1) ? b : a;
+        uint32_t       irqs = 0xFu << (4 * t);
+        for (int i=0; i<10000; ++i)
+        {
+            h.unmaskIrqs(irqs);
+            h.maskIrqs(irqs & 0xAAAAAAAA);
+        }
+    });
+    for (auto& th : threads) th.join();
+
+    check("concurrent changes through both handlers are all kept",
+          model.readReg(REG_IRQ_MASK) == 0x55555555 && a.getIrqMask() == 0x55555555);
+}
+//================================================================================
+
+
+//================================================================================
+// checkFence() - One handler fences a mask change while the other handler is
+//                in the middle of writing the mask register
+//================================================================================
+static void checkFence()
+{
+    SlowMaskModel model;
+    VectorHandler a, b;
+
+    a.initialize(&model);
+    b.initialize(&model);
+
+    // "a" starts a slow write of the mask, and while it's on its way, "b" changes the mask
+    // and fences.  Once the fence returns, the controller has to have b's change.
+    std::thread writer([&]() {a.setIrqMask(0x1);});
+    usleep(10000);
+    b.unmaskIrqs(0x2, false);
+    b.fence();
+    bool ok = (model.readReg(REG_IRQ_MASK) == 0x3);
+    writer.join();
+
+    check("a fence waits for a change that another thread is writing", ok);
+}
+//================================================================================
+
+
+//================================================================================
+// checkStorms() - One handler masks a storming IRQ while the other keeps serving
+//                 its own IRQ and changing the mask
+//================================================================================
+static void checkStorms()
+{
+    IntrControllerModel model(32);
+    VectorHandler       a, b;
+
+    a.initialize(&model);
+    b.initialize(&model);
+
+    // "a" serves IRQ 0 and "b" serves IRQ 1.  The first poll comes after the hold window has
+    // ended, so the storming IRQ stays masked for half a second and is then released.
+    b.setStormLimit(1, 10000, 0, 500000, 100);
+    a.setIrqMask(0x3);
+    a.setGlobalEnable(true);
+
+    // Storm IRQ 1 until "b" masks it, while IRQ 0 ticks along
+    uint64_t deadline = nowNs() + 2000000000ull;
+    while ((b.getStormIrqs() & 0x2) == 0 && nowNs() < deadline)
+    {
+        model.pulse(0x2, 1000);
+        model.raise(0x1);
+        a.topLevelHandler(0x1);
+        b.topLevelHandler(0x2);
+    }
+    check("the storming IRQ is masked", b.getStormIrqs() == 0x2);
+    check("masking it leaves the other handler's IRQ enabled", model.readReg(REG_IRQ_MASK) == 0x1);
+
+    // A mask change through the other handler mustn't unmask the storming IRQ
+    a.unmaskIrqs(0x4);
+    check("a mask change through the other handler keeps it masked",
+          model.readReg(REG_IRQ_MASK) == 0x5 && a.getIrqMask() == 0x7);
+
+    // The other handler's IRQ is still delivered during the storm
+    uint64_t before = a.delivered[0];
+    model.pulse(0x2, 1000);
+    model.raise(0x1);
+    a.topLevelHandler(0x1);
+    check("the other handler's IRQ is delivered during the storm", a.delivered[0] == before + 1);
+
+    // Once the storm is over, the IRQ is unmasked again along with everything else
+    deadline = nowNs() + 3000000000ull;
+    while (b.getStormIrqs() && nowNs() < deadline) usleep(10000);
+    check("the storming IRQ is unmasked once the storm is over",
+          b.getStormIrqs() == 0 && model.readReg(REG_IRQ_MASK) == 0x7);
+}
+//================================================================================
+
+
+//================================================================================
+// checkVfio() - Runs VfioInterface with two vectors on the model's stand-ins, and
+//               checks that every interrupt raised is delivered by the handler of
+//               the vector that serves it
+//================================================================================
+static void checkVfio()
+{
+    const uint32_t LOW = 0x0000FFFF, HIGH = 0xFFFF0000;
+    const int      RAISES = 100000;
+
+    IntrControllerModel model(32);
+    VectorHandler       a, b;
+    uint64_t            raised[32] = {};
+
+    a.initialize(&model);
+    b.initialize(&model);
+    a.setIrqMask(0xFFFFFFFF);
+    a.setGlobalEnable(true);
+
+    // Every vector has to exist before any IRQ is raised
+    {
+        VfioInterface vfio;
+        vfio.addVector(LOW,  &a, model.addVector(LOW));
+        vfio.addVector(HIGH, &b, model.addVector(HIGH));
+        vfio.start();
+
+        // Raise IRQs on both vectors, sometimes two at once
+        for (int i=0; i<RAISES; ++i)
+        {
+            uint32_t irqs = (1u << (i % 32)) | ((i & 7) ? 0 : (1u << ((i * 7) % 32)));
+            model.raise(irqs);
+            for (int irq=0; irq<32; ++irq) if (irqs & (1u << irq)) ++raised[irq];
+        }
+
+        // Give the dispatch threads a moment to catch up
+        uint64_t deadline = nowNs() + 2000000000ull;
+        while (nowNs() < deadline)
+        {
+            bool caughtUp = true;
+            for (int irq=0; irq<32; ++irq)
+            {
+                VectorHandler& h = (LOW & (1u << irq)) ? a : b;
+                if (h.delivered[irq] < raised[irq]) caughtUp = false;
+            }
+            if (caughtUp) break;
+            usleep(1000);
+        }
+    }
+
+    // Each IRQ was delivered exactly as often as it was raised, and only by its own vector
+    bool ok = true;
+    for (int irq=0; irq<32; ++irq)
+    {
+        bool low = LOW & (1u << irq);
+        ok = ok && (low ? a : b).delivered[irq] == raised[irq] && (low ? b : a).delivered[irq] == 0;
+    }
+    check("every interrupt is delivered on the vector that serves it", ok);
+}
+//================================================================================
+
+
+//================================================================================
+// checkReassert() - The host takes an interrupt notification, but stops before
+//                   it gets to the IRQ (as when its coalescing budget runs out),
+//                   then re-enables interrupts in the config-space
+//================================================================================
+static void checkReassert()
+{
+    IntrControllerModel model(32);
+    VectorHandler       handler;
+    uint64_t            signals;
+    uint8_t             command = 0;
+
+    handler.initialize(&model);
+    handler.setIrqMask(1);
+    handler.setGlobalEnable(true);
+
+    model.raise(1);
+    if (read(model.uioFd(), &signals, sizeof signals) != sizeof signals) throw std::runtime_error("Can't read the uio stand-in");
+
+    // The IRQ that's still pending should interrupt the host as soon as it re-enables
+    if (pwrite(model.configFd(), &command, 1, 5) != 1) throw std::runtime_error("Can't write the config-space stand-in");
+    pollfd pfd = {model.uioFd(), POLLIN, 0};
+    check("re-enabling with IRQs pending interrupts the host again", poll(&pfd, 1, 1000) == 1);
+}
+//================================================================================
+
+
+//================================================================================
+// checkReactor() - Registers several models with one reactor, raises interrupts
+//                  on all of them, and checks that each device's handler saw
+//                  every interrupt raised on it
+//================================================================================
+static void checkReactor()
+{
+    const int DEVICES = 6, THREADS = 2, RAISES = 100000;
+
+    IntrControllerModel model[DEVICES];
+    VectorHandler       handler[DEVICES];
+    uint64_t            raised[DEVICES][32] = {};
+
+    {
+        UioReactor reactor;
+
+        // The reactor owns the file descriptors it's given, and so does the model
+        for (int d=0; d<DEVICES; ++d)
+        {
+            handler[d].initialize(&model[d]);
+            handler[d].setIrqMask(0xFFFFFFFF);
+            handler[d].setGlobalEnable(true);
+            reactor.addDevice(dup(model[d].uioFd()), dup(model[d].configFd()), &handler[d]);
+        }
+        reactor.start(THREADS);
+
+        // Go round the devices, raising a different IRQ each time
+        for (int i=0; i<RAISES; ++i)
+        {
+            int d = i % DEVICES, irq = (i / DEVICES) % 32;
+            model[d].raise(1u << irq);
+            ++raised[d][irq];
+        }
+
+        // Give the reactor threads a moment to catch up
+        uint64_t deadline = nowNs() + 2000000000ull;
+        while (nowNs() < deadline)
+        {
+            bool caughtUp = true;
+            for (int d=0; d<DEVICES; ++d) for (int irq=0; irq<32; ++irq)
+            {
+                if (handler[d].delivered[irq] < raised[d][irq]) caughtUp = false;
+            }
+            if (caughtUp) break;
+            usleep(1000);
+        }
+    }
+
+    bool ok = true;
+    for (int d=0; d<DEVICES; ++d) for (int irq=0; irq<32; ++irq)
+    {
+        ok = ok && handler[d].delivered[irq] == raised[d][irq];
+    }
+    check("the reactor delivers every interrupt on every device", ok);
+}
+//================================================================================
+
+
+//================================================================================
+// main() - Runs the checks
+//================================================================================
+int main(int argc, char** argv)
+{
+    try
+    {
+        checkMasks();
+        checkFence();
+        checkStorms();
+        checkVfio();
+        checkReassert();
+        checkReactor();
+    }
+    catch(const std::exception& e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        exit(1);
+    }
+
+    return failures ? 2 : 0;
+}
+//================================================================================